@@ -19,6 +19,10 @@ public:
 		kCmdFlagAdmin = 1u << 2,
 		kCmdFlagMultiKey = 1u << 3,
 		kCmdFlagNoKey = 1u << 4,
+		// 可能增加内存的写命令: 超出 maxmemory 且淘汰不掉 key 时拒绝执行
+		kCmdFlagDenyOom = 1u << 5,
+		// key 个数由 first_key 前一个参数 (numkeys) 给出, 之后的参数 (如 LIMIT) 不是 key; 忽略 last_key
+		kCmdFlagMovableKeys = 1u << 6,
 	};
 
 	struct CommandMeta {
@@ -44,6 +48,8 @@ public:
 	                                const CommandMeta& meta);
 	std::string Execute(const std::vector<NanoObj>& args, CommandContext* ctx = nullptr);
 	const CommandMeta* FindMeta(absl::string_view name) const;
+	// 最后一个 key 的下标 (含), 调用方保证 meta.first_key > 0; 路由、MULTI 入队和 WATCH 共用
+	static size_t LastKeyIndex(const CommandMeta& meta, const std::vector<NanoObj>& args);
 	std::string BuildCommandInfoResponse() const;
 
 private:
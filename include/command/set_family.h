@@ -23,6 +23,10 @@ public:
 	static std::string SInter(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string SUnion(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string SDiff(const std::vector<NanoObj>& args, CommandContext* ctx);
+	static std::string SInterStore(const std::vector<NanoObj>& args, CommandContext* ctx);
+	static std::string SUnionStore(const std::vector<NanoObj>& args, CommandContext* ctx);
+	static std::string SDiffStore(const std::vector<NanoObj>& args, CommandContext* ctx);
+	static std::string SInterCard(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string SScan(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string SRandMember(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string SMove(const std::vector<NanoObj>& args, CommandContext* ctx);
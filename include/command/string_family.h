@@ -15,6 +15,7 @@ public:
 	static std::string Set(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string Get(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string Del(const std::vector<NanoObj>& args, CommandContext* ctx);
+	static std::string Unlink(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string Exists(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string MSet(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string MGet(const std::vector<NanoObj>& args, CommandContext* ctx);
@@ -33,6 +34,7 @@ public:
 	static std::string Select(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string Keys(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string FlushDB(const std::vector<NanoObj>& args, CommandContext* ctx);
+	static std::string FlushAll(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static std::string DBSize(const std::vector<NanoObj>& args, CommandContext* ctx);
 	static void ClearDatabase(CommandContext* ctx);
 	static std::string Hello(const std::vector<NanoObj>& args);
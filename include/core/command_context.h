@@ -1,11 +1,14 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <string>
 
 class EngineShard;
 class EngineShardSet;
 class Database;
 class Connection;
+class NanoObj;
 
 struct CommandContext {
 	EngineShard* local_shard = nullptr;
@@ -14,6 +17,11 @@ struct CommandContext {
 	size_t db_index = 0;
 	Connection* connection = nullptr;
 	Database* legacy_db = nullptr;
+	// 路由时已经为某个 key 参数算好的 KeyHash, 处理函数通过 HashOf() 复用
+	const NanoObj* hashed_key = nullptr;
+	uint64_t hashed_key_hash = 0;
+	// 连接的回复缓冲区: 非空时聚合回复直接追加到这里, 处理函数返回空串 (见 ReplyTarget)
+	std::string* reply_buffer = nullptr;
 
 	CommandContext() = default;
 
@@ -39,6 +47,18 @@ struct CommandContext {
 		return shard_count <= 1;
 	}
 
+	void SetKeyHash(const NanoObj* key, uint64_t hash) {
+		hashed_key = key;
+		hashed_key_hash = hash;
+	}
+	uint64_t HashOf(const NanoObj& key) const;
+
+	// ReplyBuilder 的写入目标: 由连接发起时写连接的缓冲区, 否则 (MULTI、测试、分片内部调用) 写 local。
+	// 写入目标缓冲区之后不能再返回错误, 校验要放在开始写之前
+	std::string* ReplyTarget(std::string* local) const {
+		return reply_buffer != nullptr ? reply_buffer : local;
+	}
+
 	// 直接返回远程分片的 Database* 会破坏无共享架构, 使用 shard_set->Await/Add 在所属线程执行
 	Database* GetShardDB(size_t shard_id) const;
 };
@@ -1,26 +1,40 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <new>
 #include <type_traits>
+#include <utility>
 
 #include "unordered_dense.h"
 
 namespace {
 constexpr uint64_t kInitialSegmentCount = 1;
 constexpr uint64_t kDefaultFixedBucketCount = 16;
-constexpr float kSplitThreshold = 0.8f;
 } // namespace
 
+// DashTable 是一个 Dragonfly 风格的可扩展哈希表:
+// - 目录 (segment_directory) 用哈希高位选择 segment, segment 满时分裂
+// - 每个 segment 是一块连续内存: 头部 + N 个常规 bucket + 若干 stash bucket
+// - 每个 bucket 以 64 字节对齐, 首个 cache line 存放 1 字节指纹, 用 SSE2 一次比较 16 个
+// - 查找只探测 home bucket、相邻 bucket, 以及 (有溢出时) stash bucket
+// - 分裂默认是增量的: 新 segment 立即接管目录, 旧条目随后续写操作和空闲 tick 分批迁移
+// - 删除后 buddy segment 都低于低水位时合并, 目录随之减半; Clear() 释放全部 segment
 template <typename K, typename V>
 class DashTable {
 public:
 	using PreModifyCallback = std::function<void(size_t dir_idx)>;
 
+	static constexpr uint32_t kSlotsPerBucket = 14;
+	static constexpr uint32_t kStashBucketCount = 4;
+
+	// fixed_bucket_count 是每个 segment 的常规 bucket 数 (向上取整到 2 的幂)
 	explicit DashTable(uint64_t initial_segment_count = kInitialSegmentCount,
-	                   uint64_t max_segment_size = kDefaultFixedBucketCount);
+	                   uint64_t fixed_bucket_count = kDefaultFixedBucketCount);
 
 	~DashTable();
 
@@ -36,6 +50,101 @@ public:
 	bool Erase(const K& key);
 	void Clear();
 
+	// hash 必须等于 Hash(key); 调用方已经算过哈希时 (例如分片路由) 用这些重载避免重复计算
+	void Insert(const K& key, uint64_t hash, V&& value);
+	void Insert(const K& key, uint64_t hash, const V& value);
+	const V* Find(const K& key, uint64_t hash) const;
+	bool Erase(const K& key, uint64_t hash);
+
+	// 返回可修改的值指针; 与 Insert/Erase 一样先触发 PreModifyCallback
+	V* FindMutable(const K& key, uint64_t hash);
+	// key 不存在时插入默认构造的 V; second 表示是否新插入
+	std::pair<V*, bool> FindOrInsert(const K& key, uint64_t hash);
+
+	// 批量接口: 先对一批 key 发出预取, 再依次探测, 让各 key 的 cache miss 重叠而不是串行。
+	// keys/hashes/results 都有 count 个元素, hashes[i] 必须等于 Hash(*keys[i])。
+	void FindBatch(size_t count, const K* const* keys, const uint64_t* hashes, const V** results) const;
+	// on_erase(hash, value) 在条目析构前调用一次; 返回删除的条目数。
+	// 每个 key 只探测一次: 在探测到的槽位上直接回调并删除
+	template <typename FUNC>
+	size_t EraseBatch(size_t count, const K* const* keys, const uint64_t* hashes, FUNC&& on_erase) {
+		size_t erased = 0;
+		for (size_t base = 0; base < count; base += kBatchPrefetchSize) {
+			const size_t end = std::min(count, base + kBatchPrefetchSize);
+			for (size_t i = base; i < end; ++i) {
+				Prefetch(hashes[i]);
+			}
+			for (size_t i = base; i < end; ++i) {
+				const uint64_t seg_idx = GetSegmentIndex(hashes[i]);
+				if (pre_modify_cb_) {
+					pre_modify_cb_(seg_idx);
+				}
+				MigrateStep(kSplitStepBuckets);
+				Segment* segment = PrepareSegment(seg_idx, hashes[i]);
+				SlotPos pos;
+				if (!FindSlot(*segment, *keys[i], hashes[i], &pos)) {
+					continue;
+				}
+				on_erase(hashes[i], static_cast<const V&>(segment->Buckets()[pos.bucket].SlotAt(pos.slot)->value));
+				EraseAt(segment, hashes[i], pos);
+				TryMerge(seg_idx);
+				++erased;
+			}
+		}
+		return erased;
+	}
+
+	// 按哈希删除: 删除第一个 Hash(key) == hash 且 pred(value) 为 true 的条目, 返回是否删除。
+	// 只知道哈希而没有 key 时使用 (过期索引); 只有指纹匹配的槽位才重新计算哈希
+	template <typename PRED>
+	bool EraseByHash(uint64_t hash, PRED&& pred) {
+		const uint64_t seg_idx = GetSegmentIndex(hash);
+		if (pre_modify_cb_) {
+			pre_modify_cb_(seg_idx);
+		}
+		MigrateStep(kSplitStepBuckets);
+		Segment* segment = PrepareSegment(seg_idx, hash);
+		Bucket* buckets = segment->Buckets();
+		const uint32_t home = HomeBucket(*segment, hash);
+		auto try_bucket = [&](uint32_t b) {
+			uint32_t mask = buckets[b].MatchFingerprint(Fingerprint(hash));
+			while (mask != 0) {
+				const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+				mask &= mask - 1;
+				const Slot* slot = buckets[b].SlotAt(i);
+				if (Hash(slot->key) == hash && pred(static_cast<const V&>(slot->value))) {
+					EraseAt(segment, hash, SlotPos {b, i});
+					TryMerge(seg_idx);
+					return true;
+				}
+			}
+			return false;
+		};
+		if (try_bucket(home) || try_bucket((home + 1) & segment->bucket_mask)) {
+			return true;
+		}
+		if (buckets[home].stash_refs > 0) {
+			for (uint32_t b = segment->RegularBucketCount(); b < segment->TotalBucketCount(); ++b) {
+				if (try_bucket(b)) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// 预取 hash 对应的 segment 头和 home bucket 的指纹行; 只读目录, 不产生依赖的访存
+	void Prefetch(uint64_t hash) const {
+		const Segment* seg = segment_directory[GetSegmentIndex(hash)].get();
+		const uint32_t home = static_cast<uint32_t>(hash >> 8) & (fixed_bucket_count - 1);
+		__builtin_prefetch(seg, 0, 3);
+		__builtin_prefetch(seg->Buckets() + home, 0, 3);
+	}
+
+	static uint64_t Hash(const K& key) {
+		return ankerl::unordered_dense::hash<K> {}(key);
+	}
+
 	uint64_t Size() const;
 	uint64_t SegmentCount() const;
 	uint64_t BucketCount() const;
@@ -43,11 +152,86 @@ public:
 	template <typename FUNC>
 	void ForEach(FUNC&& func) const {
 		for (size_t i = 0; i < segment_directory.size(); i = NextSeg(i)) {
-			const auto& segment = segment_directory[i];
-			for (const auto& [key, value] : segment->table) {
-				func(key, value);
+			segment_directory[i]->ForEachSlot(func);
+		}
+	}
+
+	// 无状态游标遍历: 从 cursor 开始访问至少 max_entries 个条目 (以 home bucket 为单位, 可能略多),
+	// 返回下一次调用的游标, 返回 0 表示遍历结束。
+	// 游标 = home bucket << 32 | 哈希前缀 (按目录深度归一到 32 位), 按 bucket 为主序、前缀为次序访问。
+	// 所有 segment 的 bucket 数相同, 条目的 home bucket 不随分裂/合并改变; 每个 segment 覆盖一段连续的前缀,
+	// 分裂只把一段切开, 游标仍落在段的边界上。合并后游标可能落在合并段的中间, 这时从该段开头重扫当前 bucket:
+	// 上一半在这个 bucket 上已返回过, 只会重复, 下一半还没访问, 不会遗漏。
+	// 因此整个遍历期间都存在的 key 至少返回一次。
+	template <typename FUNC>
+	uint64_t Scan(uint64_t cursor, size_t max_entries, FUNC&& func) const {
+		const uint32_t prefix_shift = 32 - global_depth;
+		auto bucket = static_cast<uint32_t>(cursor >> 32);
+		uint64_t dir_idx = (cursor & 0xffffffffu) >> prefix_shift;
+		// 稀疏表上空 bucket 也计入预算, 单次调用不会扫完整个表
+		const size_t max_visits = std::max<size_t>(max_entries, 1) * 10;
+		size_t emitted = 0;
+		size_t visited = 0;
+		while (bucket < fixed_bucket_count && emitted < max_entries && visited < max_visits) {
+			if (dir_idx >= segment_directory.size()) {
+				++bucket;
+				dir_idx = 0;
+				continue;
 			}
+			const Segment& seg = *segment_directory[dir_idx];
+			emitted += ScanHomeBucket(seg, bucket, func);
+			++visited;
+			dir_idx = NextSeg(seg.segment_id);
 		}
+		if (dir_idx >= segment_directory.size()) {
+			++bucket;
+			dir_idx = 0;
+		}
+		if (bucket >= fixed_bucket_count) {
+			return 0;
+		}
+		return (static_cast<uint64_t>(bucket) << 32) | (dir_idx << prefix_shift);
+	}
+
+	// 均匀随机取一个条目, 表为空时返回 {nullptr, nullptr}。
+	// 随机选目录项和槽位, 只接受 segment 的首个目录项和已占用的槽位: 每个已占用槽位被选中的概率相同。
+	// 表很稀疏时拒绝采样可能连续失败, 超过 kRandomSampleTries 次后从随机 segment 顺序找下一个条目。
+	template <typename URBG>
+	std::pair<const K*, const V*> RandomEntry(URBG& rng) const {
+		const uint32_t total_buckets = segment_directory[0]->TotalBucketCount();
+		auto pick = [&rng](uint64_t bound) {
+			return static_cast<uint64_t>(rng() % bound);
+		};
+
+		for (uint32_t attempt = 0; attempt < kRandomSampleTries; ++attempt) {
+			const uint64_t dir_idx = pick(segment_directory.size());
+			const Segment& seg = *segment_directory[dir_idx];
+			if (seg.segment_id != dir_idx) {
+				continue;
+			}
+			const Bucket& bucket = seg.Buckets()[pick(total_buckets)];
+			const uint32_t slot = static_cast<uint32_t>(pick(kSlotsPerBucket));
+			if ((bucket.busy & (1u << slot)) != 0) {
+				const Slot* entry = bucket.SlotAt(slot);
+				return {&entry->key, &entry->value};
+			}
+		}
+
+		size_t dir_idx = segment_directory[pick(segment_directory.size())]->segment_id;
+		for (size_t visited = 0; visited < segment_directory.size();) {
+			const Segment& seg = *segment_directory[dir_idx];
+			const Bucket* buckets = seg.Buckets();
+			for (uint32_t b = 0; b < seg.TotalBucketCount(); ++b) {
+				if (buckets[b].busy != 0) {
+					const Slot* entry = buckets[b].SlotAt(static_cast<uint32_t>(__builtin_ctz(buckets[b].busy)));
+					return {&entry->key, &entry->value};
+				}
+			}
+			const size_t next = NextSeg(dir_idx);
+			visited += next - dir_idx;
+			dir_idx = next < segment_directory.size() ? next : 0;
+		}
+		return {nullptr, nullptr};
 	}
 
 	template <typename FUNC>
@@ -55,9 +239,7 @@ public:
 		if (dir_idx >= segment_directory.size()) {
 			return;
 		}
-		for (const auto& [key, value] : segment_directory[dir_idx]->table) {
-			func(key, value);
-		}
+		segment_directory[dir_idx]->ForEachSlot(func);
 	}
 
 	void SetPreModifyCallback(PreModifyCallback cb) {
@@ -68,6 +250,10 @@ public:
 		pre_modify_cb_ = nullptr;
 	}
 
+	bool HasPreModifyCallback() const {
+		return static_cast<bool>(pre_modify_cb_);
+	}
+
 	size_t DirSize() const {
 		return segment_directory.size();
 	}
@@ -84,30 +270,240 @@ public:
 		return NextSeg(sid);
 	}
 
+	// 分批销毁整张表 (FLUSH ASYNC): 从目录尾部逐个摘下 segment, 本次释放约 max_entries 个条目后停止。
+	// 释放前对每个条目调用 func(key, value), 调用方可以把大对象移走另行分批释放。
+	// 只用于已经摘下、不再查找的表; 返回本次释放的条目数, DirSize() 为 0 时表已释放完
+	template <typename FUNC>
+	size_t ReleaseStep(size_t max_entries, FUNC&& func) {
+		migration_.reset();
+		size_t released = 0;
+		while (!segment_directory.empty() && released < max_entries) {
+			std::shared_ptr<Segment> seg = std::move(segment_directory.back());
+			segment_directory.pop_back();
+			// 目录中还有别的项指向它时留给最后一项
+			if (seg.use_count() > 1) {
+				continue;
+			}
+			seg->ForEachSlotMutable(func);
+			released += seg->size;
+			size_ -= seg->size;
+		}
+		return released;
+	}
+
+	// 推进进行中的分裂, 最多迁移 max_buckets 个 bucket; 返回是否仍有待迁移的条目
+	bool MigrateStep(uint32_t max_buckets);
+
+	bool IsMigrating() const {
+		return migration_ != nullptr;
+	}
+
+	// 关闭后分裂在触发它的 Insert 内同步完成
+	void SetIncrementalSplit(bool enabled) {
+		incremental_split_ = enabled;
+		if (!enabled && migration_) {
+			FinishMigration();
+		}
+	}
+
 private:
+	struct Slot {
+		K key;
+		V value;
+	};
+
+	// 首个 cache line: 指纹 + 占用位图 + 溢出计数; 之后是 kSlotsPerBucket 个槽位
+	struct alignas(64) Bucket {
+		uint8_t fingerprints[16];
+		uint16_t busy;
+		// 以本 bucket 为 home 却被放进 stash 的条目数, 为 0 时查找可跳过 stash
+		uint8_t stash_refs;
+		alignas(64) unsigned char storage[kSlotsPerBucket][sizeof(Slot)];
+
+		Slot* SlotAt(uint32_t i) {
+			return std::launder(reinterpret_cast<Slot*>(storage[i]));
+		}
+		const Slot* SlotAt(uint32_t i) const {
+			return std::launder(reinterpret_cast<const Slot*>(storage[i]));
+		}
+		bool Full() const {
+			return busy == (1u << kSlotsPerBucket) - 1;
+		}
+		uint32_t MatchFingerprint(uint8_t fp) const;
+	};
+
+	static_assert(alignof(Slot) <= 64, "slot alignment exceeds a cache line");
+
+	// segment 头部和 bucket 数组在同一次分配中, 查找路径只经过 目录 -> segment -> bucket
 	struct Segment {
-		ankerl::unordered_dense::map<K, V, ankerl::unordered_dense::hash<K>> table;
 		uint8_t local_depth;
 		uint32_t segment_id;
+		uint32_t bucket_mask;
+		uint64_t size = 0;
 		uint64_t version = 0;
 
-		explicit Segment(uint8_t depth, uint32_t id, uint64_t fixed_bucket_count)
-		    : table(fixed_bucket_count), local_depth(depth), segment_id(id) {
-			table.max_load_factor(1.0f);
+		Segment(uint8_t depth, uint32_t id, uint32_t regular_buckets);
+		~Segment();
+
+		static std::shared_ptr<Segment> Create(uint8_t depth, uint32_t id, uint32_t regular_buckets);
+
+		uint32_t RegularBucketCount() const {
+			return bucket_mask + 1;
+		}
+		uint32_t TotalBucketCount() const {
+			return RegularBucketCount() + kStashBucketCount;
+		}
+		Bucket* Buckets() {
+			return reinterpret_cast<Bucket*>(reinterpret_cast<char*>(this) + HeaderSize());
+		}
+		const Bucket* Buckets() const {
+			return reinterpret_cast<const Bucket*>(reinterpret_cast<const char*>(this) + HeaderSize());
+		}
+		static constexpr size_t HeaderSize() {
+			return (sizeof(Segment) + alignof(Bucket) - 1) & ~(alignof(Bucket) - 1);
+		}
+
+		template <typename FUNC>
+		void ForEachSlot(FUNC& func) const {
+			const Bucket* buckets = Buckets();
+			for (uint32_t b = 0; b < TotalBucketCount(); ++b) {
+				uint32_t mask = buckets[b].busy;
+				while (mask != 0) {
+					const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+					mask &= mask - 1;
+					const Slot* slot = buckets[b].SlotAt(i);
+					func(slot->key, slot->value);
+				}
+			}
+		}
+
+		template <typename FUNC>
+		void ForEachSlotMutable(FUNC& func) {
+			Bucket* buckets = Buckets();
+			for (uint32_t b = 0; b < TotalBucketCount(); ++b) {
+				uint32_t mask = buckets[b].busy;
+				while (mask != 0) {
+					const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+					mask &= mask - 1;
+					Slot* slot = buckets[b].SlotAt(i);
+					func(slot->key, slot->value);
+				}
+			}
 		}
 	};
 
-	uint64_t GetSegmentIndex(const K& key) const;
+	struct SlotPos {
+		uint32_t bucket;
+		uint32_t slot;
+	};
+
+	// 进行中的分裂: target 已在目录中接管上半部分, 但属于它的条目可能仍留在 source 里。
+	// 同一时间最多一个; 再次分裂前先完成当前迁移。
+	struct Migration {
+		std::shared_ptr<Segment> source;
+		std::shared_ptr<Segment> target;
+		std::vector<bool> done;
+		uint32_t cursor = 0;
+	};
+
+	// 每次写操作顺带迁移的 bucket 数
+	static constexpr uint32_t kSplitStepBuckets = 2;
+	// RandomEntry 拒绝采样的最大尝试次数
+	static constexpr uint32_t kRandomSampleTries = 64;
+	// 批量接口一次预取的 key 数, 太大时早先预取的行会在探测前被挤出 L1
+	static constexpr size_t kBatchPrefetchSize = 16;
+	// 两个 buddy 的条目数都低于容量的 1/kMergeLowWaterDivisor 时合并
+	static constexpr uint32_t kMergeLowWaterDivisor = 4;
+
+	static uint8_t Fingerprint(uint64_t hash) {
+		return static_cast<uint8_t>(hash);
+	}
+	static uint32_t HomeBucket(const Segment& seg, uint64_t hash) {
+		return static_cast<uint32_t>(hash >> 8) & seg.bucket_mask;
+	}
+
+	bool FindSlot(const Segment& seg, const K& key, uint64_t hash, SlotPos* pos) const;
+	template <typename BusyFn>
+	static uint32_t ChooseBucket(const Segment& seg, uint32_t home, BusyFn&& busy_of);
+	bool ReserveSlot(Segment* seg, uint64_t hash, SlotPos* pos);
+	void ReleaseSlot(Segment* seg, uint64_t hash, SlotPos pos);
+	V* InsertNew(Segment* seg, uint64_t hash, const K& key, V&& value);
+	void EraseAt(Segment* seg, uint64_t hash, SlotPos pos);
+	void TryMerge(uint64_t dir_idx);
+	bool MergeInto(Segment* keep, Segment* drop);
+	void ShrinkDirectory();
+
+	uint64_t GetSegmentIndex(uint64_t hash) const;
+
+	// 访问 seg 中 home 为 b 的全部条目: 它们只可能在 b、相邻 bucket 或 stash 里。
+	// seg 处于迁移中时, 属于它的条目可能还在对端 segment, 两边都按归属过滤一遍。
+	template <typename FUNC>
+	size_t ScanHomeBucket(const Segment& seg, uint32_t b, FUNC& func) const {
+		const Segment* partner = nullptr;
+		if (migration_ != nullptr) {
+			if (&seg == migration_->source.get()) {
+				partner = migration_->target.get();
+			} else if (&seg == migration_->target.get()) {
+				partner = migration_->source.get();
+			}
+		}
+		size_t emitted = VisitHome(seg, seg, b, partner != nullptr, func);
+		if (partner != nullptr) {
+			emitted += VisitHome(*partner, seg, b, true, func);
+		}
+		return emitted;
+	}
+
+	template <typename FUNC>
+	size_t VisitHome(const Segment& phys, const Segment& owner, uint32_t b, bool check_owner, FUNC& func) const {
+		const Bucket* buckets = phys.Buckets();
+		size_t emitted = 0;
+		auto visit = [&](uint32_t bid) {
+			uint32_t mask = buckets[bid].busy;
+			while (mask != 0) {
+				const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+				mask &= mask - 1;
+				const Slot* slot = buckets[bid].SlotAt(i);
+				const uint64_t hash = Hash(slot->key);
+				if (HomeBucket(phys, hash) != b) {
+					continue;
+				}
+				if (check_owner && segment_directory[GetSegmentIndex(hash)].get() != &owner) {
+					continue;
+				}
+				func(slot->key, slot->value);
+				++emitted;
+			}
+		};
+		visit(b);
+		visit((b + 1) & phys.bucket_mask);
+		if (buckets[b].stash_refs > 0) {
+			for (uint32_t s = phys.RegularBucketCount(); s < phys.TotalBucketCount(); ++s) {
+				visit(s);
+			}
+		}
+		return emitted;
+	}
+
 	void SplitSegment(uint32_t seg_id);
-	bool NeedSplit(uint32_t seg_id) const;
+	void MoveBucket(Segment* source, Segment* target, uint32_t b);
+	void MigrateBucket(uint32_t b);
+	void FinishMigration();
+	Segment* PrepareSegment(uint64_t seg_idx, uint64_t hash);
 	size_t NextSeg(size_t sid) const;
 
 	// Extendible hashing directory slots can alias the same segment until a split,
 	// so ownership must be shared across multiple directory entries.
 	std::vector<std::shared_ptr<Segment>> segment_directory;
 	uint8_t global_depth;
-	uint64_t max_segment_size;
+	// 构造时的目录深度, 合并和目录收缩不会低于它
+	uint8_t min_depth_;
+	uint32_t fixed_bucket_count;
 	PreModifyCallback pre_modify_cb_;
+	std::unique_ptr<Migration> migration_;
+	bool incremental_split_ = true;
+	// 条目总数, 随 ReserveSlot/ReleaseSlot 增减; 分裂迁移和合并不改变它
+	uint64_t size_ = 0;
 
 public:
 	uint8_t GetGlobalDepth() const {
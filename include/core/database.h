@@ -4,15 +4,63 @@
 #include <optional>
 #include <memory>
 #include <array>
+#include <random>
 #include <vector>
 #include <cstdint>
 #include "core/nano_obj.h"
 
 #include "core/dashtable.h"
+#include "core/expire_index.h"
+#include "core/lazy_free.h"
+#include "core/memory_budget.h"
+#include "core/watch_registry.h"
+
+// 主表中的值: 对象、过期时间和淘汰用的访问信息放在同一个槽位里 (共 24 字节)。
+// obj 带 NanoObj::kFlagExpire 时 expire_at_ms 才有效, 没有 TTL 的 key 只检查这一位, 不读时钟。
+// 截止时间只用 48 位 (有符号毫秒, 上限 kMaxExpireAtMs = 2^47-1, 约 4460 年), 剩下 16 位存访问信息:
+//   LRU: 最近访问时间, 秒, 取低 16 位
+//   LFU: 高 8 位为上次衰减的时间 (分钟, 取低 8 位), 低 8 位为对数访问计数
+// 访问信息不影响值本身, 只读查找也会更新, 所以是 mutable。
+struct DbValue {
+	static constexpr int64_t kMaxExpireAtMs = (int64_t {1} << 47) - 1;
+
+	NanoObj obj;
+	int64_t expire_at_ms : 48;
+	mutable uint64_t access : 16;
+
+	DbValue() : expire_at_ms(0), access(0) {
+	}
+
+	bool HasExpire() const {
+		return obj.HasExpire();
+	}
+	bool IsExpired(int64_t now_ms) const {
+		return obj.HasExpire() && expire_at_ms <= now_ms;
+	}
+};
+
+static_assert(sizeof(DbValue) == 24);
+
+// INFO keyspace 的一行: 全部由计数器维护, 不遍历表
+struct KeyspaceStats {
+	size_t keys = 0;
+	size_t expires = 0;
+	int64_t avg_ttl_ms = 0;
+};
+
+// 一轮主动过期的统计: sampled 是从过期索引取出的条目数, expired 是其中确实被删除的
+struct ExpireCycleStats {
+	size_t sampled = 0;
+	size_t expired = 0;
+	// 某个 DB 因达到单轮上限而停下, 还有到期条目没处理
+	bool more_due = false;
+};
 
 class Database {
 public:
 	static constexpr size_t kNumDBs = 16;
+	// 每次淘汰在每个 DB 中采样的 key 数
+	static constexpr size_t kEvictionSamples = 5;
 
 	explicit Database();
 	~Database() = default;
@@ -22,42 +70,85 @@ public:
 	bool Del(const NanoObj& key);
 	bool Exists(const NanoObj& key);
 	size_t KeyCount();
+	KeyspaceStats GetKeyspaceStats(size_t db_index) const;
 	bool Select(size_t db_index);
 	size_t CurrentDB() const {
 		return current_db;
 	}
 	void ClearCurrentDB();
 	void ClearAll();
+	// FLUSHDB / FLUSHALL ASYNC: 立即换上空表, 旧表和过期索引交给后台分批释放
+	void ClearCurrentDBAsync();
+	void ClearAllAsync();
 	std::vector<std::string> Keys();
+	// 从当前 DB 均匀随机取一个未过期的 key, 不遍历整个表
+	std::optional<std::string> RandomKey();
+	// 增量遍历当前 DB, 每次大约 count 个 key, 跳过已过期的; 返回 0 表示遍历结束
+	uint64_t Scan(uint64_t cursor, size_t count, std::vector<std::string>* keys);
 
 	const NanoObj* Find(const NanoObj& key);
 	bool Expire(const NanoObj& key, int64_t ttl_ms);
 	bool Persist(const NanoObj& key);
 	int64_t TTL(const NanoObj& key);
-	size_t ActiveExpireCycle(size_t max_keys_per_db = 32);
+	// 从各 DB 的过期索引取出最多 max_keys_per_db 个到期条目并删除, 返回删除数
+	size_t ActiveExpireCycle(size_t max_keys_per_db = 32, ExpireCycleStats* stats = nullptr);
+	// 空闲时推进各表进行中的增量分裂, 返回是否还有未完成的迁移
+	bool SplitMigrationStep(uint32_t max_buckets_per_table);
+	// 后台 fiber 调用: 释放约 max_items 个延迟释放的元素, 返回是否还有待释放的
+	bool LazyFreeStep(size_t max_items);
+	bool HasPendingLazyFree() const;
+	// 本分片上被 WATCH 的 key 的版本戳
+	WatchRegistry& Watches() {
+		return watches;
+	}
+	// 按策略从各 DB 采样 kEvictionSamples 个 key, 删除其中最该淘汰的一个; 没有候选时返回 false
+	bool EvictOne(EvictionPolicy policy);
 
 	bool Set(const NanoObj& key, const NanoObj& value);
 	bool Set(const NanoObj& key, NanoObj&& value);
 
+	// 带预先算好的 key 哈希 (KeyHash) 的版本: 路由时算过一次的哈希可以直接复用
+	std::optional<std::string> Get(const NanoObj& key, uint64_t hash);
+	bool Set(const NanoObj& key, uint64_t hash, const NanoObj& value);
+	bool Set(const NanoObj& key, uint64_t hash, NanoObj&& value);
+	// 写入值并在同一个槽位上处理 TTL, 只探测一次表: kKeep 保留未过期的原 TTL, kClear 清除,
+	// kSet 设为 ttl_ms 毫秒后过期 (ttl_ms > 0)
+	enum class SetTtl : uint8_t { kKeep, kClear, kSet };
+	bool Set(const NanoObj& key, uint64_t hash, NanoObj&& value, SetTtl ttl_mode, int64_t ttl_ms = 0);
+	bool Del(const NanoObj& key, uint64_t hash);
+	bool Exists(const NanoObj& key, uint64_t hash);
+	const NanoObj* Find(const NanoObj& key, uint64_t hash);
+	bool Expire(const NanoObj& key, uint64_t hash, int64_t ttl_ms);
+	bool Persist(const NanoObj& key, uint64_t hash);
+	int64_t TTL(const NanoObj& key, uint64_t hash);
+
+	// 多 key 批量版本 (MGET/EXISTS/DEL/MSET): 一批 key 的表访问先统一预取再探测。
+	// out[i] 为 nullptr 表示 key 不存在或已过期
+	void FindBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes, const NanoObj** out);
+	size_t DelBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes);
+	// MSET 语义: 覆盖值并清除 TTL
+	void SetBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes, const NanoObj* const* values);
+	// UNLINK: 与 DEL 一样立即从表中删除, 但大对象交给 lazy free 队列, 不在命令里析构
+	size_t UnlinkBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes);
+	// 只发出预取; 流水线在执行前对已解析命令的 key 调用
+	void Prefetch(size_t db_index, uint64_t hash) const;
+
 	template <typename Func>
 	void ForEachInDB(size_t db_index, Func&& func) const {
 		if (db_index >= kNumDBs || tables[db_index] == nullptr) {
 			return;
 		}
 		const int64_t now_ms = CurrentTimeMs();
-		tables[db_index]->ForEach([db_index, now_ms, &func, this](const NanoObj& key, const NanoObj& value) {
-			const int64_t* expire_at_ms = expire_tables[db_index]->Find(key);
-			if (expire_at_ms != nullptr && *expire_at_ms <= now_ms) {
+		tables[db_index]->ForEach([now_ms, &func](const NanoObj& key, const DbValue& value) {
+			if (value.IsExpired(now_ms)) {
 				return;
 			}
-			const int64_t expire_ms = (expire_at_ms == nullptr ? 0 : *expire_at_ms);
-			func(key, value, expire_ms);
+			func(key, value.obj, value.HasExpire() ? value.expire_at_ms : 0);
 		});
 	}
 
 public:
-	using Table = DashTable<NanoObj, NanoObj>;
-	using ExpireTable = DashTable<NanoObj, int64_t>;
+	using Table = DashTable<NanoObj, DbValue>;
 
 	Table* GetTable(size_t db_index) {
 		if (db_index >= kNumDBs) {
@@ -66,20 +157,45 @@ public:
 		return tables[db_index].get();
 	}
 
-	ExpireTable* GetExpireTable(size_t db_index) {
-		if (db_index >= kNumDBs) {
-			return nullptr;
-		}
-		return expire_tables[db_index].get();
-	}
-
 private:
 
 	static int64_t CurrentTimeMs();
-	bool IsExpiredInDB(size_t db_index, const NanoObj& key, int64_t now_ms) const;
-	void PruneExpiredInDB(size_t db_index, const NanoObj& key, int64_t now_ms);
+	// now_ms + ttl_ms, 钳到 kMaxExpireAtMs
+	static int64_t ExpireAtFromTtl(int64_t now_ms, int64_t ttl_ms);
+	// 内存估算中一个 key 占用的字节数: 固定的槽位/key 开销加上字符串值的堆内存,
+	// 容器内部的内存留给 MemoryBudget::Calibrate 修正
+	static int64_t EntryBytes(const NanoObj& value);
+	void ChargeMemory(size_t db_index, int64_t bytes);
+	// 查找未过期的条目; 已过期的条目在这里被惰性删除
+	const DbValue* FindLive(size_t db_index, const NanoObj& key, uint64_t hash);
+	DbValue* FindLiveMutable(size_t db_index, const NanoObj& key, uint64_t hash);
+	size_t PruneExpiredInDB(size_t db_index);
+	// 记录一次访问; 只有开启 LRU/LFU 淘汰时才读时钟
+	void TouchAccess(const DbValue& value, bool inserted);
+	bool Unlink(size_t db_index, const NanoObj& key, uint64_t hash);
+	void DetachDB(size_t db_index);
+	uint64_t EvictionScore(EvictionPolicy policy, const DbValue& value, int64_t now_ms) const;
+	// 所有增减 TTL 的路径都经过这两个函数, 保持 expiring_counts、expire_at_sums 和过期索引一致;
+	// TTL 被清除、修改或 key 被删除时用旧截止时间 Untrack
+	void TrackExpire(size_t db_index, uint64_t hash, int64_t expire_at_ms);
+	void UntrackExpire(size_t db_index, uint64_t hash, int64_t expire_at_ms);
 
 	std::array<std::unique_ptr<Table>, kNumDBs> tables;
-	std::array<std::unique_ptr<ExpireTable>, kNumDBs> expire_tables;
+	// 每个 DB 中带 TTL 的 key 数, 为 0 时跳过过期扫描
+	std::array<size_t, kNumDBs> expiring_counts {};
+	// 带 TTL 的 key 的截止时间之和, 用于 avg_ttl; 截止时间最大为 kMaxExpireAtMs (2^47-1),
+	// 当前时间戳约 2^41, 几百万个 key 就会超出 int64, 所以用 128 位累加
+	std::array<__int128, kNumDBs> expire_at_sums {};
+	// 每个 DB 的过期索引, 每个带 TTL 的 key 一个条目 (只存哈希), 随 TTL 变化和删除同步增删
+	std::array<ExpireIndex, kNumDBs> expire_indexes;
+	// 每个 DB 按 EntryBytes 记下的字节数, FLUSH 时整体从内存估算中扣掉
+	std::array<int64_t, kNumDBs> used_bytes {};
+	// FLUSH ASYNC 摘下的表和过期索引, 以及 UNLINK 摘下的大对象; 由 LazyFreeStep 分批释放
+	std::vector<std::unique_ptr<Table>> detached_tables;
+	std::vector<ExpireIndex> detached_expire_indexes;
+	LazyFreeQueue lazy_free;
+	WatchRegistry watches {kNumDBs};
+	// RandomKey、淘汰采样和 LFU 计数共用; Database 只在所属分片线程上访问
+	std::mt19937_64 random_engine {std::random_device {}()};
 	size_t current_db = 0;
 };
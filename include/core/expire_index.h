@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "core/unordered_dense.h"
+
+// 按截止时间分桶的过期索引: 桶号 = expire_at_ms / kBucketMs, 桶按时间有序。
+// 主动过期只访问已到期的桶, 回收代价与到期 key 数成正比, 与表大小无关。
+//
+// 只记录 key 的哈希, 不复制 key; 每个带 TTL 的 key 恰好一个条目, 修改 TTL、PERSIST、删除 key 时
+// 由 Database 按 (哈希, 旧截止时间) 移除旧条目, 索引大小始终等于带 TTL 的 key 数。
+// 取出的条目由调用方按哈希回主表查找, 确实已过期才删除。
+// 两个 key 的 64 位哈希相同且截止时间落在同一个桶时共用一个条目 (计数), 取出时按较早的截止时间;
+// 这只会让其中一个 key 晚些由惰性过期回收, 不影响正确性。
+class ExpireIndex {
+public:
+	static constexpr int64_t kBucketMs = 64;
+
+	struct Entry {
+		uint64_t hash;
+		int64_t expire_at_ms;
+	};
+
+	void Add(uint64_t hash, int64_t expire_at_ms);
+	// 条目不存在时什么也不做 (已被 PopDue 取走)
+	void Remove(uint64_t hash, int64_t expire_at_ms);
+
+	// 取出截止时间不晚于 now_ms 的条目, 最多 max_entries 个, 追加到 out。
+	// 返回 true 表示因为达到 max_entries 而停下, 可能还有到期条目。
+	bool PopDue(int64_t now_ms, size_t max_entries, std::vector<Entry>* out);
+
+	size_t Size() const {
+		return size_;
+	}
+
+	void Clear();
+	// 分批释放 (FLUSH ASYNC 摘下的索引), 最多释放 max_entries 个条目, 返回实际释放数
+	size_t ReleaseStep(size_t max_entries);
+
+private:
+	struct Slot {
+		int64_t expire_at_ms;
+		uint32_t count;
+	};
+	using Bucket = ankerl::unordered_dense::map<uint64_t, Slot>;
+
+	std::map<int64_t, Bucket> buckets_;
+	size_t size_ = 0;
+};
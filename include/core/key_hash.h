@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "core/unordered_dense.h"
+
+// key 的 64 位哈希。分片路由 (Shard)、Database 和 DashTable 都使用同一个函数,
+// 因此每个 key 参数只需计算一次, 再通过 *_(key, hash) 重载一路传下去。
+// 带 hash tag 的 key 例外: 路由使用 tag 的哈希 (见 server/sharding.h)。
+// 整数编码的 NanoObj 按十进制字符串哈希, KeyHash(NanoObj) 与 KeyHash(原始字符串) 相同。
+inline uint64_t KeyHash(std::string_view key) {
+	return ankerl::unordered_dense::hash<std::string_view> {}(key);
+}
+
+inline uint64_t KeyHash(const NanoObj& key) {
+	return ankerl::unordered_dense::hash<NanoObj> {}(key);
+}
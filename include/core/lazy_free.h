@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/nano_obj.h"
+
+// 大对象的延迟释放队列: UNLINK / FLUSH ASYNC 先把值从表里摘下放进来, 命令立即返回,
+// 由分片的后台 fiber 调用 Step 分批释放, 每批的代价有上限, 不会长时间占住 vCPU。
+// 只在所属分片线程上访问。
+class LazyFreeQueue {
+public:
+	// 元素数不超过该值的对象直接释放, 排队不划算 (与 Redis 的 LAZYFREE_THRESHOLD 相同)
+	static constexpr size_t kLazyFreeThreshold = 64;
+
+	// 释放 obj 的代价, 按容器元素数计; 字符串和整数为 1
+	static size_t FreeEffort(const NanoObj& obj);
+	static bool ShouldFreeLazily(const NanoObj& obj) {
+		return FreeEffort(obj) > kLazyFreeThreshold;
+	}
+
+	void Push(NanoObj&& obj);
+
+	// 最多释放约 max_items 个元素, 返回实际释放数
+	size_t Step(size_t max_items);
+
+	bool Empty() const {
+		return objects_.empty() && set_members_.empty() && hash_fields_.empty();
+	}
+	size_t PendingObjects() const {
+		return objects_.size();
+	}
+
+private:
+	std::deque<NanoObj> objects_;
+	// set / hash 先 extract 出底层的元素数组, 再从尾部逐个释放
+	std::vector<std::string> set_members_;
+	std::vector<std::pair<std::string, std::string>> hash_fields_;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+class Database;
+
+enum class EvictionPolicy : uint8_t {
+	kNoEviction = 0,
+	kAllKeysLru,
+	kAllKeysLfu,
+	kVolatileLru,
+	kVolatileTtl,
+};
+
+std::optional<EvictionPolicy> ParseEvictionPolicy(std::string_view name);
+const char* EvictionPolicyName(EvictionPolicy policy);
+
+// maxmemory 和淘汰策略: 进程级配置, 由启动参数或 CONFIG SET 在任意线程写入, 分片线程只读。
+//
+// 每个分片的预算是 maxmemory / 分片数, 用量按分片线程统计: 使用 mimalloc 时每个 vCPU 线程
+// 有自己的堆, 分片的 key 和连接缓冲区都在本线程分配, 用量取本线程堆中在用块的字节数;
+// 否则退回 mallinfo2 的进程用量按分片数均摊。统计堆要遍历所有页, 只在过期 tick 上做 (Calibrate),
+// 两次统计之间由 Database 在增删 key 时调用 Charge 记下字节差, 写路径上读用量是 O(1) 的。
+// 超出时各分片只从自己的表里淘汰, 不需要跨线程协调。
+class MemoryBudget {
+public:
+	// 每条写命令最多淘汰的 key 数, 限制单条命令的延迟
+	static constexpr size_t kMaxEvictionsPerWrite = 64;
+
+	static void SetMaxMemory(uint64_t bytes);
+	static uint64_t MaxMemory();
+	static void SetPolicy(EvictionPolicy policy);
+	static EvictionPolicy Policy();
+	static void SetNumShards(size_t num_shards);
+	// maxmemory / 分片数, 未设置 maxmemory 时为 0
+	static uint64_t ShardBudget();
+
+	// 当前分片线程的用量估算: 上次 Calibrate 的结果加上此后 Charge 的字节差
+	static uint64_t UsedMemory();
+	static bool OverLimit();
+	// Database 增删 key 时记录当前线程用量的变化 (新增为正, 删除为负)
+	static void Charge(int64_t bytes);
+	// 遍历当前线程的堆重新统计用量, 修正 Charge 估不到的部分 (容器内部、连接缓冲区等)
+	static void Calibrate();
+	// 过期 tick 调用: 设置了 maxmemory 且距上次统计超过约 100ms 时才重新统计
+	static void CalibrateIfDue();
+
+	// 写命令执行前调用: 本分片超出预算时按策略从 db 淘汰一批 key。
+	// 返回 false 表示仍然超出且一个 key 都淘汰不掉 (noeviction 或没有候选), 写命令应返回 OOM
+	static bool ReclaimForWrite(Database* db);
+};
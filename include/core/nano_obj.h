@@ -51,6 +51,8 @@ public:
 		EXTERNAL_TAG = 18,
 		JSON_TAG = 19,
 		SBF_TAG = 20,
+		// 借用的字符串: 布局同 SMALL_STR_TAG, 但 ptr 指向别人的内存 (如 RESP 读缓冲区), 析构时不释放
+		VIEW_TAG = 21,
 		NULL_TAG = 31,
 	};
 
@@ -68,6 +70,14 @@ public:
 	static NanoObj FromInt(int64_t val);
 	static NanoObj FromKey(std::string_view key);
 
+	// 变为借用 str 的字符串, 不拷贝; 调用方保证 str 比本对象及其使用者活得长。
+	// 借用对象被拷贝或移动时都会生成自有副本, 所以存进 Database 的值永远不会悬空。
+	// 只用于解析出的命令参数, str 长度不超过 UINT16_MAX
+	void SetView(std::string_view str);
+	bool IsView() const {
+		return taglen == VIEW_TAG;
+	}
+
 	char* PrepareStringBuffer(size_t len);
 	void FinalizePreparedString();
 	bool MaybeConvertToInt();
@@ -95,6 +105,13 @@ public:
 	uint8_t GetTag() const;
 	uint8_t GetFlag() const;
 
+	// flag 位: 该值带有 TTL, 过期时间与值一起存放在 Database 的 DbValue 中
+	static constexpr uint8_t kFlagExpire = 1 << 0;
+	bool HasExpire() const {
+		return (flag & kFlagExpire) != 0;
+	}
+	void SetExpireFlag(bool has_expire);
+
 	std::string_view GetStringView() const;
 	int64_t GetIntValue() const;
 
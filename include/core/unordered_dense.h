@@ -118,6 +118,7 @@
 
 // Forward declaration and include NanoObj for hash specialization
 #include "core/nano_obj.h"
+#include <charconv>
 
 namespace ankerl::unordered_dense {
 inline namespace ANKERL_UNORDERED_DENSE_NAMESPACE {
@@ -436,8 +437,11 @@ struct hash<NanoObj> {
 			auto sv = obj.GetStringView();
 			return detail::wyhash::hash(sv.data(), sv.size());
 		} else if (tag == 15) {
-			return detail::wyhash::hash(static_cast<std::uint64_t>(obj.GetIntValue()));
-		} else if (tag == 16) {
+			// 整数编码的 key 按十进制形式哈希, 与原始字符串的哈希一致 (见 core/key_hash.h)
+			char buf[24];
+			auto res = std::to_chars(buf, buf + sizeof(buf), obj.GetIntValue());
+			return detail::wyhash::hash(buf, static_cast<std::size_t>(res.ptr - buf));
+		} else if (tag == NanoObj::SMALL_STR_TAG || tag == NanoObj::VIEW_TAG) {
 			auto sv = obj.GetStringView();
 			return detail::wyhash::hash(sv.data(), sv.size());
 		}
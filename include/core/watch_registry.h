@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/container/flat_hash_map.h>
+
+// WATCH 使用的 key 版本戳。每个分片一份, 由该分片的 Database 持有, 只在所属分片线程上访问, 不需要加锁:
+// 只为该分片上被 WATCH 的 key 建立条目, 写命令在 key 所在分片上执行前调用 Touch 递增版本。
+// 没有任何连接 WATCH 时 Touch 只有一次原子读, 不影响写路径。
+//
+// 版本在执行写操作之前递增: EXEC 检查时版本未变, 说明此刻之前没有写入发生。
+class WatchRegistry {
+public:
+	explicit WatchRegistry(size_t num_dbs);
+	~WatchRegistry();
+
+	WatchRegistry(const WatchRegistry&) = delete;
+	WatchRegistry& operator=(const WatchRegistry&) = delete;
+
+	// 登记 key 并返回当前版本; 同一 key 可被多个连接登记, 按引用计数释放
+	uint64_t Watch(size_t db_index, std::string_view key);
+	void Unwatch(size_t db_index, std::string_view key);
+	uint64_t Version(size_t db_index, std::string_view key) const;
+
+	void Touch(size_t db_index, std::string_view key);
+	// FLUSHDB / FLUSHALL: 使本分片该 db (或所有 db) 上的 WATCH 全部失效
+	void TouchDb(size_t db_index);
+	void TouchAll();
+
+	// 所有分片上都没有被 WATCH 的 key
+	static bool Empty();
+
+private:
+	struct Entry {
+		uint64_t version = 0;
+		uint32_t watchers = 0;
+	};
+
+	std::vector<absl::flat_hash_map<std::string, Entry>> watched;
+	// 每个 db 的 FLUSH 次数, 计入 Version, 避免 FLUSH 时逐个递增
+	std::vector<uint64_t> db_epochs;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "core/nano_obj.h"
+
+// 把 RESP 回复直接追加到目标缓冲区, 每个元素不再先生成一个临时 std::string 再 +=。
+// 聚合回复 (HGETALL / SMEMBERS / LRANGE / MGET / KEYS ...) 用它逐项写入同一个缓冲区;
+// 由连接发起的命令 (本地执行或转发到其他分片) 直接写连接的 write_buffer, 此时 result 保持为空:
+//
+//   std::string result;
+//   ReplyBuilder reply(ctx->ReplyTarget(&result));
+//   reply.ArrayHeader(n);
+//   for (...) reply.BulkString(value);
+//   return result;
+class ReplyBuilder {
+public:
+	explicit ReplyBuilder(std::string* out_value) : out(out_value) {
+	}
+
+	void SimpleString(std::string_view s);
+	// 与 RESPParser::MakeError 相同, 自动加 "ERR " 前缀
+	void Error(std::string_view msg);
+	void Integer(int64_t value);
+	void BulkString(std::string_view s);
+	// 直接按 NanoObj 的编码写出, 不经过 ToString 拷贝
+	void BulkString(const NanoObj& value);
+	void NullBulkString();
+	void ArrayHeader(size_t count);
+	// 已经编码好的 RESP 片段 (如其他分片返回的回复)
+	void Raw(std::string_view resp) {
+		out->append(resp.data(), resp.size());
+	}
+	// 预先为接下来约 bytes 字节的回复扩容, 只在开始写一个大回复前调用一次
+	void Reserve(size_t bytes) {
+		out->reserve(out->size() + bytes);
+	}
+
+private:
+	void AppendLength(char prefix, int64_t value);
+
+	std::string* out;
+};
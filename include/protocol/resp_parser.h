@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 #include <photon/net/socket.h>
 #include "core/nano_obj.h"
@@ -22,12 +25,32 @@ public:
 
 	explicit RESPParser(photon::net::ISocketStream* stream) : stream(stream) {
 	}
+	~RESPParser() {
+		ReleaseBuffer();
+	}
+
+	RESPParser(const RESPParser&) = delete;
+	RESPParser& operator=(const RESPParser&) = delete;
+
+	// 解析状态机: 只消费已读入的字节, 不做任何 I/O。
+	// 命令不完整时消费掉全部数据并返回 NEED_MORE, 解析进度 (已解析的参数、当前 bulk 已拷贝的长度等)
+	// 保存在 parser 中, 下次读入后从断点继续, 不会重新解析已处理过的字节。
+	// 返回 OK 时 args 中较长的 bulk 参数可能借用读缓冲区 (见 NanoObj::SetView), 只在下一次读入之前有效
+	TryParseResult Parse(std::vector<NanoObj>& args);
 
+	// 读入接口: 调用方把数据写到 WritableData() 开始的至多 WritableSize() 字节, 再用 CommitRead 提交。
+	// 正在接收较大的 bulk 参数且缓冲区已消费完时, 返回的是参数自己的内存, 数据不再经过读缓冲区
+	char* WritableData();
+	size_t WritableSize() const;
+	void CommitRead(size_t n);
+
+	// 从 stream 读到一条完整命令为止; 出错或连接关闭时返回 -1
 	int ParseCommand(std::vector<NanoObj>& args);
 	TryParseResult TryParseCommandNoRead(std::vector<NanoObj>& args);
-	bool HasBufferedData() const {
-		return buffer_pos < buffer_size;
-	}
+	// 还有未消费的数据, 或有一条命令解析到一半
+	bool HasBufferedData() const;
+	// 没有待处理的输入时把读缓冲区还给本线程的缓冲区池, 下次读入时再取; 有输入时不做任何事并返回 false
+	bool ReleaseBuffer();
 
 	// NOLINTNEXTLINE(readability-identifier-naming)
 	int parse_command(std::vector<NanoObj>& args) {
@@ -67,7 +90,7 @@ public:
 
 	static std::string MakeSimpleString(const std::string& s);
 	static std::string MakeError(const std::string& msg);
-	static std::string MakeBulkString(const std::string& s);
+	static std::string MakeBulkString(std::string_view s);
 	static std::string MakeNullBulkString();
 	static std::string MakeInteger(int64_t value);
 	static std::string MakeArray(int64_t count);
@@ -81,7 +104,7 @@ public:
 		return MakeError(msg);
 	}
 	// NOLINTNEXTLINE(readability-identifier-naming)
-	static std::string make_bulk_string(const std::string& s) {
+	static std::string make_bulk_string(std::string_view s) {
 		return MakeBulkString(s);
 	}
 	// NOLINTNEXTLINE(readability-identifier-naming)
@@ -98,30 +121,45 @@ public:
 	}
 
 private:
-	int ParseArray(std::vector<NanoObj>& args);
-	int ParseInlineCommand(std::string_view line, std::vector<NanoObj>& args);
-	int ParseValue(ParsedValue& value);
-
-	char ReadChar();
-	std::string ReadLine();
-	std::string ReadBulkString(int64_t len);
-	int ReadBulkStringInto(int64_t len, NanoObj& out);
-	int FillBuffer();
+	enum class State { kStart, kArrayLen, kArgType, kBulkLen, kBulkData, kBulkCRLF, kSimpleArg, kInline };
 
-private:
-	int ReadLineView(std::string_view* out);
-	int ReadInlineLineView(char first_char, std::string_view* out);
-	void ConsumeCRLF(bool term_is_cr);
-
-	// Scratch buffers used when the line spans multiple recv() fills.
-	// These are reused across calls to avoid per-command allocations.
-	std::string scratch_line;
-	std::string scratch_inline;
+	int ParseInlineCommand(std::string_view line, std::vector<NanoObj>& args);
+	std::pair<const char*, bool> FindTerminator(const char* start, size_t avail) const;
+	// 取出一行 (不含行尾); 行不完整时把已有部分存入 partial_line 并返回 false
+	bool TakeLine(std::string_view* out);
+	void ResizeBuffer();
+	void BeginArg();
+	void FinishArg();
+	void FinishBulkData();
+	void MaterializePending();
+	TryParseResult Fail(std::vector<NanoObj>& args);
 
 	photon::net::ISocketStream* stream;
-	char buffer[8192];
+	// 读缓冲区在读入时从缓冲区池取出, 大小随读入量伸缩 (见 ResizeBuffer); 空闲时可以还回去
+	std::unique_ptr<char[]> buffer;
+	// buffer 中 CR / LF 的位图 (与 buffer 同一块内存), 每次读入后只扫描新增的字节; 行尾查找只查位图不再扫内存
+	uint64_t* terminator_bits = nullptr;
+	// 最近一次使用的缓冲区大小, 缓冲区还回池中后仍保留
+	size_t buffer_capacity = 0;
 	size_t buffer_pos = 0;
 	size_t buffer_size = 0;
-	bool allow_socket_read = true;
-	bool no_read_need_more = false;
+	bool read_filled_buffer = false;
+	size_t small_reads = 0;
+	// WritableData() 返回的是当前 bulk 参数的内存
+	bool direct_read = false;
+
+	State state = State::kStart;
+	// 当前命令已解析出的参数, 完整后整体交给调用方
+	std::vector<NanoObj> pending;
+	int64_t args_left = 0;
+	// 正在拷贝的 bulk 参数: 目标内存、总长度、已拷贝长度
+	char* bulk_data = nullptr;
+	size_t bulk_len = 0;
+	size_t bulk_copied = 0;
+	// bulk 内容之后还要跳过的 CRLF 字节数
+	size_t crlf_left = 0;
+	// 上一行以 CR 结尾而 LF 还没读到
+	bool skip_lf = false;
+	// 跨越多次读入的行, 复用以避免每条命令分配
+	std::string partial_line;
 };
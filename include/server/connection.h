@@ -4,6 +4,7 @@
 #include <string_view>
 #include <vector>
 #include <atomic>
+#include <sys/uio.h>
 #include <photon/net/socket.h>
 
 #include "core/nano_obj.h"
@@ -26,12 +27,19 @@ public:
 	void SendArray(const std::vector<std::string>& values);
 	bool SendResponse(std::string_view response);
 	void AppendResponse(std::string_view response);
+	// 大回复 (如大 value 的 GET) 整块移入待发送列表而不拷进 write_buffer, Flush 时与小回复一起 writev
+	void AppendResponse(std::string&& response);
 	bool Flush();
 	bool HasBufferedInput() const {
 		return parser.HasBufferedData();
 	}
 	size_t PendingResponseBytes() const {
-		return write_buffer.size();
+		return write_buffer.size() + pending_reply_bytes;
+	}
+	// 处理函数直接追加回复的缓冲区 (CommandContext::reply_buffer); 转发到其他分片时连接 fiber
+	// 在 Await 中等待, 目标分片写入期间不会有别人访问它
+	std::string* ReplyBuffer() {
+		return &write_buffer;
 	}
 
 	bool SetDBIndex(size_t index);
@@ -73,8 +81,21 @@ private:
 	size_t db_index = 0;
 	std::string client_name;
 	std::string last_command = "unknown";
+	// 大回复不拷进 write_buffer, 只记下它在 write_buffer 中的插入位置; Flush 时按位置把
+	// write_buffer 切成几段与大回复交替提交
+	struct PendingReply {
+		size_t buffer_offset = 0;
+		std::string data;
+	};
+
 	std::string write_buffer;
+	std::vector<PendingReply> pending_replies;
+	size_t pending_reply_bytes = 0;
+	std::vector<iovec> iovecs;
 	std::atomic<bool> close_requested {false};
 
+	// 读入一次数据; 出错或连接关闭时返回 false
+	bool ReadInput();
 	bool SendRaw(std::string_view data);
+	bool SendVectored();
 };
@@ -48,10 +48,29 @@ public:
 	// 初始化线程本地指针
 	void InitializeInThread();
 
+	// 多分片事务的分片锁 (仅限所属 vCPU 线程调用)。事务任务占住任务队列期间分片处于冻结状态,
+	// 本 vCPU 上不经任务队列、直接执行命令的 fiber 要先调用 WaitUntilUnfrozen。
+	// 事务自身的命令执行期间 (SetTransactionRunning(true)) 不算冻结。
+	void Freeze() {
+		frozen = true;
+	}
+	void Unfreeze() {
+		frozen = false;
+	}
+	void SetTransactionRunning(bool running) {
+		transaction_running = running;
+	}
+	bool IsFrozen() const {
+		return frozen && !transaction_running;
+	}
+	void WaitUntilUnfrozen();
+
 private:
 	size_t shard_id;
 	std::unique_ptr<Database> db;
 	TaskQueue task_queue;
+	bool frozen = false;
+	bool transaction_running = false;
 
 	static __thread EngineShard* tlocal_shard;
 };
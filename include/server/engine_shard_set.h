@@ -4,6 +4,11 @@
 #include <memory>
 #include <functional>
 #include <atomic>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 #include "server/engine_shard.h"
 #include "core/task_queue.h"
@@ -24,6 +29,42 @@ public:
 		return shards[shard_id]->GetTaskQueue()->Await(std::forward<F>(func));
 	}
 
+	// 并行分发: 同时向 shard_ids 中的每个分片投递 func(shard_id), 只等待一次全部完成,
+	// 代价约为一次跨分片往返而不是 shard_ids.size() 次。结果按 shard_ids 的顺序返回 (func 返回 void 时不收集)。
+	// func 会在多个分片线程上并发调用, 只能写各自独占的数据。
+	template <typename F>
+	auto AwaitAll(const std::vector<size_t>& shard_ids, F&& func) {
+		using RetType = std::invoke_result_t<F&, size_t>;
+		if constexpr (std::is_void_v<RetType>) {
+			RunOnShards(shard_ids, [&func](size_t index, size_t shard_id) {
+				(void)index;
+				func(shard_id);
+			});
+		} else {
+			// 先写入各自的 optional 再搬出, 避免 std::vector<bool> 这类共享存储的并发写
+			std::vector<std::optional<RetType>> slots(shard_ids.size());
+			RunOnShards(shard_ids, [&func, &slots](size_t index, size_t shard_id) {
+				slots[index].emplace(func(shard_id));
+			});
+			std::vector<RetType> results;
+			results.reserve(slots.size());
+			for (auto& slot : slots) {
+				results.push_back(std::move(*slot));
+			}
+			return results;
+		}
+	}
+
+	// 对所有分片执行 AwaitAll
+	template <typename F>
+	auto AwaitOnAll(F&& func) {
+		std::vector<size_t> shard_ids(shards.size());
+		for (size_t i = 0; i < shard_ids.size(); ++i) {
+			shard_ids[i] = i;
+		}
+		return AwaitAll(shard_ids, std::forward<F>(func));
+	}
+
 	// 发送任务不等待
 	template <typename F>
 	void Add(size_t shard_id, F&& func) {
@@ -43,6 +84,59 @@ public:
 	void Stop();
 
 private:
+	// 先把 task(i, shard_ids[i]) 投递到其他分片, 本线程所属分片的那一项直接在当前 fiber 执行,
+	// 然后在一个信号量上等待全部完成。任务引用调用方的栈, 所以即使出错也要等所有任务结束,
+	// 之后再重新抛出第一个异常。
+	template <typename Task>
+	void RunOnShards(const std::vector<size_t>& shard_ids, Task&& task) {
+		const size_t count = shard_ids.size();
+		std::vector<std::exception_ptr> exceptions(count);
+		photon::semaphore done_sem(0);
+		EngineShard* local_shard = EngineShard::Tlocal();
+		size_t local_index = count;
+		uint64_t dispatched = 0;
+
+		for (size_t i = 0; i < count; ++i) {
+			const size_t shard_id = shard_ids[i];
+			if (local_index == count && local_shard != nullptr && local_shard->ShardId() == shard_id) {
+				local_index = i;
+				continue;
+			}
+			const bool added = shards[shard_id]->GetTaskQueue()->Add([&task, &exceptions, &done_sem, i, shard_id]() {
+				try {
+					task(i, shard_id);
+				} catch (...) {
+					exceptions[i] = std::current_exception();
+				}
+				done_sem.signal(1);
+			});
+			if (added) {
+				++dispatched;
+			} else {
+				exceptions[i] = std::make_exception_ptr(std::runtime_error("shard task queue is closed"));
+			}
+		}
+
+		if (local_index != count) {
+			// 内联执行不经过任务队列, 需要自己遵守多分片事务的分片锁
+			local_shard->WaitUntilUnfrozen();
+			try {
+				task(local_index, shard_ids[local_index]);
+			} catch (...) {
+				exceptions[local_index] = std::current_exception();
+			}
+		}
+		if (dispatched > 0) {
+			done_sem.wait(dispatched);
+		}
+
+		for (const auto& exception : exceptions) {
+			if (exception) {
+				std::rethrow_exception(exception);
+			}
+		}
+	}
+
 	std::vector<std::unique_ptr<EngineShard>> shards;
 	std::atomic<bool> running {true};
 };
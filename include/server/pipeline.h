@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/nano_obj.h"
+
+class CommandRegistry;
+class Connection;
+class EngineShardSet;
+
+// 单 key 命令的路由结果; 哈希只算一次, 同时用于选分片、预取和目标分片上的表查找
+struct RoutedCommand {
+	const NanoObj* key = nullptr;
+	uint64_t key_hash = 0;
+	size_t target_shard = 0;
+	bool forward = false;
+};
+
+// 无 key、未知或 key 跨分片的命令返回 key == nullptr, 留在本分片执行
+RoutedCommand RouteCommand(const std::vector<NanoObj>& args, CommandRegistry& registry, size_t vcpu_index,
+                           size_t num_shards);
+
+// 从 begin 开始可以合并执行的连续单 key 命令 [begin, end): 遇到无 key 命令 (包括 QUIT、
+// 事务命令和 CLIENT PAUSE/KILL 等) 即结束, 所以同一段内不会有命令改变本连接的暂停或关闭状态
+size_t SquashedRunEnd(const std::vector<RoutedCommand>& routes, size_t begin, size_t batch_size);
+
+// 流水线中连续的单 key 命令 [begin, end) 按目标分片分组, 每个分片一跳执行完自己的那组,
+// 各分片并行 (本分片的那组在当前 fiber 内联执行)。同一 key 总在同一分片, 组内保持原顺序,
+// 所以对该连接而言结果与逐条执行相同。responses[i - begin] 为第 i 条命令的回复。
+// connection 只在本分片内联执行时传给命令, 可以为 nullptr
+void ExecuteSquashed(std::vector<std::vector<NanoObj>>& batch, const std::vector<RoutedCommand>& routes, size_t begin,
+                     size_t end, EngineShardSet* shard_set, size_t num_shards, size_t conn_db_index,
+                     Connection* connection, std::vector<std::string>* responses);
@@ -1,15 +1,101 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <string_view>
 #include <cstdint>
-#include <absl/hash/hash.h>
+#include <optional>
+#include <vector>
+
+#include "core/key_hash.h"
+
+// 用哈希的中间位选分片: 低 8 位是 DashTable 指纹, 紧接着是 bucket 下标, 高位选择 segment。
+// 若复用这些位, 同一分片内的 key 会在表内聚集。
+inline size_t ShardOfHash(uint64_t hash, size_t num_shards) {
+	if (num_shards <= 1) {
+		return 0;
+	}
+	return static_cast<uint32_t>(hash >> 24) % num_shards;
+}
+
+// Redis Cluster 风格的 hash tag: key 中第一个 '{' 与其后第一个 '}' 之间的内容非空时,
+// 只用这段内容选分片, 于是 {user:1}:name 和 {user:1}:age 一定落在同一分片。
+// 没有 hash tag 时返回整个 key。
+inline std::string_view KeyHashTag(std::string_view key) {
+	const size_t open = key.find('{');
+	if (open == std::string_view::npos) {
+		return key;
+	}
+	const size_t close = key.find('}', open + 1);
+	if (close == std::string_view::npos || close == open + 1) {
+		return key;
+	}
+	return key.substr(open + 1, close - open - 1);
+}
+
+// key_hash 为 KeyHash(key), 仍用于表查找; 只有带 hash tag 的 key 才需要为路由再算一次哈希
+inline size_t ShardOfKey(std::string_view key, uint64_t key_hash, size_t num_shards) {
+	if (num_shards <= 1) {
+		return 0;
+	}
+	const std::string_view tag = KeyHashTag(key);
+	return ShardOfHash(tag.size() == key.size() ? key_hash : KeyHash(tag), num_shards);
+}
+
+// 整数编码的 key 只含数字, 不会有 hash tag
+inline size_t ShardOfKey(const NanoObj& key, uint64_t key_hash, size_t num_shards) {
+	return ShardOfKey(key.GetStringView(), key_hash, num_shards);
+}
 
 inline size_t Shard(std::string_view key, size_t num_shards) {
 	if (num_shards <= 1) {
 		return 0;
 	}
+	return ShardOfKey(key, KeyHash(key), num_shards);
+}
 
-	uint64_t hash = absl::Hash<std::string_view> {}(key);
-	return hash % num_shards;
+inline size_t Shard(const NanoObj& key, size_t num_shards) {
+	if (num_shards <= 1) {
+		return 0;
+	}
+	return ShardOfKey(key, KeyHash(key), num_shards);
 }
+
+// 连接的目标分片亲和性: 每 kWindow 条单 key 命令统计一次各分片的命中数,
+// 若某个非本地分片占到 3/4 以上, 建议把连接迁移到该分片所在的 vCPU。
+class ShardAffinity {
+public:
+	static constexpr uint32_t kWindow = 64;
+
+	explicit ShardAffinity(size_t num_shards) : hits(num_shards, 0) {
+	}
+
+	// 记录一条命令的目标分片; 窗口结束且应迁移时返回目标分片
+	std::optional<size_t> Record(size_t target_shard, size_t local_shard) {
+		++hits[target_shard];
+		if (++recorded < kWindow) {
+			return std::nullopt;
+		}
+		size_t best = 0;
+		for (size_t i = 1; i < hits.size(); ++i) {
+			if (hits[i] > hits[best]) {
+				best = i;
+			}
+		}
+		const bool dominant = hits[best] * 4 >= kWindow * 3;
+		Reset();
+		if (!dominant || best == local_shard) {
+			return std::nullopt;
+		}
+		return best;
+	}
+
+	void Reset() {
+		std::fill(hits.begin(), hits.end(), 0);
+		recorded = 0;
+	}
+
+private:
+	std::vector<uint32_t> hits;
+	uint32_t recorded = 0;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/nano_obj.h"
+
+class Connection;
+class EngineShard;
+class EngineShardSet;
+class WatchRegistry;
+
+// 一个连接的 MULTI / EXEC / WATCH 状态, 由连接循环持有。
+//
+// EXEC 时按顺序把队列切成若干段: 连续的带 key 命令为一段, 无 key 命令 (SELECT、PING、FLUSHDB ...)
+// 在段之间由当前连接直接执行。每条带 key 命令的 key 必须落在同一分片 (入队时检查, 否则 CROSSSLOT)。
+// - 单分片段走快速路径: 在所属分片上一次执行完, 本分片直接内联, 不需要任何协调
+// - 多分片段按分片号升序逐个冻结涉及的分片 (事务任务占住分片的任务队列), 全部冻结后
+//   各分片并行执行自己的命令再解冻; 升序加锁保证多个事务之间不会死锁
+// 段内的命令对其他连接是原子的; 无 key 命令不在任何段内。
+//
+// WATCH 的 key 版本登记在 key 所在分片上 (见 core/watch_registry.h), 在第一段加锁之后、执行之前
+// 由各分片检查自己的 key; 被 WATCH 的 key 所在分片也加入第一段的冻结集合。
+class Transaction {
+public:
+	Transaction(EngineShardSet* shard_set, size_t num_shards, Connection* connection);
+	~Transaction();
+
+	Transaction(const Transaction&) = delete;
+	Transaction& operator=(const Transaction&) = delete;
+
+	bool InMulti() const {
+		return in_multi;
+	}
+
+	// 处理 MULTI / EXEC / DISCARD / WATCH / UNWATCH, 以及 MULTI 状态下的命令入队 (会移走 args)。
+	// 返回 false 表示不是事务相关命令, 由调用方照常执行
+	bool Handle(std::vector<NanoObj>& args, EngineShard* local_shard, std::string* response);
+
+private:
+	static constexpr size_t kNoShard = SIZE_MAX;
+
+	struct QueuedCommand {
+		std::vector<NanoObj> args;
+		// 命令的 key 所在分片; 无 key 命令为 kNoShard
+		size_t shard = kNoShard;
+	};
+
+	struct WatchedKey {
+		size_t db_index = 0;
+		std::string key;
+		// key 所在分片, 版本戳登记在该分片的 WatchRegistry 中
+		size_t shard = 0;
+		uint64_t version = 0;
+	};
+
+	std::string Queue(std::vector<NanoObj>& args);
+	std::string Exec(EngineShard* local_shard);
+	std::string Watch(const std::vector<NanoObj>& args);
+	void Reset();
+	void UnwatchAll();
+	// 对 watched[begin, end) 涉及的每个分片, 在该分片线程上调用 func(shard_id, registry);
+	// 本分片直接调用, 其他分片经任务队列, 调用方不能持有任何分片的冻结
+	template <typename F>
+	void ForEachWatchShard(size_t begin, F&& func);
+	// 在 shard_id 所在线程上调用: 该分片上被 WATCH 的 key 版本都未变
+	bool WatchedKeysUnchangedOn(size_t shard_id, const WatchRegistry& registry) const;
+	bool WatchedKeysUnchanged();
+
+	// 执行 [begin, end) 这一段带 key 命令, 回复写入 replies; WATCH 检查失败时返回 false
+	bool RunSegment(size_t begin, size_t end, EngineShard* local_shard, bool check_watch,
+	                std::vector<std::string>* replies);
+	bool RunFrozenSegment(const std::vector<size_t>& shard_ids, const std::vector<std::vector<size_t>>& commands,
+	                      size_t db_index, bool check_watch, std::vector<std::string>* replies);
+	size_t DBIndex() const;
+
+	EngineShardSet* shard_set;
+	size_t num_shards;
+	Connection* connection;
+	bool in_multi = false;
+	// 入队出错 (未知命令、参数个数、CROSSSLOT) 后 EXEC 直接放弃
+	bool dirty = false;
+	std::vector<QueuedCommand> queued;
+	std::vector<WatchedKey> watched;
+};
@@ -1,15 +1,58 @@
 #include "command/command_registry.h"
 #include "core/command_context.h"
+#include "core/database.h"
+#include "core/memory_budget.h"
+#include "core/watch_registry.h"
 #include "core/nano_obj.h"
+#include "protocol/reply_builder.h"
 #include "protocol/resp_parser.h"
+#include "server/engine_shard.h"
+#include "server/engine_shard_set.h"
+#include "server/sharding.h"
 #include <absl/container/flat_hash_map.h>
 #include <algorithm>
+#include <charconv>
 #include <string>
 #include <tuple>
 #include <vector>
 
 namespace {
 
+// 写命令执行前在 key 所在分片上递增其 WATCH 版本。单 key 命令总在 key 所在分片上执行, 直接查本分片的表;
+// 在协调者上分发的多 key 命令, 其他分片的 key 通过任务队列递增, 排在随后分发的写操作之前
+void TouchWatchedKeys(const std::vector<NanoObj>& args, const CommandRegistry::CommandMeta& meta,
+                      const CommandContext* ctx) {
+	if (meta.first_key <= 0 || ctx == nullptr) {
+		return;
+	}
+	const size_t db_index = ctx->GetDBIndex();
+	const bool single_shard = ctx->IsSingleShard() || ctx->shard_set == nullptr;
+	const size_t last_key = CommandRegistry::LastKeyIndex(meta, args);
+	const size_t step = meta.key_step > 0 ? static_cast<size_t>(meta.key_step) : 1;
+	for (size_t i = static_cast<size_t>(meta.first_key); i <= last_key && i < args.size(); i += step) {
+		std::string int_key;
+		std::string_view key = args[i].GetStringView();
+		if (key.empty() && args[i].IsInt()) {
+			int_key = args[i].ToString();
+			key = int_key;
+		}
+		if (single_shard) {
+			ctx->GetDB()->Watches().Touch(db_index, key);
+			continue;
+		}
+		const size_t shard_id = Shard(key, ctx->GetShardCount());
+		if (ctx->local_shard != nullptr && ctx->local_shard->ShardId() == shard_id) {
+			ctx->local_shard->GetDB().Watches().Touch(db_index, key);
+			continue;
+		}
+		ctx->shard_set->Add(shard_id, [db_index, owned_key = std::string(key)]() {
+			if (EngineShard* shard = EngineShard::Tlocal()) {
+				shard->GetDB().Watches().Touch(db_index, owned_key);
+			}
+		});
+	}
+}
+
 std::vector<std::string> BuildFlagStrings(const CommandRegistry::CommandMeta& meta) {
 	std::vector<std::string> flags;
 	if ((meta.flags & CommandRegistry::kCmdFlagReadOnly) != 0) {
@@ -27,11 +70,36 @@ std::vector<std::string> BuildFlagStrings(const CommandRegistry::CommandMeta& me
 	if ((meta.flags & CommandRegistry::kCmdFlagNoKey) != 0) {
 		flags.emplace_back("nokey");
 	}
+	if ((meta.flags & CommandRegistry::kCmdFlagDenyOom) != 0) {
+		flags.emplace_back("denyoom");
+	}
+	if ((meta.flags & CommandRegistry::kCmdFlagMovableKeys) != 0) {
+		flags.emplace_back("movablekeys");
+	}
 	return flags;
 }
 
 } // namespace
 
+size_t CommandRegistry::LastKeyIndex(const CommandMeta& meta, const std::vector<NanoObj>& args) {
+	const size_t first_key = static_cast<size_t>(meta.first_key);
+	if ((meta.flags & kCmdFlagMovableKeys) == 0) {
+		return meta.last_key < 0 ? args.size() - 1 : static_cast<size_t>(meta.last_key);
+	}
+	if (first_key >= args.size()) {
+		return first_key;
+	}
+	// numkeys 不合法时只把第一个参数当作 key, 由命令自己返回错误
+	const std::string numkeys_text = args[first_key - 1].ToString();
+	uint64_t numkeys = 0;
+	const char* end = numkeys_text.data() + numkeys_text.size();
+	const auto [ptr, ec] = std::from_chars(numkeys_text.data(), end, numkeys);
+	if (ec != std::errc() || ptr != end || numkeys == 0) {
+		return first_key;
+	}
+	return first_key + std::min<uint64_t>(numkeys, args.size() - first_key) - 1;
+}
+
 CommandRegistry& CommandRegistry::Instance() {
 	static CommandRegistry registry;
 	return registry;
@@ -78,6 +146,20 @@ std::string CommandRegistry::Execute(const std::vector<NanoObj>& args, CommandCo
 		return "-ERR Unknown command '" + cmd + "'\r\n";
 	}
 
+	// 未设置 maxmemory 且没有连接 WATCH 时不查命令元信息, 不增加开销
+	const bool check_oom = MemoryBudget::MaxMemory() != 0;
+	if (check_oom || !WatchRegistry::Empty()) {
+		const CommandMeta* meta = FindMeta(cmd_sv);
+		if (check_oom && meta != nullptr && (meta->flags & kCmdFlagDenyOom) != 0) {
+			if (!MemoryBudget::ReclaimForWrite(ctx != nullptr ? ctx->GetDB() : nullptr)) {
+				return "-OOM command not allowed when used memory > 'maxmemory'.\r\n";
+			}
+		}
+		if (meta != nullptr && (meta->flags & kCmdFlagWrite) != 0) {
+			TouchWatchedKeys(args, *meta, ctx);
+		}
+	}
+
 	auto it_with_ctx = handlers_with_context.find(cmd_sv);
 	if (it_with_ctx != handlers_with_context.end()) {
 		return it_with_ctx->second(args, ctx);
@@ -110,21 +192,23 @@ std::string CommandRegistry::BuildCommandInfoResponse() const {
 	std::sort(rows.begin(), rows.end(),
 	          [](const auto& lhs, const auto& rhs) { return std::get<0>(lhs) < std::get<0>(rhs); });
 
-	std::string response = RESPParser::MakeArray(static_cast<int64_t>(rows.size()));
+	std::string response;
+	ReplyBuilder reply(&response);
+	reply.ArrayHeader(rows.size());
 	for (const auto& [name, meta] : rows) {
-		response += RESPParser::MakeArray(6);
-		response += RESPParser::MakeBulkString(name);
-		response += RESPParser::MakeInteger(meta.arity);
+		reply.ArrayHeader(6);
+		reply.BulkString(name);
+		reply.Integer(meta.arity);
 
 		const std::vector<std::string> flags = BuildFlagStrings(meta);
-		response += RESPParser::MakeArray(static_cast<int64_t>(flags.size()));
+		reply.ArrayHeader(flags.size());
 		for (const auto& flag : flags) {
-			response += RESPParser::MakeBulkString(flag);
+			reply.BulkString(flag);
 		}
 
-		response += RESPParser::MakeInteger(meta.first_key);
-		response += RESPParser::MakeInteger(meta.last_key);
-		response += RESPParser::MakeInteger(meta.key_step);
+		reply.Integer(meta.first_key);
+		reply.Integer(meta.last_key);
+		reply.Integer(meta.key_step);
 	}
 
 	return response;
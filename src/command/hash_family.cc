@@ -1,5 +1,6 @@
 #include "command/hash_family.h"
 #include "core/command_context.h"
+#include "protocol/reply_builder.h"
 #include "protocol/resp_parser.h"
 #include <cstdlib>
 #include <sstream>
@@ -8,18 +9,19 @@ namespace {
 using CommandMeta = CommandRegistry::CommandMeta;
 constexpr uint32_t kReadOnly = CommandRegistry::kCmdFlagReadOnly;
 constexpr uint32_t kWrite = CommandRegistry::kCmdFlagWrite;
+constexpr uint32_t kDenyOom = CommandRegistry::kCmdFlagDenyOom;
 } // namespace
 
 void HashFamily::Register(CommandRegistry* registry) {
 	registry->RegisterCommandWithContext(
 	    "HSET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return HSet(args, ctx); },
-	    CommandMeta {-4, 1, 1, 1, kWrite});
+	    CommandMeta {-4, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "HGET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return HGet(args, ctx); },
 	    CommandMeta {3, 1, 1, 1, kReadOnly});
 	registry->RegisterCommandWithContext(
 	    "HMSET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return HMSet(args, ctx); },
-	    CommandMeta {-4, 1, 1, 1, kWrite});
+	    CommandMeta {-4, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "HMGET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return HMGet(args, ctx); },
 	    CommandMeta {-3, 1, 1, 1, kReadOnly});
@@ -43,7 +45,7 @@ void HashFamily::Register(CommandRegistry* registry) {
 	    CommandMeta {2, 1, 1, 1, kReadOnly});
 	registry->RegisterCommandWithContext(
 	    "HINCRBY", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return HIncrBy(args, ctx); },
-	    CommandMeta {4, 1, 1, 1, kWrite});
+	    CommandMeta {4, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "HSTRLEN", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return HStrLen(args, ctx); },
 	    CommandMeta {3, 1, 1, 1, kReadOnly});
@@ -63,17 +65,18 @@ std::string HashFamily::HSet(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		if (hash_obj != nullptr && !hash_obj->IsHash()) {
-			db->Del(key);
+			db->Del(key, key_hash);
 		}
 		auto hash_table = new HashType();
 		NanoObj new_hash = NanoObj::FromHash();
 		new_hash.SetObj(hash_table);
-		db->Set(key, std::move(new_hash));
-		hash_obj = db->Find(key);
+		db->Set(key, key_hash, std::move(new_hash));
+		hash_obj = db->Find(key, key_hash);
 	}
 
 	auto hash_table = hash_obj->GetObj<HashType>();
@@ -95,7 +98,8 @@ std::string HashFamily::HGet(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeNullBulkString();
@@ -120,17 +124,18 @@ std::string HashFamily::HMSet(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		if (hash_obj != nullptr && !hash_obj->IsHash()) {
-			db->Del(key);
+			db->Del(key, key_hash);
 		}
 		auto hash_table = new HashType();
 		NanoObj new_hash = NanoObj::FromHash();
 		new_hash.SetObj(hash_table);
-		db->Set(key, std::move(new_hash));
-		hash_obj = db->Find(key);
+		db->Set(key, key_hash, std::move(new_hash));
+		hash_obj = db->Find(key, key_hash);
 	}
 
 	auto hash_table = hash_obj->GetObj<HashType>();
@@ -152,26 +157,28 @@ std::string HashFamily::HMGet(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(args.size() - 2);
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
-		std::string result = RESPParser::MakeArray(static_cast<int64_t>(args.size() - 2));
 		for (size_t i = 2; i < args.size(); i++) {
-			result += RESPParser::MakeNullBulkString();
+			reply.NullBulkString();
 		}
 		return result;
 	}
 
 	auto hash_table = hash_obj->GetObj<HashType>();
 
-	std::string result = RESPParser::MakeArray(static_cast<int64_t>(args.size() - 2));
 	for (size_t i = 2; i < args.size(); i++) {
 		std::string field = args[i].ToString();
 		auto it = hash_table->find(field);
 		if (it != hash_table->end()) {
-			result += RESPParser::MakeBulkString(it->second);
+			reply.BulkString(it->second);
 		} else {
-			result += RESPParser::MakeNullBulkString();
+			reply.NullBulkString();
 		}
 	}
 
@@ -186,7 +193,8 @@ std::string HashFamily::HDel(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeInteger(0);
@@ -213,7 +221,8 @@ std::string HashFamily::HExists(const std::vector<NanoObj>& args, CommandContext
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeInteger(0);
@@ -233,7 +242,8 @@ std::string HashFamily::HLen(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeInteger(0);
@@ -251,7 +261,8 @@ std::string HashFamily::HKeys(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeArray(0);
@@ -259,9 +270,11 @@ std::string HashFamily::HKeys(const std::vector<NanoObj>& args, CommandContext*
 
 	auto hash_table = hash_obj->GetObj<HashType>();
 
-	std::string result = RESPParser::MakeArray(static_cast<int64_t>(hash_table->size()));
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(hash_table->size());
 	for (const auto& pair : *hash_table) {
-		result += RESPParser::MakeBulkString(pair.first);
+		reply.BulkString(pair.first);
 	}
 
 	return result;
@@ -275,7 +288,8 @@ std::string HashFamily::HVals(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeArray(0);
@@ -283,9 +297,11 @@ std::string HashFamily::HVals(const std::vector<NanoObj>& args, CommandContext*
 
 	auto hash_table = hash_obj->GetObj<HashType>();
 
-	std::string result = RESPParser::MakeArray(static_cast<int64_t>(hash_table->size()));
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(hash_table->size());
 	for (const auto& pair : *hash_table) {
-		result += RESPParser::MakeBulkString(pair.second);
+		reply.BulkString(pair.second);
 	}
 
 	return result;
@@ -299,7 +315,8 @@ std::string HashFamily::HGetAll(const std::vector<NanoObj>& args, CommandContext
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeArray(0);
@@ -307,10 +324,12 @@ std::string HashFamily::HGetAll(const std::vector<NanoObj>& args, CommandContext
 
 	auto hash_table = hash_obj->GetObj<HashType>();
 
-	std::string result = RESPParser::MakeArray(static_cast<int64_t>(hash_table->size() * 2));
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(hash_table->size() * 2);
 	for (const auto& pair : *hash_table) {
-		result += RESPParser::MakeBulkString(pair.first);
-		result += RESPParser::MakeBulkString(pair.second);
+		reply.BulkString(pair.first);
+		reply.BulkString(pair.second);
 	}
 
 	return result;
@@ -324,7 +343,8 @@ std::string HashFamily::HIncrBy(const std::vector<NanoObj>& args, CommandContext
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeError("WRONGTYPE Operation against a key holding the wrong kind of value");
@@ -365,7 +385,8 @@ std::string HashFamily::HScan(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeError("WRONGTYPE Operation against a key holding the wrong kind of value");
@@ -389,17 +410,14 @@ std::string HashFamily::HScan(const std::vector<NanoObj>& args, CommandContext*
 		return result;
 	}
 
-	std::vector<std::string> keys;
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(2);
+	reply.BulkString("0");
+	reply.ArrayHeader(hash_table->size() * 2);
 	for (const auto& pair : *hash_table) {
-		keys.push_back(pair.first);
-		keys.push_back(pair.second);
-	}
-
-	std::string result = RESPParser::MakeArray(2);
-	result += RESPParser::MakeBulkString("0");
-	result += RESPParser::MakeArray(static_cast<int64_t>(keys.size()));
-	for (const auto& item : keys) {
-		result += RESPParser::MakeBulkString(item);
+		reply.BulkString(pair.first);
+		reply.BulkString(pair.second);
 	}
 	return result;
 }
@@ -412,7 +430,8 @@ std::string HashFamily::HStrLen(const std::vector<NanoObj>& args, CommandContext
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeInteger(0);
@@ -437,7 +456,8 @@ std::string HashFamily::HRandField(const std::vector<NanoObj>& args, CommandCont
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* hash_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* hash_obj = db->Find(key, key_hash);
 
 	if (hash_obj == nullptr || !hash_obj->IsHash()) {
 		return RESPParser::MakeNullBulkString();
@@ -461,12 +481,14 @@ std::string HashFamily::HRandField(const std::vector<NanoObj>& args, CommandCont
 		return RESPParser::MakeError("count is not a valid positive integer");
 	}
 
-	std::string result = RESPParser::MakeArray(count);
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(static_cast<size_t>(count));
 	for (int i = 0; i < count && !hash_table->empty(); i++) {
 		auto it = hash_table->begin();
 		size_t offset = std::rand() % hash_table->size();
 		std::advance(it, offset);
-		result += RESPParser::MakeBulkString(it->first);
+		reply.BulkString(it->first);
 		hash_table->erase(it);
 	}
 
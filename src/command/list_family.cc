@@ -1,5 +1,6 @@
 #include "command/list_family.h"
 #include "core/command_context.h"
+#include "protocol/reply_builder.h"
 #include "protocol/resp_parser.h"
 #include <cstdlib>
 #include <sstream>
@@ -10,15 +11,16 @@ namespace {
 using CommandMeta = CommandRegistry::CommandMeta;
 constexpr uint32_t kReadOnly = CommandRegistry::kCmdFlagReadOnly;
 constexpr uint32_t kWrite = CommandRegistry::kCmdFlagWrite;
+constexpr uint32_t kDenyOom = CommandRegistry::kCmdFlagDenyOom;
 } // namespace
 
 void ListFamily::Register(CommandRegistry* registry) {
 	registry->RegisterCommandWithContext(
 	    "LPUSH", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return LPush(args, ctx); },
-	    CommandMeta {-3, 1, 1, 1, kWrite});
+	    CommandMeta {-3, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "RPUSH", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return RPush(args, ctx); },
-	    CommandMeta {-3, 1, 1, 1, kWrite});
+	    CommandMeta {-3, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "LPOP", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return LPop(args, ctx); },
 	    CommandMeta {-2, 1, 1, 1, kWrite});
@@ -33,7 +35,7 @@ void ListFamily::Register(CommandRegistry* registry) {
 	    CommandMeta {3, 1, 1, 1, kReadOnly});
 	registry->RegisterCommandWithContext(
 	    "LSET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return LSet(args, ctx); },
-	    CommandMeta {4, 1, 1, 1, kWrite});
+	    CommandMeta {4, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "LRANGE", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return LRange(args, ctx); },
 	    CommandMeta {4, 1, 1, 1, kReadOnly});
@@ -45,7 +47,7 @@ void ListFamily::Register(CommandRegistry* registry) {
 	    CommandMeta {4, 1, 1, 1, kWrite});
 	registry->RegisterCommandWithContext(
 	    "LINSERT", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return LInsert(args, ctx); },
-	    CommandMeta {5, 1, 1, 1, kWrite});
+	    CommandMeta {5, 1, 1, 1, kWrite | kDenyOom});
 }
 
 std::string ListFamily::LPush(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -56,17 +58,18 @@ std::string ListFamily::LPush(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		if (list_obj != nullptr && !list_obj->IsList()) {
-			db->Del(key);
+			db->Del(key, key_hash);
 		}
 		auto list = new std::deque<NanoObj>();
 		NanoObj new_list = NanoObj::FromList();
 		new_list.SetObj(list);
-		db->Set(key, std::move(new_list));
-		list_obj = db->Find(key);
+		db->Set(key, key_hash, std::move(new_list));
+		list_obj = db->Find(key, key_hash);
 	}
 
 	auto list = list_obj->GetObj<std::deque<NanoObj>>();
@@ -86,17 +89,18 @@ std::string ListFamily::RPush(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		if (list_obj != nullptr && !list_obj->IsList()) {
-			db->Del(key);
+			db->Del(key, key_hash);
 		}
 		auto list = new std::deque<NanoObj>();
 		NanoObj new_list = NanoObj::FromList();
 		new_list.SetObj(list);
-		db->Set(key, std::move(new_list));
-		list_obj = db->Find(key);
+		db->Set(key, key_hash, std::move(new_list));
+		list_obj = db->Find(key, key_hash);
 	}
 
 	auto list = list_obj->GetObj<std::deque<NanoObj>>();
@@ -116,7 +120,8 @@ std::string ListFamily::LPop(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_null_bulk_string();
@@ -139,19 +144,21 @@ std::string ListFamily::LPop(const std::vector<NanoObj>& args, CommandContext* c
 		std::string result = list->front().ToString();
 		list->pop_front();
 		if (list->empty()) {
-			db->Del(key);
+			db->Del(key, key_hash);
 		}
 		return RESPParser::make_bulk_string(result);
 	}
 
-	std::string result = RESPParser::make_array(count);
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(static_cast<size_t>(count));
 	for (int64_t i = 0; i < count && !list->empty(); i++) {
-		result += RESPParser::make_bulk_string(list->front().ToString());
+		reply.BulkString(list->front());
 		list->pop_front();
 	}
 
 	if (list->empty()) {
-		db->Del(key);
+		db->Del(key, key_hash);
 	}
 
 	return result;
@@ -165,7 +172,8 @@ std::string ListFamily::RPop(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_null_bulk_string();
@@ -188,19 +196,21 @@ std::string ListFamily::RPop(const std::vector<NanoObj>& args, CommandContext* c
 		std::string result = list->back().ToString();
 		list->pop_back();
 		if (list->empty()) {
-			db->Del(key);
+			db->Del(key, key_hash);
 		}
 		return RESPParser::make_bulk_string(result);
 	}
 
-	std::string result = RESPParser::make_array(count);
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(static_cast<size_t>(count));
 	for (int64_t i = 0; i < count && !list->empty(); i++) {
-		result += RESPParser::make_bulk_string(list->back().ToString());
+		reply.BulkString(list->back());
 		list->pop_back();
 	}
 
 	if (list->empty()) {
-		db->Del(key);
+		db->Del(key, key_hash);
 	}
 
 	return result;
@@ -214,7 +224,8 @@ std::string ListFamily::LLen(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_integer(0);
@@ -232,7 +243,8 @@ std::string ListFamily::LIndex(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_null_bulk_string();
@@ -264,7 +276,8 @@ std::string ListFamily::LSet(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_error("no such key");
@@ -297,7 +310,8 @@ std::string ListFamily::LRange(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_array(0);
@@ -337,9 +351,11 @@ std::string ListFamily::LRange(const std::vector<NanoObj>& args, CommandContext*
 		return RESPParser::make_array(0);
 	}
 
-	std::string result = RESPParser::make_array(stop - start + 1);
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(static_cast<size_t>(stop - start + 1));
 	for (int64_t i = start; i <= stop; i++) {
-		result += RESPParser::make_bulk_string(list->at(i).ToString());
+		reply.BulkString((*list)[static_cast<size_t>(i)]);
 	}
 
 	return result;
@@ -353,7 +369,8 @@ std::string ListFamily::LTrim(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::ok_response();
@@ -382,7 +399,7 @@ std::string ListFamily::LTrim(const std::vector<NanoObj>& args, CommandContext*
 	}
 
 	if (start >= len || start > stop) {
-		db->Del(key);
+		db->Del(key, key_hash);
 		return RESPParser::ok_response();
 	}
 
@@ -407,7 +424,8 @@ std::string ListFamily::LRem(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_integer(0);
@@ -454,7 +472,7 @@ std::string ListFamily::LRem(const std::vector<NanoObj>& args, CommandContext* c
 	}
 
 	if (list->empty()) {
-		db->Del(key);
+		db->Del(key, key_hash);
 	}
 
 	return RESPParser::make_integer(removed);
@@ -468,7 +486,8 @@ std::string ListFamily::LInsert(const std::vector<NanoObj>& args, CommandContext
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* list_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* list_obj = db->Find(key, key_hash);
 
 	if (list_obj == nullptr || !list_obj->IsList()) {
 		return RESPParser::make_integer(0);
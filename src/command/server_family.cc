@@ -7,6 +7,7 @@
 #include <charconv>
 #include <cstdint>
 #include <fstream>
+#include <limits>
 #include <cstdio>
 #include <optional>
 #include <random>
@@ -20,8 +21,10 @@
 
 #include "core/command_context.h"
 #include "core/database.h"
+#include "core/memory_budget.h"
 #include "core/rdb_serializer.h"
 #include "core/util.h"
+#include "protocol/reply_builder.h"
 #include "protocol/resp_parser.h"
 #include "server/connection.h"
 #include "server/engine_shard.h"
@@ -39,6 +42,7 @@ DECLARE_int32(num_shards);
 DECLARE_bool(tcp_nodelay);
 DECLARE_bool(use_iouring_tcp_server);
 DECLARE_uint64(photon_handler_stack_kb);
+DECLARE_bool(release_idle_buffers);
 
 namespace {
 
@@ -215,6 +219,25 @@ std::optional<uint64_t> ParseUint64(std::string_view value) {
 	return parsed;
 }
 
+// 与 Redis 配置相同的单位: k/m/g 按 1000 进位, kb/mb/gb 按 1024 进位
+std::optional<uint64_t> ParseMemorySize(std::string_view value) {
+	constexpr std::pair<std::string_view, uint64_t> kUnits[] = {
+	    {"kb", 1024ULL}, {"mb", 1024ULL * 1024}, {"gb", 1024ULL * 1024 * 1024},
+	    {"k", 1000ULL},  {"m", 1000ULL * 1000},  {"g", 1000ULL * 1000 * 1000},
+	};
+	for (const auto& [suffix, multiplier] : kUnits) {
+		if (value.size() > suffix.size() &&
+		    EqualsIgnoreCase(value.substr(value.size() - suffix.size()), suffix)) {
+			auto parsed = ParseUint64(value.substr(0, value.size() - suffix.size()));
+			if (!parsed.has_value() || *parsed > std::numeric_limits<uint64_t>::max() / multiplier) {
+				return std::nullopt;
+			}
+			return *parsed * multiplier;
+		}
+	}
+	return ParseUint64(value);
+}
+
 std::optional<uint64_t> ParseClientId(const NanoObj& arg) {
 	const std::string_view sv = arg.GetStringView();
 	if (!sv.empty()) {
@@ -232,10 +255,12 @@ std::optional<uint64_t> ParseUint64Arg(const NanoObj& arg) {
 }
 
 std::string BuildConfigArrayResponse(const std::vector<std::pair<std::string, std::string>>& items) {
-	std::string response = RESPParser::MakeArray(static_cast<int64_t>(items.size() * 2U));
+	std::string response;
+	ReplyBuilder reply(&response);
+	reply.ArrayHeader(items.size() * 2U);
 	for (const auto& [key, value] : items) {
-		response += RESPParser::MakeBulkString(key);
-		response += RESPParser::MakeBulkString(value);
+		reply.BulkString(key);
+		reply.BulkString(value);
 	}
 	return response;
 }
@@ -262,29 +287,42 @@ std::string BuildInfoPayload(std::string_view section, CommandContext* ctx) {
 	}
 
 	if (keyspace_section && ctx != nullptr) {
+		// 每个分片只读计数器, 不遍历表; avg_ttl 按各分片的 expires 加权,
+		// avg_ttl_ms 最大接近 2^47, 乘以 expires 可能超出 int64, 用 128 位累加
 		const size_t db_index = ctx->GetDBIndex();
-		size_t key_count = 0;
+		KeyspaceStats total;
+		__int128 ttl_weighted_sum = 0;
+		auto accumulate = [&total, &ttl_weighted_sum](const KeyspaceStats& stats) {
+			total.keys += stats.keys;
+			total.expires += stats.expires;
+			ttl_weighted_sum += static_cast<__int128>(stats.avg_ttl_ms) * stats.expires;
+		};
 		if (ctx->shard_set != nullptr && !ctx->IsSingleShard()) {
-			for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-				key_count += ctx->shard_set->Await(shard_id, [db_index]() -> size_t {
-					EngineShard* shard = EngineShard::Tlocal();
-					if (shard == nullptr) {
-						return 0;
-					}
-					auto& db = shard->GetDB();
-					(void)db.Select(db_index);
-					return db.KeyCount();
-				});
+			const auto per_shard = ctx->shard_set->AwaitOnAll([db_index](size_t shard_id) -> KeyspaceStats {
+				(void)shard_id;
+				EngineShard* shard = EngineShard::Tlocal();
+				if (shard == nullptr) {
+					return {};
+				}
+				return shard->GetDB().GetKeyspaceStats(db_index);
+			});
+			for (const KeyspaceStats& stats : per_shard) {
+				accumulate(stats);
 			}
 		} else {
 			Database* db = ctx->GetDB();
 			if (db != nullptr) {
-				key_count = db->KeyCount();
+				accumulate(db->GetKeyspaceStats(db_index));
 			}
 		}
+		if (total.expires > 0) {
+			total.avg_ttl_ms = static_cast<int64_t>(ttl_weighted_sum / total.expires);
+		}
 
 		payload += "# Keyspace\r\n";
-		payload += "db" + std::to_string(db_index) + ":keys=" + std::to_string(key_count) + "\r\n";
+		payload += "db" + std::to_string(db_index) + ":keys=" + std::to_string(total.keys) +
+		           ",expires=" + std::to_string(total.expires) + ",avg_ttl=" + std::to_string(total.avg_ttl_ms) +
+		           "\r\n";
 	}
 
 	return payload;
@@ -343,11 +381,12 @@ std::vector<ProactorPool::ClientSnapshot> CollectClientSnapshots(CommandContext*
 		return ProactorPool::ListLocalConnections();
 	}
 
+	const auto per_shard = ctx->shard_set->AwaitOnAll([](size_t shard_id) -> std::vector<ProactorPool::ClientSnapshot> {
+		(void)shard_id;
+		return ProactorPool::ListLocalConnections();
+	});
 	std::vector<ProactorPool::ClientSnapshot> snapshots;
-	for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-		auto shard_snapshots = ctx->shard_set->Await(shard_id, []() -> std::vector<ProactorPool::ClientSnapshot> {
-			return ProactorPool::ListLocalConnections();
-		});
+	for (const auto& shard_snapshots : per_shard) {
 		snapshots.insert(snapshots.end(), shard_snapshots.begin(), shard_snapshots.end());
 	}
 	return snapshots;
@@ -358,15 +397,11 @@ bool KillClientById(uint64_t client_id, CommandContext* ctx) {
 		return ProactorPool::KillLocalConnectionById(client_id);
 	}
 
-	bool killed = false;
-	for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-		const bool shard_killed = ctx->shard_set->Await(
-		    shard_id, [client_id]() -> bool { return ProactorPool::KillLocalConnectionById(client_id); });
-		if (shard_killed) {
-			killed = true;
-		}
-	}
-	return killed;
+	const std::vector<bool> killed = ctx->shard_set->AwaitOnAll([client_id](size_t shard_id) -> bool {
+		(void)shard_id;
+		return ProactorPool::KillLocalConnectionById(client_id);
+	});
+	return std::find(killed.begin(), killed.end(), true) != killed.end();
 }
 
 std::error_code BgSaveToFile(const std::string& file_path, CommandContext* ctx) {
@@ -480,12 +515,15 @@ std::string ServerFamily::Config(const std::vector<NanoObj>& args, CommandContex
 			return RESPParser::MakeError("wrong number of arguments for 'CONFIG GET'");
 		}
 		const std::string pattern = args[2].ToString();
-		const std::array<std::pair<std::string, std::string>, 5> options = {
+		const std::array<std::pair<std::string, std::string>, 8> options = {
 		    std::make_pair("port", std::to_string(FLAGS_port)),
 		    std::make_pair("num_shards", std::to_string(FLAGS_num_shards)),
 		    std::make_pair("tcp_nodelay", FLAGS_tcp_nodelay ? "yes" : "no"),
 		    std::make_pair("use_iouring_tcp_server", FLAGS_use_iouring_tcp_server ? "yes" : "no"),
 		    std::make_pair("photon_handler_stack_kb", std::to_string(FLAGS_photon_handler_stack_kb)),
+		    std::make_pair("release_idle_buffers", FLAGS_release_idle_buffers ? "yes" : "no"),
+		    std::make_pair("maxmemory", std::to_string(MemoryBudget::MaxMemory())),
+		    std::make_pair("maxmemory-policy", EvictionPolicyName(MemoryBudget::Policy())),
 		};
 
 		std::vector<std::pair<std::string, std::string>> matched;
@@ -522,6 +560,15 @@ std::string ServerFamily::Config(const std::vector<NanoObj>& args, CommandContex
 			return RESPParser::OkResponse();
 		}
 
+		if (EqualsIgnoreCase(name, "release_idle_buffers")) {
+			auto parsed = ParseBool(value);
+			if (!parsed.has_value()) {
+				return RESPParser::MakeError("Invalid argument for CONFIG SET 'release_idle_buffers'");
+			}
+			FLAGS_release_idle_buffers = *parsed;
+			return RESPParser::OkResponse();
+		}
+
 		if (EqualsIgnoreCase(name, "photon_handler_stack_kb")) {
 			int64_t parsed_value = 0;
 			const std::string str_value(value);
@@ -533,6 +580,25 @@ std::string ServerFamily::Config(const std::vector<NanoObj>& args, CommandContex
 			return RESPParser::OkResponse();
 		}
 
+		if (EqualsIgnoreCase(name, "maxmemory")) {
+			// 纯数字参数会被编码成整数, GetStringView 为空
+			auto parsed = ParseMemorySize(args[3].ToString());
+			if (!parsed.has_value()) {
+				return RESPParser::MakeError("Invalid argument for CONFIG SET 'maxmemory'");
+			}
+			MemoryBudget::SetMaxMemory(*parsed);
+			return RESPParser::OkResponse();
+		}
+
+		if (EqualsIgnoreCase(name, "maxmemory-policy") || EqualsIgnoreCase(name, "maxmemory_policy")) {
+			auto parsed = ParseEvictionPolicy(value);
+			if (!parsed.has_value()) {
+				return RESPParser::MakeError("Invalid argument for CONFIG SET 'maxmemory-policy'");
+			}
+			MemoryBudget::SetPolicy(*parsed);
+			return RESPParser::OkResponse();
+		}
+
 		return RESPParser::MakeError("Unsupported CONFIG parameter");
 	}
 
@@ -688,33 +754,29 @@ std::string ServerFamily::RandomKey(const std::vector<NanoObj>& args, CommandCon
 		if (db == nullptr) {
 			return RESPParser::MakeError("ERR internal database");
 		}
-		std::vector<std::string> keys = db->Keys();
-		if (keys.empty()) {
-			return RESPParser::NullBulkResponse();
-		}
-		const size_t random_index = PickRandomIndex(keys.size());
-		return RESPParser::MakeBulkString(keys[random_index]);
+		std::optional<std::string> key = db->RandomKey();
+		return key ? RESPParser::MakeBulkString(*key) : RESPParser::NullBulkResponse();
 	}
 
-	std::vector<std::string> all_keys;
-	for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-		auto shard_keys = ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex()]() -> std::vector<std::string> {
+	// key 均匀分布在各分片上: 随机选一个分片在本地采样, 该分片为空时依次尝试后面的分片
+	const size_t shard_count = ctx->shard_set->Size();
+	const size_t first_shard = PickRandomIndex(shard_count);
+	for (size_t i = 0; i < shard_count; ++i) {
+		const size_t shard_id = (first_shard + i) % shard_count;
+		auto key = ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex()]() -> std::optional<std::string> {
 			EngineShard* shard = EngineShard::Tlocal();
 			if (shard == nullptr) {
-				return {};
+				return std::nullopt;
 			}
 			auto& db = shard->GetDB();
 			(void)db.Select(db_index);
-			return db.Keys();
+			return db.RandomKey();
 		});
-		all_keys.insert(all_keys.end(), shard_keys.begin(), shard_keys.end());
-	}
-
-	if (all_keys.empty()) {
-		return RESPParser::NullBulkResponse();
+		if (key) {
+			return RESPParser::MakeBulkString(*key);
+		}
 	}
-	const size_t random_index = PickRandomIndex(all_keys.size());
-	return RESPParser::MakeBulkString(all_keys[random_index]);
+	return RESPParser::NullBulkResponse();
 }
 
 std::string ServerFamily::Save(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -1,8 +1,14 @@
 #include "command/set_family.h"
 #include "core/command_context.h"
+#include "protocol/reply_builder.h"
 #include "protocol/resp_parser.h"
 #include "server/sharding.h"
+#include "server/engine_shard.h"
+#include "server/engine_shard_set.h"
+#include "core/util.h"
 #include <cstdlib>
+#include <limits>
+#include <type_traits>
 #include <sstream>
 #include <vector>
 #include <algorithm>
@@ -11,7 +17,9 @@ namespace {
 using CommandMeta = CommandRegistry::CommandMeta;
 constexpr uint32_t kReadOnly = CommandRegistry::kCmdFlagReadOnly;
 constexpr uint32_t kWrite = CommandRegistry::kCmdFlagWrite;
+constexpr uint32_t kDenyOom = CommandRegistry::kCmdFlagDenyOom;
 constexpr uint32_t kMultiKey = CommandRegistry::kCmdFlagMultiKey;
+constexpr uint32_t kMovableKeys = CommandRegistry::kCmdFlagMovableKeys;
 
 bool AllKeysSameShard(const std::vector<NanoObj>& args, size_t first_key_index, CommandContext* ctx) {
 	if (ctx == nullptr) {
@@ -23,21 +31,275 @@ bool AllKeysSameShard(const std::vector<NanoObj>& args, size_t first_key_index,
 	if (args.size() <= first_key_index) {
 		return true;
 	}
-	const size_t shard0 = Shard(args[first_key_index].ToString(), ctx->GetShardCount());
+	const size_t shard0 = Shard(args[first_key_index], ctx->GetShardCount());
 	for (size_t i = first_key_index + 1; i < args.size(); ++i) {
-		const size_t shard_i = Shard(args[i].ToString(), ctx->GetShardCount());
+		const size_t shard_i = Shard(args[i], ctx->GetShardCount());
 		if (shard_i != shard0) {
 			return false;
 		}
 	}
 	return true;
 }
+// ---- 跨分片集合运算 ----
+// 每个分片先在本地用自己持有的 key 做过滤, 协调者 (执行命令的 fiber) 只合并各分片的部分结果:
+// - SUNION: 各分片并行返回本地并集, 协调者去重合并
+// - SINTER: 先并行取各分片的最小基数, 由最小集合所在分片算出本地交集作为候选,
+//   再把候选交给其余分片并行过滤, 只有最小的那份数据需要跨分片传递
+// - SDIFF: 第一个 key 所在分片算出本地差集作为候选, 其余分片并行剔除
+// 非集合类型的 key 与不存在的 key 同样视为空集。
+enum class SetOp { kInter, kUnion, kDiff };
+
+using SetType = ankerl::unordered_dense::set<std::string, ankerl::unordered_dense::hash<std::string>>;
+using KeyList = std::vector<const NanoObj*>;
+
+std::vector<const NanoObj*> SourceKeys(const std::vector<NanoObj>& args, size_t first_key_index) {
+	std::vector<const NanoObj*> keys;
+	keys.reserve(args.size() - first_key_index);
+	for (size_t i = first_key_index; i < args.size(); ++i) {
+		keys.push_back(&args[i]);
+	}
+	return keys;
+}
+
+const SetType* FindSet(Database& db, const NanoObj& key) {
+	const NanoObj* obj = db.Find(key);
+	if (obj == nullptr || !obj->IsSet()) {
+		return nullptr;
+	}
+	return obj->GetObj<SetType>();
+}
+
+// 本地 key 中最小集合的基数; 有 key 不存在时为 0
+size_t LocalMinCard(Database& db, const KeyList& keys) {
+	size_t min_card = std::numeric_limits<size_t>::max();
+	for (const NanoObj* key : keys) {
+		const SetType* set = FindSet(db, *key);
+		min_card = std::min(min_card, set != nullptr ? set->size() : 0);
+	}
+	return min_card;
+}
+
+// 本地交集, 从最小的集合开始过滤
+std::vector<std::string> LocalInter(Database& db, const KeyList& keys) {
+	std::vector<const SetType*> sets;
+	for (const NanoObj* key : keys) {
+		const SetType* set = FindSet(db, *key);
+		if (set == nullptr || set->empty()) {
+			return {};
+		}
+		sets.push_back(set);
+	}
+	std::sort(sets.begin(), sets.end(), [](const SetType* a, const SetType* b) { return a->size() < b->size(); });
+
+	std::vector<std::string> members;
+	for (const auto& member : *sets[0]) {
+		bool in_all = true;
+		for (size_t i = 1; i < sets.size() && in_all; ++i) {
+			in_all = sets[i]->count(member) != 0;
+		}
+		if (in_all) {
+			members.push_back(member);
+		}
+	}
+	return members;
+}
+
+std::vector<std::string> LocalUnion(Database& db, const KeyList& keys) {
+	SetType union_set;
+	for (const NanoObj* key : keys) {
+		if (const SetType* set = FindSet(db, *key); set != nullptr) {
+			union_set.insert(set->begin(), set->end());
+		}
+	}
+	return std::move(union_set).extract();
+}
+
+// keys[0] 的集合减去本地其余 key 的集合
+std::vector<std::string> LocalDiff(Database& db, const KeyList& keys) {
+	const SetType* base = FindSet(db, *keys[0]);
+	if (base == nullptr) {
+		return {};
+	}
+	std::vector<const SetType*> others;
+	for (size_t i = 1; i < keys.size(); ++i) {
+		if (const SetType* set = FindSet(db, *keys[i]); set != nullptr) {
+			others.push_back(set);
+		}
+	}
+	std::vector<std::string> members;
+	for (const auto& member : *base) {
+		bool removed = false;
+		for (size_t i = 0; i < others.size() && !removed; ++i) {
+			removed = others[i]->count(member) != 0;
+		}
+		if (!removed) {
+			members.push_back(member);
+		}
+	}
+	return members;
+}
+
+// 候选成员的保留标记: SINTER 保留在本地所有集合中都存在的成员, SDIFF 保留在本地任何集合中都不存在的成员
+std::vector<uint8_t> LocalFilter(Database& db, const KeyList& keys, const std::vector<std::string>& candidates,
+                                 SetOp op) {
+	const bool keep_if_present = op == SetOp::kInter;
+	std::vector<const SetType*> sets;
+	for (const NanoObj* key : keys) {
+		const SetType* set = FindSet(db, *key);
+		if (set == nullptr) {
+			if (keep_if_present) {
+				return std::vector<uint8_t>(candidates.size(), 0);
+			}
+			continue;
+		}
+		sets.push_back(set);
+	}
+	std::vector<uint8_t> keep(candidates.size(), 1);
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		for (const SetType* set : sets) {
+			if ((set->count(candidates[i]) != 0) != keep_if_present) {
+				keep[i] = 0;
+				break;
+			}
+		}
+	}
+	return keep;
+}
+
+// 在 shard_ids 所在分片上并行执行 func(db, shard_id), 结果按 shard_ids 顺序返回。
+// 单分片模式下只有分片 0, 直接在 ctx 的 Database 上执行。
+template <typename F>
+auto RunOnShards(CommandContext* ctx, const std::vector<size_t>& shard_ids, F&& func) {
+	using RetType = std::invoke_result_t<F&, Database&, size_t>;
+	if (ctx->IsSingleShard() || ctx->shard_set == nullptr) {
+		std::vector<RetType> results;
+		for (size_t shard_id : shard_ids) {
+			results.push_back(func(*ctx->GetDB(), shard_id));
+		}
+		return results;
+	}
+	return ctx->shard_set->AwaitAll(shard_ids, [db_index = ctx->GetDBIndex(), &func](size_t shard_id) -> RetType {
+		EngineShard* shard = EngineShard::Tlocal();
+		if (shard == nullptr) {
+			return RetType {};
+		}
+		auto& db = shard->GetDB();
+		db.Select(db_index);
+		return func(db, shard_id);
+	});
+}
+
+size_t ShardCountOf(CommandContext* ctx) {
+	return (ctx->IsSingleShard() || ctx->shard_set == nullptr) ? 1 : ctx->GetShardCount();
+}
+
+std::vector<std::string> ComputeSetOp(SetOp op, const KeyList& keys, CommandContext* ctx) {
+	const size_t shard_count = ShardCountOf(ctx);
+	std::vector<KeyList> keys_by_shard(shard_count);
+	std::vector<size_t> shard_ids;
+	for (const NanoObj* key : keys) {
+		const size_t shard_id = Shard(*key, shard_count);
+		if (keys_by_shard[shard_id].empty()) {
+			shard_ids.push_back(shard_id);
+		}
+		keys_by_shard[shard_id].push_back(key);
+	}
+
+	if (op == SetOp::kUnion) {
+		auto partials = RunOnShards(ctx, shard_ids, [&keys_by_shard](Database& db, size_t shard_id) {
+			return LocalUnion(db, keys_by_shard[shard_id]);
+		});
+		if (partials.size() == 1) {
+			return std::move(partials[0]);
+		}
+		SetType union_set;
+		for (auto& partial : partials) {
+			for (auto& member : partial) {
+				union_set.insert(std::move(member));
+			}
+		}
+		return std::move(union_set).extract();
+	}
+
+	// 候选集所在的分片: SINTER 选最小集合所在分片, SDIFF 为第一个 key 所在分片
+	size_t base_shard = shard_ids[0];
+	if (op == SetOp::kInter && shard_ids.size() > 1) {
+		const auto cards = RunOnShards(ctx, shard_ids, [&keys_by_shard](Database& db, size_t shard_id) {
+			return LocalMinCard(db, keys_by_shard[shard_id]);
+		});
+		const size_t smallest = static_cast<size_t>(std::min_element(cards.begin(), cards.end()) - cards.begin());
+		if (cards[smallest] == 0) {
+			return {};
+		}
+		base_shard = shard_ids[smallest];
+	}
+
+	auto candidates = std::move(RunOnShards(ctx, {base_shard}, [&keys_by_shard, op](Database& db, size_t shard_id) {
+		return op == SetOp::kInter ? LocalInter(db, keys_by_shard[shard_id]) : LocalDiff(db, keys_by_shard[shard_id]);
+	})[0]);
+	if (candidates.empty() || shard_ids.size() == 1) {
+		return candidates;
+	}
+
+	std::vector<size_t> other_shards;
+	for (size_t shard_id : shard_ids) {
+		if (shard_id != base_shard) {
+			other_shards.push_back(shard_id);
+		}
+	}
+	// 各分片只读 candidates, 写各自的返回值
+	const auto keeps = RunOnShards(ctx, other_shards, [&keys_by_shard, &candidates, op](Database& db, size_t shard_id) {
+		return LocalFilter(db, keys_by_shard[shard_id], candidates, op);
+	});
+	std::vector<std::string> members;
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		bool keep = true;
+		for (const auto& shard_keep : keeps) {
+			if (shard_keep[i] == 0) {
+				keep = false;
+				break;
+			}
+		}
+		if (keep) {
+			members.push_back(std::move(candidates[i]));
+		}
+	}
+	return members;
+}
+
+// 把结果写到 destination 所属分片, 覆盖原值; 结果为空时删除 destination。返回结果基数
+int64_t StoreSet(const NanoObj& dest, const std::vector<std::string>& members, CommandContext* ctx) {
+	const size_t dest_shard = Shard(dest, ShardCountOf(ctx));
+	(void)RunOnShards(ctx, {dest_shard}, [&dest, &members](Database& db, size_t shard_id) -> int64_t {
+		(void)shard_id;
+		db.Del(dest);
+		if (members.empty()) {
+			return 0;
+		}
+		auto* set = new SetType(members.begin(), members.end());
+		NanoObj set_obj = NanoObj::FromSet();
+		set_obj.SetObj(set);
+		db.Set(dest, std::move(set_obj));
+		return 0;
+	});
+	return static_cast<int64_t>(members.size());
+}
+
+std::string MakeMemberArray(const std::vector<std::string>& members, CommandContext* ctx) {
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(members.size());
+	for (const auto& member : members) {
+		reply.BulkString(member);
+	}
+	return result;
+}
 } // namespace
 
 void SetFamily::Register(CommandRegistry* registry) {
 	registry->RegisterCommandWithContext(
 	    "SADD", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SAdd(args, ctx); },
-	    CommandMeta {-3, 1, 1, 1, kWrite});
+	    CommandMeta {-3, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "SREM", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SRem(args, ctx); },
 	    CommandMeta {-3, 1, 1, 1, kWrite});
@@ -65,6 +327,18 @@ void SetFamily::Register(CommandRegistry* registry) {
 	registry->RegisterCommandWithContext(
 	    "SDIFF", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SDiff(args, ctx); },
 	    CommandMeta {-2, 1, -1, 1, kReadOnly | kMultiKey});
+	registry->RegisterCommandWithContext(
+	    "SINTERSTORE", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SInterStore(args, ctx); },
+	    CommandMeta {-3, 1, -1, 1, kWrite | kDenyOom | kMultiKey});
+	registry->RegisterCommandWithContext(
+	    "SUNIONSTORE", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SUnionStore(args, ctx); },
+	    CommandMeta {-3, 1, -1, 1, kWrite | kDenyOom | kMultiKey});
+	registry->RegisterCommandWithContext(
+	    "SDIFFSTORE", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SDiffStore(args, ctx); },
+	    CommandMeta {-3, 1, -1, 1, kWrite | kDenyOom | kMultiKey});
+	registry->RegisterCommandWithContext(
+	    "SINTERCARD", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SInterCard(args, ctx); },
+	    CommandMeta {-3, 2, -1, 1, kReadOnly | kMultiKey | kMovableKeys});
 	registry->RegisterCommandWithContext(
 	    "SSCAN", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SScan(args, ctx); },
 	    CommandMeta {-3, 1, 1, 1, kReadOnly});
@@ -84,17 +358,18 @@ std::string SetFamily::SAdd(const std::vector<NanoObj>& args, CommandContext* ct
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		if (set_obj != nullptr && !set_obj->IsSet()) {
-			db->Del(key);
+			db->Del(key, key_hash);
 		}
 		auto set = new SetType();
 		NanoObj new_set = NanoObj::FromSet();
 		new_set.SetObj(set);
-		db->Set(key, std::move(new_set));
-		set_obj = db->Find(key);
+		db->Set(key, key_hash, std::move(new_set));
+		set_obj = db->Find(key, key_hash);
 	}
 
 	auto set = set_obj->GetObj<SetType>();
@@ -117,7 +392,8 @@ std::string SetFamily::SRem(const std::vector<NanoObj>& args, CommandContext* ct
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		return RESPParser::make_integer(0);
@@ -133,7 +409,7 @@ std::string SetFamily::SRem(const std::vector<NanoObj>& args, CommandContext* ct
 	}
 
 	if (set->empty()) {
-		db->Del(key);
+		db->Del(key, key_hash);
 	}
 
 	return RESPParser::make_integer(removed);
@@ -147,7 +423,8 @@ std::string SetFamily::SPop(const std::vector<NanoObj>& args, CommandContext* ct
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		return RESPParser::make_null_bulk_string();
@@ -166,15 +443,17 @@ std::string SetFamily::SPop(const std::vector<NanoObj>& args, CommandContext* ct
 		}
 	}
 
-	std::string result = RESPParser::make_array(count);
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(static_cast<size_t>(count));
 	int64_t i = 0;
 	for (auto it = set->begin(); i < count && it != set->end(); ++i) {
-		result += RESPParser::make_bulk_string(*it);
+		reply.BulkString(*it);
 		it = set->erase(it);
 	}
 
 	if (set->empty()) {
-		db->Del(key);
+		db->Del(key, key_hash);
 	}
 
 	return result;
@@ -188,7 +467,8 @@ std::string SetFamily::SMembers(const std::vector<NanoObj>& args, CommandContext
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		return RESPParser::make_array(0);
@@ -196,9 +476,11 @@ std::string SetFamily::SMembers(const std::vector<NanoObj>& args, CommandContext
 
 	auto set = set_obj->GetObj<SetType>();
 
-	std::string result = RESPParser::make_array(static_cast<int64_t>(set->size()));
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(set->size());
 	for (const auto& member : *set) {
-		result += RESPParser::make_bulk_string(member);
+		reply.BulkString(member);
 	}
 
 	return result;
@@ -212,7 +494,8 @@ std::string SetFamily::SCard(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		return RESPParser::make_integer(0);
@@ -230,7 +513,8 @@ std::string SetFamily::SIsMember(const std::vector<NanoObj>& args, CommandContex
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		return RESPParser::make_integer(0);
@@ -250,13 +534,16 @@ std::string SetFamily::SMIsMember(const std::vector<NanoObj>& args, CommandConte
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
-	std::string result = RESPParser::make_array(static_cast<int64_t>(args.size() - 2));
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(args.size() - 2);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		for (size_t i = 2; i < args.size(); i++) {
-			result += RESPParser::make_integer(0);
+			reply.Integer(0);
 		}
 		return result;
 	}
@@ -264,7 +551,7 @@ std::string SetFamily::SMIsMember(const std::vector<NanoObj>& args, CommandConte
 	auto set = set_obj->GetObj<SetType>();
 	for (size_t i = 2; i < args.size(); i++) {
 		std::string member = args[i].ToString();
-		result += RESPParser::make_integer(set->count(member) ? 1 : 0);
+		reply.Integer(set->count(member) ? 1 : 0);
 	}
 
 	return result;
@@ -275,43 +562,7 @@ std::string SetFamily::SInter(const std::vector<NanoObj>& args, CommandContext*
 	if (args.size() < 2) {
 		return RESPParser::make_error("wrong number of arguments for SINTER");
 	}
-
-	if (!AllKeysSameShard(args, 1, ctx)) {
-		return RESPParser::make_error("CROSSSLOT Keys in request don't hash to the same slot");
-	}
-
-	auto* db = ctx->GetDB();
-
-	std::vector<SetType*> sets;
-	for (size_t i = 1; i < args.size(); i++) {
-		const NanoObj& key = args[i];
-		auto* set_obj = db->Find(key);
-
-		if (set_obj == nullptr || !set_obj->IsSet()) {
-			return RESPParser::make_array(0);
-		}
-
-		auto set = set_obj->GetObj<SetType>();
-		sets.push_back(set);
-	}
-
-	SetType intersection = *sets[0];
-	for (size_t i = 1; i < sets.size(); i++) {
-		SetType temp;
-		for (const auto& elem : intersection) {
-			if (sets[i]->count(elem)) {
-				temp.insert(elem);
-			}
-		}
-		intersection = std::move(temp);
-	}
-
-	std::string result = RESPParser::make_array(static_cast<int64_t>(intersection.size()));
-	for (const auto& elem : intersection) {
-		result += RESPParser::make_bulk_string(elem);
-	}
-
-	return result;
+	return MakeMemberArray(ComputeSetOp(SetOp::kInter, SourceKeys(args, 1), ctx), ctx);
 }
 
 std::string SetFamily::SUnion(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -319,30 +570,7 @@ std::string SetFamily::SUnion(const std::vector<NanoObj>& args, CommandContext*
 	if (args.size() < 2) {
 		return RESPParser::make_error("wrong number of arguments for SUNION");
 	}
-
-	if (!AllKeysSameShard(args, 1, ctx)) {
-		return RESPParser::make_error("CROSSSLOT Keys in request don't hash to the same slot");
-	}
-
-	auto* db = ctx->GetDB();
-
-	SetType union_set;
-	for (size_t i = 1; i < args.size(); i++) {
-		const NanoObj& key = args[i];
-		auto* set_obj = db->Find(key);
-
-		if (set_obj != nullptr && set_obj->IsSet()) {
-			auto set = set_obj->GetObj<SetType>();
-			union_set.insert(set->begin(), set->end());
-		}
-	}
-
-	std::string result = RESPParser::make_array(static_cast<int64_t>(union_set.size()));
-	for (const auto& elem : union_set) {
-		result += RESPParser::make_bulk_string(elem);
-	}
-
-	return result;
+	return MakeMemberArray(ComputeSetOp(SetOp::kUnion, SourceKeys(args, 1), ctx), ctx);
 }
 
 std::string SetFamily::SDiff(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -350,39 +578,67 @@ std::string SetFamily::SDiff(const std::vector<NanoObj>& args, CommandContext* c
 	if (args.size() < 2) {
 		return RESPParser::make_error("wrong number of arguments for SDIFF");
 	}
+	return MakeMemberArray(ComputeSetOp(SetOp::kDiff, SourceKeys(args, 1), ctx), ctx);
+}
 
-	auto* db = ctx->GetDB();
-	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
-
-	if (set_obj == nullptr || !set_obj->IsSet()) {
-		return RESPParser::make_array(0);
+std::string SetFamily::SInterStore(const std::vector<NanoObj>& args, CommandContext* ctx) {
+	// SINTERSTORE destination key [key ...]
+	if (args.size() < 3) {
+		return RESPParser::make_error("wrong number of arguments for SINTERSTORE");
 	}
+	const auto members = ComputeSetOp(SetOp::kInter, SourceKeys(args, 2), ctx);
+	return RESPParser::make_integer(StoreSet(args[1], members, ctx));
+}
 
-	auto diff_set = *set_obj->GetObj<SetType>();
+std::string SetFamily::SUnionStore(const std::vector<NanoObj>& args, CommandContext* ctx) {
+	// SUNIONSTORE destination key [key ...]
+	if (args.size() < 3) {
+		return RESPParser::make_error("wrong number of arguments for SUNIONSTORE");
+	}
+	const auto members = ComputeSetOp(SetOp::kUnion, SourceKeys(args, 2), ctx);
+	return RESPParser::make_integer(StoreSet(args[1], members, ctx));
+}
 
-	if (!AllKeysSameShard(args, 1, ctx)) {
-		return RESPParser::make_error("CROSSSLOT Keys in request don't hash to the same slot");
+std::string SetFamily::SDiffStore(const std::vector<NanoObj>& args, CommandContext* ctx) {
+	// SDIFFSTORE destination key [key ...]
+	if (args.size() < 3) {
+		return RESPParser::make_error("wrong number of arguments for SDIFFSTORE");
 	}
+	const auto members = ComputeSetOp(SetOp::kDiff, SourceKeys(args, 2), ctx);
+	return RESPParser::make_integer(StoreSet(args[1], members, ctx));
+}
 
-	for (size_t i = 2; i < args.size(); i++) {
-		const NanoObj& other_key = args[i];
-		auto* other_set_obj = db->Find(other_key);
+std::string SetFamily::SInterCard(const std::vector<NanoObj>& args, CommandContext* ctx) {
+	// SINTERCARD numkeys key [key ...] [LIMIT limit]
+	if (args.size() < 3) {
+		return RESPParser::make_error("wrong number of arguments for SINTERCARD");
+	}
+	int64_t numkeys = 0;
+	if (!ParseLongLong(args[1].ToString(), &numkeys) || numkeys <= 0) {
+		return RESPParser::make_error("numkeys should be greater than 0");
+	}
+	const size_t key_end = 2 + static_cast<size_t>(numkeys);
+	if (static_cast<uint64_t>(numkeys) > args.size() - 2) {
+		return RESPParser::make_error("Number of keys can't be greater than number of args");
+	}
 
-		if (other_set_obj != nullptr && other_set_obj->IsSet()) {
-			auto set = other_set_obj->GetObj<SetType>();
-			for (const auto& elem : *set) {
-				diff_set.erase(elem);
-			}
+	int64_t limit = 0;
+	if (key_end < args.size()) {
+		if (key_end + 2 != args.size() || !EqualsIgnoreCase(args[key_end].ToString(), "LIMIT")) {
+			return RESPParser::make_error("syntax error");
+		}
+		if (!ParseLongLong(args[key_end + 1].ToString(), &limit) || limit < 0) {
+			return RESPParser::make_error("LIMIT can't be negative");
 		}
 	}
 
-	std::string result = RESPParser::make_array(static_cast<int64_t>(diff_set.size()));
-	for (const auto& elem : diff_set) {
-		result += RESPParser::make_bulk_string(elem);
+	std::vector<const NanoObj*> keys;
+	for (size_t i = 2; i < key_end; ++i) {
+		keys.push_back(&args[i]);
 	}
-
-	return result;
+	const auto members = ComputeSetOp(SetOp::kInter, keys, ctx);
+	const auto card = static_cast<int64_t>(members.size());
+	return RESPParser::make_integer(limit > 0 ? std::min(card, limit) : card);
 }
 
 std::string SetFamily::SScan(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -393,7 +649,8 @@ std::string SetFamily::SScan(const std::vector<NanoObj>& args, CommandContext* c
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		return RESPParser::make_error("WRONGTYPE Operation against a key holding the wrong kind of value");
@@ -417,11 +674,13 @@ std::string SetFamily::SScan(const std::vector<NanoObj>& args, CommandContext* c
 		return result;
 	}
 
-	std::string result = RESPParser::make_array(2);
-	result += RESPParser::make_bulk_string("0");
-	result += RESPParser::make_array(static_cast<int64_t>(set->size()));
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(2);
+	reply.BulkString("0");
+	reply.ArrayHeader(set->size());
 	for (const auto& elem : *set) {
-		result += RESPParser::make_bulk_string(elem);
+		reply.BulkString(elem);
 	}
 
 	return result;
@@ -435,7 +694,8 @@ std::string SetFamily::SRandMember(const std::vector<NanoObj>& args, CommandCont
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
-	auto* set_obj = db->Find(key);
+	const uint64_t key_hash = ctx->HashOf(key);
+	auto* set_obj = db->Find(key, key_hash);
 
 	if (set_obj == nullptr || !set_obj->IsSet()) {
 		return RESPParser::make_null_bulk_string();
@@ -459,16 +719,20 @@ std::string SetFamily::SRandMember(const std::vector<NanoObj>& args, CommandCont
 		return RESPParser::make_error("count is not a valid integer");
 	}
 
-	std::vector<std::string> members;
+	// 只收集指针, 成员本身直接从集合写进回复
+	std::vector<const std::string*> members;
+	members.reserve(set->size());
 	for (const auto& member : *set) {
-		members.push_back(member);
+		members.push_back(&member);
 	}
 
-	std::string result = RESPParser::make_array(count);
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.ArrayHeader(static_cast<size_t>(count));
 	for (int64_t i = 0; i < count && !members.empty(); i++) {
 		size_t offset = std::rand() % members.size();
-		result += RESPParser::make_bulk_string(members[offset]);
-		members.erase(members.begin() + static_cast<std::vector<std::string>::difference_type>(offset));
+		reply.BulkString(*members[offset]);
+		members.erase(members.begin() + static_cast<std::vector<const std::string*>::difference_type>(offset));
 	}
 
 	return result;
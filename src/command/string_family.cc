@@ -7,13 +7,14 @@
 #include "server/sharding.h"
 #include "server/engine_shard.h"
 #include "server/engine_shard_set.h"
+#include "protocol/reply_builder.h"
 #include "protocol/resp_parser.h"
 #include <photon/common/alog.h>
+#include <algorithm>
 #include <charconv>
 #include <limits>
 #include <optional>
 #include <system_error>
-#include <unordered_map>
 
 namespace {
 
@@ -22,46 +23,135 @@ constexpr const char* kInvalidExpireTimeError = "invalid expire time in 'set' co
 using CommandMeta = CommandRegistry::CommandMeta;
 constexpr uint32_t kReadOnly = CommandRegistry::kCmdFlagReadOnly;
 constexpr uint32_t kWrite = CommandRegistry::kCmdFlagWrite;
+constexpr uint32_t kDenyOom = CommandRegistry::kCmdFlagDenyOom;
 constexpr uint32_t kAdmin = CommandRegistry::kCmdFlagAdmin;
 constexpr uint32_t kMultiKey = CommandRegistry::kCmdFlagMultiKey;
 constexpr uint32_t kNoKey = CommandRegistry::kCmdFlagNoKey;
 
+// 落在同一分片上的一批 key, 以数组形式交给 Database 的批量接口。
+// AwaitAll() 是同步的, 直接引用 args 中的对象; 路由时算好的哈希一并带到目标分片。
+struct KeyBatch {
+	std::vector<size_t> indices;
+	std::vector<const NanoObj*> keys;
+	std::vector<const NanoObj*> values;
+	std::vector<uint64_t> hashes;
+};
+
+// args[1], args[1 + step], ... 是 key; step 为 2 时 key 后紧跟 value (MSET)。
+// 返回值按分片号下标, 没有 key 的分片为空 batch; shard_count 为 1 时所有 key 都在分片 0
+std::vector<KeyBatch> GroupKeysByShard(const std::vector<NanoObj>& args, size_t step, size_t shard_count) {
+	std::vector<KeyBatch> batches(shard_count);
+	for (size_t i = 1; i < args.size(); i += step) {
+		const uint64_t hash = KeyHash(args[i]);
+		KeyBatch& batch = batches[ShardOfKey(args[i], hash, shard_count)];
+		batch.indices.push_back((i - 1) / step);
+		batch.keys.push_back(&args[i]);
+		batch.hashes.push_back(hash);
+		if (step == 2) {
+			batch.values.push_back(&args[i + 1]);
+		}
+	}
+	return batches;
+}
+
+// 把 key 按分片分组, 对每个持有 key 的分片执行 func(db, batch) 并返回各分片结果之和。
+// 多分片时所有分片并行执行 (AwaitAll), func 只能写各自 batch 对应的数据
+template <typename F>
+int64_t ForEachKeyShard(const std::vector<NanoObj>& args, size_t step, CommandContext* ctx, F&& func) {
+	if (ctx->IsSingleShard() || ctx->shard_set == nullptr) {
+		return func(*ctx->GetDB(), GroupKeysByShard(args, step, 1)[0]);
+	}
+
+	const std::vector<KeyBatch> batches = GroupKeysByShard(args, step, ctx->GetShardCount());
+	std::vector<size_t> shard_ids;
+	for (size_t shard_id = 0; shard_id < batches.size(); ++shard_id) {
+		if (!batches[shard_id].keys.empty()) {
+			shard_ids.push_back(shard_id);
+		}
+	}
+	const std::vector<int64_t> results =
+	    ctx->shard_set->AwaitAll(shard_ids, [db_index = ctx->GetDBIndex(), &batches, &func](size_t shard_id) -> int64_t {
+		    EngineShard* shard = EngineShard::Tlocal();
+		    if (shard == nullptr) {
+			    return 0;
+		    }
+		    auto& db = shard->GetDB();
+		    db.Select(db_index);
+		    return func(db, batches[shard_id]);
+	    });
+	int64_t total = 0;
+	for (int64_t result : results) {
+		total += result;
+	}
+	return total;
+}
+
+// DEL / UNLINK 共用: lazy 为 true 时大对象交给所属分片的 lazy free 队列
+int64_t DeleteKeys(const std::vector<NanoObj>& args, CommandContext* ctx, bool lazy) {
+	return ForEachKeyShard(args, 1, ctx, [lazy](Database& db, const KeyBatch& batch) -> int64_t {
+		const size_t count = batch.keys.size();
+		return static_cast<int64_t>(lazy ? db.UnlinkBatch(count, batch.keys.data(), batch.hashes.data())
+		                                 : db.DelBatch(count, batch.keys.data(), batch.hashes.data()));
+	});
+}
+
+// FLUSHDB / FLUSHALL 的可选参数: ASYNC 时换上空表, 旧数据由各分片后台释放; SYNC 或省略时在命令内清空。
+// 返回 nullopt 表示语法错误
+std::optional<bool> ParseFlushAsync(const std::vector<NanoObj>& args) {
+	if (args.size() == 1) {
+		return false;
+	}
+	if (args.size() == 2) {
+		const std::string_view mode = args[1].GetStringView();
+		if (EqualsIgnoreCase(mode, "ASYNC")) {
+			return true;
+		}
+		if (EqualsIgnoreCase(mode, "SYNC")) {
+			return false;
+		}
+	}
+	return std::nullopt;
+}
+
 } // namespace
 
 void StringFamily::Register(CommandRegistry* registry) {
 	registry->RegisterCommandWithContext(
 	    "SET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Set(args, ctx); },
-	    CommandMeta {-3, 1, 1, 1, kWrite});
+	    CommandMeta {-3, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "GET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Get(args, ctx); },
 	    CommandMeta {2, 1, 1, 1, kReadOnly});
 	registry->RegisterCommandWithContext(
 	    "DEL", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Del(args, ctx); },
 	    CommandMeta {-2, 1, -1, 1, kWrite | kMultiKey});
+	registry->RegisterCommandWithContext(
+	    "UNLINK", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Unlink(args, ctx); },
+	    CommandMeta {-2, 1, -1, 1, kWrite | kMultiKey});
 	registry->RegisterCommandWithContext(
 	    "EXISTS", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Exists(args, ctx); },
 	    CommandMeta {-2, 1, -1, 1, kReadOnly | kMultiKey});
 	registry->RegisterCommandWithContext(
 	    "MSET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return MSet(args, ctx); },
-	    CommandMeta {-3, 1, -1, 2, kWrite | kMultiKey});
+	    CommandMeta {-3, 1, -1, 2, kWrite | kDenyOom | kMultiKey});
 	registry->RegisterCommandWithContext(
 	    "MGET", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return MGet(args, ctx); },
 	    CommandMeta {-2, 1, -1, 1, kReadOnly | kMultiKey});
 	registry->RegisterCommandWithContext(
 	    "INCR", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Incr(args, ctx); },
-	    CommandMeta {2, 1, 1, 1, kWrite});
+	    CommandMeta {2, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "DECR", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Decr(args, ctx); },
-	    CommandMeta {2, 1, 1, 1, kWrite});
+	    CommandMeta {2, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "INCRBY", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return IncrBy(args, ctx); },
-	    CommandMeta {3, 1, 1, 1, kWrite});
+	    CommandMeta {3, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "DECRBY", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return DecrBy(args, ctx); },
-	    CommandMeta {3, 1, 1, 1, kWrite});
+	    CommandMeta {3, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "APPEND", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Append(args, ctx); },
-	    CommandMeta {3, 1, 1, 1, kWrite});
+	    CommandMeta {3, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "STRLEN", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return StrLen(args, ctx); },
 	    CommandMeta {2, 1, 1, 1, kReadOnly});
@@ -73,7 +163,7 @@ void StringFamily::Register(CommandRegistry* registry) {
 	    CommandMeta {4, 1, 1, 1, kReadOnly});
 	registry->RegisterCommandWithContext(
 	    "SETRANGE", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return SetRange(args, ctx); },
-	    CommandMeta {4, 1, 1, 1, kWrite});
+	    CommandMeta {4, 1, 1, 1, kWrite | kDenyOom});
 	registry->RegisterCommandWithContext(
 	    "EXPIRE", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return Expire(args, ctx); },
 	    CommandMeta {3, 1, 1, 1, kWrite});
@@ -91,7 +181,10 @@ void StringFamily::Register(CommandRegistry* registry) {
 	    CommandMeta {2, 0, 0, 0, kReadOnly | kNoKey});
 	registry->RegisterCommandWithContext(
 	    "FLUSHDB", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return FlushDB(args, ctx); },
-	    CommandMeta {1, 0, 0, 0, kWrite | kAdmin | kNoKey});
+	    CommandMeta {-1, 0, 0, 0, kWrite | kAdmin | kNoKey});
+	registry->RegisterCommandWithContext(
+	    "FLUSHALL", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return FlushAll(args, ctx); },
+	    CommandMeta {-1, 0, 0, 0, kWrite | kAdmin | kNoKey});
 	registry->RegisterCommandWithContext(
 	    "DBSIZE", [](const std::vector<NanoObj>& args, CommandContext* ctx) { return DBSize(args, ctx); },
 	    CommandMeta {1, 0, 0, 0, kReadOnly | kNoKey});
@@ -118,6 +211,7 @@ std::string StringFamily::Set(const std::vector<NanoObj>& args, CommandContext*
 	}
 
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 	const NanoObj& value = args[2];
 
 	int64_t ttl_ms = -1;
@@ -141,11 +235,11 @@ std::string StringFamily::Set(const std::vector<NanoObj>& args, CommandContext*
 		}
 	}
 
-	db->Set(key, NanoObj(value));
+	// 一次探测同时写值和 TTL: 不带 EX/PX 的 SET 清除原有 TTL
 	if (ttl_ms >= 0) {
-		(void)db->Expire(key, ttl_ms);
+		db->Set(key, key_hash, NanoObj(value), Database::SetTtl::kSet, ttl_ms);
 	} else {
-		(void)db->Persist(key);
+		db->Set(key, key_hash, NanoObj(value), Database::SetTtl::kClear);
 	}
 	return RESPParser::ok_response();
 }
@@ -157,66 +251,30 @@ std::string StringFamily::Get(const std::vector<NanoObj>& args, CommandContext*
 		return RESPParser::make_error("wrong number of arguments for 'GET'");
 	}
 
-	auto result = db->Get(args[1]);
-	if (result) {
-		return RESPParser::make_bulk_string(*result);
-	} else {
+	// 直接从存储的值编码回复, 不经过中间的 std::string 拷贝
+	const NanoObj* value = db->Find(args[1], ctx->HashOf(args[1]));
+	if (value == nullptr) {
 		return RESPParser::make_null_bulk_string();
 	}
+	const std::string_view view = value->GetStringView();
+	if (view.empty()) {
+		return RESPParser::make_bulk_string(value->ToString());
+	}
+	return RESPParser::make_bulk_string(view);
 }
 
 std::string StringFamily::Del(const std::vector<NanoObj>& args, CommandContext* ctx) {
 	if (args.size() < 2) {
 		return RESPParser::make_error("wrong number of arguments for 'DEL'");
 	}
+	return RESPParser::make_integer(DeleteKeys(args, ctx, false));
+}
 
-	if (ctx->IsSingleShard() || ctx->shard_set == nullptr) {
-		auto* db = ctx->GetDB();
-		int count = 0;
-		for (size_t i = 1; i < args.size(); ++i) {
-			if (db->Del(args[i])) {
-				++count;
-			}
-		}
-		return RESPParser::make_integer(count);
-	}
-
-	struct KeyReq {
-		std::string key;
-	};
-
-	std::unordered_map<size_t, std::vector<KeyReq>> shard_to_keys;
-	shard_to_keys.reserve(args.size() - 1);
-
-	for (size_t i = 1; i < args.size(); ++i) {
-		std::string key = args[i].ToString();
-		const size_t shard_id = Shard(key, ctx->GetShardCount());
-		shard_to_keys[shard_id].push_back(KeyReq {std::move(key)});
-	}
-
-	int count = 0;
-
-	for (auto& [shard_id, keys] : shard_to_keys) {
-		int shard_deleted =
-		    ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex(), keys = std::move(keys)]() mutable -> int {
-			    EngineShard* shard = EngineShard::Tlocal();
-			    if (shard == nullptr) {
-				    return 0;
-			    }
-			    auto& db = shard->GetDB();
-			    db.Select(db_index);
-			    int local_deleted = 0;
-			    for (const auto& k : keys) {
-				    if (db.Del(NanoObj::FromKey(k.key))) {
-					    ++local_deleted;
-				    }
-			    }
-			    return local_deleted;
-		    });
-		count += shard_deleted;
+std::string StringFamily::Unlink(const std::vector<NanoObj>& args, CommandContext* ctx) {
+	if (args.size() < 2) {
+		return RESPParser::make_error("wrong number of arguments for 'UNLINK'");
 	}
-
-	return RESPParser::make_integer(count);
+	return RESPParser::make_integer(DeleteKeys(args, ctx, true));
 }
 
 std::string StringFamily::Exists(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -224,51 +282,17 @@ std::string StringFamily::Exists(const std::vector<NanoObj>& args, CommandContex
 		return RESPParser::make_error("wrong number of arguments for 'EXISTS'");
 	}
 
-	if (ctx->IsSingleShard() || ctx->shard_set == nullptr) {
-		auto* db = ctx->GetDB();
-		int count = 0;
-		for (size_t i = 1; i < args.size(); ++i) {
-			if (db->Exists(args[i])) {
-				++count;
+	const int64_t count = ForEachKeyShard(args, 1, ctx, [](Database& db, const KeyBatch& batch) -> int64_t {
+		std::vector<const NanoObj*> found(batch.keys.size());
+		db.FindBatch(batch.keys.size(), batch.keys.data(), batch.hashes.data(), found.data());
+		int64_t existing = 0;
+		for (const NanoObj* obj : found) {
+			if (obj != nullptr) {
+				++existing;
 			}
 		}
-		return RESPParser::make_integer(count);
-	}
-
-	struct KeyReq {
-		std::string key;
-	};
-
-	std::unordered_map<size_t, std::vector<KeyReq>> shard_to_keys;
-	shard_to_keys.reserve(args.size() - 1);
-
-	for (size_t i = 1; i < args.size(); ++i) {
-		std::string key = args[i].ToString();
-		const size_t shard_id = Shard(key, ctx->GetShardCount());
-		shard_to_keys[shard_id].push_back(KeyReq {std::move(key)});
-	}
-
-	int count = 0;
-	for (auto& [shard_id, keys] : shard_to_keys) {
-		int shard_count =
-		    ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex(), keys = std::move(keys)]() mutable -> int {
-			    EngineShard* shard = EngineShard::Tlocal();
-			    if (shard == nullptr) {
-				    return 0;
-			    }
-			    auto& db = shard->GetDB();
-			    db.Select(db_index);
-			    int local_exists = 0;
-			    for (const auto& k : keys) {
-				    if (db.Exists(NanoObj::FromKey(k.key))) {
-					    ++local_exists;
-				    }
-			    }
-			    return local_exists;
-		    });
-		count += shard_count;
-	}
-
+		return existing;
+	});
 	return RESPParser::make_integer(count);
 }
 
@@ -277,48 +301,10 @@ std::string StringFamily::MSet(const std::vector<NanoObj>& args, CommandContext*
 		return RESPParser::make_error("wrong number of arguments for 'MSET'");
 	}
 
-	size_t num_pairs = (args.size() - 1) / 2;
-
-	if (ctx->IsSingleShard() || ctx->shard_set == nullptr) {
-		auto* db = ctx->GetDB();
-		for (size_t i = 1; i < args.size(); i += 2) {
-			db->Set(args[i], NanoObj(args[i + 1]));
-			(void)db->Persist(args[i]);
-		}
-		return RESPParser::ok_response();
-	}
-
-	struct KvPair {
-		std::string key;
-		std::string value;
-	};
-
-	std::unordered_map<size_t, std::vector<KvPair>> shard_to_pairs;
-	shard_to_pairs.reserve(num_pairs);
-
-	for (size_t i = 1; i < args.size(); i += 2) {
-		std::string key = args[i].ToString();
-		std::string value = args[i + 1].ToString();
-		const size_t shard_id = Shard(key, ctx->GetShardCount());
-		shard_to_pairs[shard_id].push_back(KvPair {std::move(key), std::move(value)});
-	}
-
-	for (auto& [shard_id, pairs] : shard_to_pairs) {
-		ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex(), pairs = std::move(pairs)]() mutable {
-			EngineShard* shard = EngineShard::Tlocal();
-			if (shard == nullptr) {
-				return;
-			}
-			auto& db = shard->GetDB();
-			db.Select(db_index);
-			for (const auto& kv : pairs) {
-				NanoObj key = NanoObj::FromKey(kv.key);
-				db.Set(key, NanoObj::FromKey(kv.value));
-				(void)db.Persist(key);
-			}
-		});
-	}
-
+	(void)ForEachKeyShard(args, 2, ctx, [](Database& db, const KeyBatch& batch) -> int64_t {
+		db.SetBatch(batch.keys.size(), batch.keys.data(), batch.hashes.data(), batch.values.data());
+		return 0;
+	});
 	return RESPParser::ok_response();
 }
 
@@ -327,68 +313,47 @@ std::string StringFamily::MGet(const std::vector<NanoObj>& args, CommandContext*
 		return RESPParser::make_error("wrong number of arguments for 'MGET'");
 	}
 
+	// 某个 key 的回复在 buffers[buffer] 中的位置; length 为 0 表示不存在 (编码后的 bulk string 不会为空)
+	struct EncodedValue {
+		size_t buffer = 0;
+		size_t offset = 0;
+		size_t length = 0;
+	};
 	size_t num_keys = args.size() - 1;
-
-	if (ctx->IsSingleShard() || ctx->shard_set == nullptr) {
-		auto* db = ctx->GetDB();
-		std::string result = RESPParser::make_array(static_cast<int64_t>(num_keys));
-		for (size_t i = 1; i < args.size(); ++i) {
-			auto val = db->Get(args[i]);
-			if (val) {
-				result += RESPParser::make_bulk_string(*val);
-			} else {
-				result += RESPParser::make_null_bulk_string();
+	std::vector<EncodedValue> encoded(num_keys);
+	// 每批一个缓冲区, 以该批第一个 key 的下标编号, 各分片写的缓冲区互不重叠
+	std::vector<std::string> buffers(num_keys);
+
+	// 值在目标分片上直接编码成 RESP: 返回后该分片可能继续修改表, 不能把对象指针带回来
+	(void)ForEachKeyShard(args, 1, ctx, [&encoded, &buffers](Database& db, const KeyBatch& batch) -> int64_t {
+		std::vector<const NanoObj*> found(batch.keys.size());
+		db.FindBatch(batch.keys.size(), batch.keys.data(), batch.hashes.data(), found.data());
+		const size_t buffer_index = batch.indices[0];
+		std::string& buffer = buffers[buffer_index];
+		ReplyBuilder reply(&buffer);
+		for (size_t i = 0; i < found.size(); ++i) {
+			if (found[i] != nullptr) {
+				const size_t offset = buffer.size();
+				reply.BulkString(*found[i]);
+				encoded[batch.indices[i]] = {buffer_index, offset, buffer.size() - offset};
 			}
 		}
-		return result;
-	}
-
-	struct KeyReq {
-		size_t index;
-		std::string key;
-	};
-
-	std::unordered_map<size_t, std::vector<KeyReq>> shard_to_reqs;
-	shard_to_reqs.reserve(num_keys);
-
-	for (size_t i = 1; i < args.size(); ++i) {
-		std::string key = args[i].ToString();
-		const size_t shard_id = Shard(key, ctx->GetShardCount());
-		shard_to_reqs[shard_id].push_back(KeyReq {i - 1, std::move(key)});
-	}
-
-	std::vector<std::optional<std::string>> final_values(num_keys);
-
-	for (auto& [shard_id, reqs] : shard_to_reqs) {
-		auto results = ctx->shard_set->Await(shard_id,
-		                                     [db_index = ctx->GetDBIndex(), reqs = std::move(reqs)]() mutable
-		                                     -> std::vector<std::pair<size_t, std::optional<std::string>>> {
-			                                     std::vector<std::pair<size_t, std::optional<std::string>>> out;
-			                                     out.reserve(reqs.size());
-
-			                                     EngineShard* shard = EngineShard::Tlocal();
-			                                     if (shard == nullptr) {
-				                                     return out;
-			                                     }
-			                                     auto& db = shard->GetDB();
-			                                     db.Select(db_index);
-			                                     for (const auto& req : reqs) {
-				                                     out.emplace_back(req.index, db.Get(NanoObj::FromKey(req.key)));
-			                                     }
-			                                     return out;
-		                                     });
-
-		for (auto& [idx, val] : results) {
-			final_values[idx] = std::move(val);
-		}
-	}
-
-	std::string result = RESPParser::make_array(static_cast<int64_t>(num_keys));
-	for (size_t i = 0; i < num_keys; ++i) {
-		if (final_values[i]) {
-			result += RESPParser::make_bulk_string(*final_values[i]);
+		return 0;
+	});
+
+	size_t total_bytes = 0;
+	for (const std::string& buffer : buffers) {
+		total_bytes += buffer.size();
+	}
+	std::string result;
+	ReplyBuilder reply(ctx->ReplyTarget(&result));
+	reply.Reserve(total_bytes + num_keys * 5 + 16);
+	reply.ArrayHeader(num_keys);
+	for (const EncodedValue& value : encoded) {
+		if (value.length != 0) {
+			reply.Raw(std::string_view(buffers[value.buffer]).substr(value.offset, value.length));
 		} else {
-			result += RESPParser::make_null_bulk_string();
+			reply.NullBulkString();
 		}
 	}
 
@@ -402,9 +367,10 @@ std::string StringFamily::Incr(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 
 	int64_t new_value;
-	auto current = db->Get(key);
+	auto current = db->Get(key, key_hash);
 	if (current) {
 		auto current_value = ParseInt(*current);
 		if (!current_value) {
@@ -415,7 +381,7 @@ std::string StringFamily::Incr(const std::vector<NanoObj>& args, CommandContext*
 		new_value = 1;
 	}
 
-	db->Set(key, NanoObj::FromInt(new_value));
+	db->Set(key, key_hash, NanoObj::FromInt(new_value));
 	return RESPParser::make_integer(new_value);
 }
 
@@ -426,9 +392,10 @@ std::string StringFamily::Decr(const std::vector<NanoObj>& args, CommandContext*
 
 	auto* db = ctx->GetDB();
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 
 	int64_t new_value;
-	auto current = db->Get(key);
+	auto current = db->Get(key, key_hash);
 	if (current) {
 		auto current_value = ParseInt(*current);
 		if (!current_value) {
@@ -439,7 +406,7 @@ std::string StringFamily::Decr(const std::vector<NanoObj>& args, CommandContext*
 		new_value = -1;
 	}
 
-	db->Set(key, NanoObj::FromInt(new_value));
+	db->Set(key, key_hash, NanoObj::FromInt(new_value));
 	return RESPParser::make_integer(new_value);
 }
 
@@ -451,13 +418,14 @@ std::string StringFamily::IncrBy(const std::vector<NanoObj>& args, CommandContex
 	}
 
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 	auto increment = ParseInt(args[2].ToString());
 	if (!increment) {
 		return RESPParser::make_error(kInvalidIntegerError);
 	}
 
 	int64_t new_value;
-	auto current = db->Get(key);
+	auto current = db->Get(key, key_hash);
 	if (current) {
 		auto current_value = ParseInt(*current);
 		if (!current_value) {
@@ -468,7 +436,7 @@ std::string StringFamily::IncrBy(const std::vector<NanoObj>& args, CommandContex
 		new_value = *increment;
 	}
 
-	db->Set(key, NanoObj::FromInt(new_value));
+	db->Set(key, key_hash, NanoObj::FromInt(new_value));
 	return RESPParser::make_integer(new_value);
 }
 
@@ -484,8 +452,9 @@ std::string StringFamily::DecrBy(const std::vector<NanoObj>& args, CommandContex
 	}
 
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 	int64_t new_value;
-	auto current = db->Get(key);
+	auto current = db->Get(key, key_hash);
 	if (current) {
 		auto current_value = ParseInt(*current);
 		if (!current_value) {
@@ -496,7 +465,7 @@ std::string StringFamily::DecrBy(const std::vector<NanoObj>& args, CommandContex
 		new_value = -*decrement;
 	}
 
-	db->Set(key, NanoObj::FromInt(new_value));
+	db->Set(key, key_hash, NanoObj::FromInt(new_value));
 	return RESPParser::make_integer(new_value);
 }
 
@@ -508,17 +477,18 @@ std::string StringFamily::Append(const std::vector<NanoObj>& args, CommandContex
 	}
 
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 	const NanoObj& value = args[2];
 
 	std::string new_value;
-	auto current = db->Get(key);
+	auto current = db->Get(key, key_hash);
 	if (current) {
 		new_value = *current + value.ToString();
 	} else {
 		new_value = value.ToString();
 	}
 
-	db->Set(key, NanoObj::FromKey(new_value));
+	db->Set(key, key_hash, NanoObj::FromKey(new_value));
 	return RESPParser::make_integer(static_cast<int64_t>(new_value.length()));
 }
 
@@ -529,7 +499,7 @@ std::string StringFamily::StrLen(const std::vector<NanoObj>& args, CommandContex
 		return RESPParser::make_error("wrong number of arguments for 'STRLEN'");
 	}
 
-	auto val = db->Get(args[1]);
+	auto val = db->Get(args[1], ctx->HashOf(args[1]));
 	if (val) {
 		return RESPParser::make_integer(static_cast<int64_t>(val->length()));
 	} else {
@@ -543,7 +513,7 @@ std::string StringFamily::Type(const std::vector<NanoObj>& args, CommandContext*
 	}
 
 	auto* db = ctx->GetDB();
-	const NanoObj* value = db->Find(args[1]);
+	const NanoObj* value = db->Find(args[1], ctx->HashOf(args[1]));
 	if (value == nullptr) {
 		return RESPParser::make_simple_string("none");
 	}
@@ -572,13 +542,14 @@ std::string StringFamily::GetRange(const std::vector<NanoObj>& args, CommandCont
 	}
 
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 	auto start = ParseInt(args[2].ToString());
 	auto end = ParseInt(args[3].ToString());
 	if (!start || !end) {
 		return RESPParser::make_error(kInvalidIntegerError);
 	}
 
-	auto val = db->Get(key);
+	auto val = db->Get(key, key_hash);
 	if (!val) {
 		return RESPParser::make_bulk_string("");
 	}
@@ -606,6 +577,7 @@ std::string StringFamily::SetRange(const std::vector<NanoObj>& args, CommandCont
 	}
 
 	const NanoObj& key = args[1];
+	const uint64_t key_hash = ctx->HashOf(key);
 	auto offset = ParseInt(args[2].ToString());
 	if (!offset) {
 		return RESPParser::make_error(kInvalidIntegerError);
@@ -613,7 +585,7 @@ std::string StringFamily::SetRange(const std::vector<NanoObj>& args, CommandCont
 	const NanoObj& value = args[3];
 
 	std::string new_value;
-	auto current = db->Get(key);
+	auto current = db->Get(key, key_hash);
 	if (current) {
 		new_value = *current;
 	}
@@ -631,7 +603,7 @@ std::string StringFamily::SetRange(const std::vector<NanoObj>& args, CommandCont
 		new_value[offset_sz + i] = value_str[i];
 	}
 
-	db->Set(key, NanoObj::FromKey(new_value));
+	db->Set(key, key_hash, NanoObj::FromKey(new_value));
 	return RESPParser::make_integer(static_cast<int64_t>(new_value.length()));
 }
 
@@ -655,7 +627,7 @@ std::string StringFamily::Expire(const std::vector<NanoObj>& args, CommandContex
 		}
 	}
 
-	return RESPParser::make_integer(db->Expire(args[1], ttl_ms) ? 1 : 0);
+	return RESPParser::make_integer(db->Expire(args[1], ctx->HashOf(args[1]), ttl_ms) ? 1 : 0);
 }
 
 std::string StringFamily::TTL(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -664,7 +636,7 @@ std::string StringFamily::TTL(const std::vector<NanoObj>& args, CommandContext*
 	}
 
 	auto* db = ctx->GetDB();
-	return RESPParser::make_integer(db->TTL(args[1]));
+	return RESPParser::make_integer(db->TTL(args[1], ctx->HashOf(args[1])));
 }
 
 std::string StringFamily::Persist(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -673,7 +645,7 @@ std::string StringFamily::Persist(const std::vector<NanoObj>& args, CommandConte
 	}
 
 	auto* db = ctx->GetDB();
-	return RESPParser::make_integer(db->Persist(args[1]) ? 1 : 0);
+	return RESPParser::make_integer(db->Persist(args[1], ctx->HashOf(args[1])) ? 1 : 0);
 }
 
 std::string StringFamily::Select(const std::vector<NanoObj>& args, CommandContext* ctx) {
@@ -706,19 +678,17 @@ std::string StringFamily::Select(const std::vector<NanoObj>& args, CommandContex
 	// In sharded mode we keep database selection consistent across all shards
 	// (current implementation is global, not per-connection).
 	if (ctx->shard_set && !ctx->IsSingleShard()) {
-		for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-			bool ok = ctx->shard_set->Await(shard_id, [db_index_size_t]() -> bool {
-				EngineShard* shard = EngineShard::Tlocal();
-				if (shard == nullptr) {
-					return false;
-				}
-				auto& shard_db = shard->GetDB();
-				return shard_db.Select(db_index_size_t);
-			});
-
-			if (!ok) {
-				return RESPParser::make_error("DB index out of range");
+		const std::vector<bool> selected = ctx->shard_set->AwaitOnAll([db_index_size_t](size_t shard_id) -> bool {
+			(void)shard_id;
+			EngineShard* shard = EngineShard::Tlocal();
+			if (shard == nullptr) {
+				return false;
 			}
+			auto& shard_db = shard->GetDB();
+			return shard_db.Select(db_index_size_t);
+		});
+		if (std::find(selected.begin(), selected.end(), false) != selected.end()) {
+			return RESPParser::make_error("DB index out of range");
 		}
 
 		ctx->db_index = db_index_size_t;
@@ -738,53 +708,102 @@ std::string StringFamily::Keys(const std::vector<NanoObj>& args, CommandContext*
 	if (!ctx->shard_set || ctx->IsSingleShard()) {
 		auto* db = ctx->GetDB();
 		std::vector<std::string> keys = db->Keys();
-		std::string response = RESPParser::make_array(static_cast<int64_t>(keys.size()));
+		std::string response;
+		ReplyBuilder reply(ctx->ReplyTarget(&response));
+		reply.ArrayHeader(keys.size());
 		for (const auto& key : keys) {
-			response += RESPParser::make_bulk_string(key);
+			reply.BulkString(key);
 		}
 		return response;
 	}
 
-	std::vector<std::string> all_keys;
-	for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-		auto shard_keys = ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex()]() -> std::vector<std::string> {
-			EngineShard* shard = EngineShard::Tlocal();
-			if (!shard) {
-				return {};
-			}
-			auto& db = shard->GetDB();
-			db.Select(db_index);
-			return db.Keys();
-		});
-		all_keys.insert(all_keys.end(), shard_keys.begin(), shard_keys.end());
-	}
-
-	std::string response = RESPParser::make_array(static_cast<int64_t>(all_keys.size()));
-	for (const auto& key : all_keys) {
-		response += RESPParser::make_bulk_string(key);
+	const auto per_shard_keys =
+	    ctx->shard_set->AwaitOnAll([db_index = ctx->GetDBIndex()](size_t shard_id) -> std::vector<std::string> {
+		    (void)shard_id;
+		    EngineShard* shard = EngineShard::Tlocal();
+		    if (!shard) {
+			    return {};
+		    }
+		    auto& db = shard->GetDB();
+		    db.Select(db_index);
+		    return db.Keys();
+	    });
+	size_t total_keys = 0;
+	for (const auto& shard_keys : per_shard_keys) {
+		total_keys += shard_keys.size();
+	}
+
+	std::string response;
+	ReplyBuilder reply(ctx->ReplyTarget(&response));
+	reply.ArrayHeader(total_keys);
+	for (const auto& shard_keys : per_shard_keys) {
+		for (const auto& key : shard_keys) {
+			reply.BulkString(key);
+		}
 	}
 	return response;
 }
 
 std::string StringFamily::FlushDB(const std::vector<NanoObj>& args, CommandContext* ctx) {
-	(void)args;
+	const std::optional<bool> async = ParseFlushAsync(args);
+	if (!async.has_value()) {
+		return RESPParser::make_error("syntax error");
+	}
+	// 每个分片使自己表中该 db 上的 WATCH 失效
+	auto flush = [async = *async](Database& db) {
+		db.Watches().TouchDb(db.CurrentDB());
+		if (async) {
+			db.ClearCurrentDBAsync();
+		} else {
+			db.ClearCurrentDB();
+		}
+	};
+
 	if (!ctx->shard_set || ctx->IsSingleShard()) {
-		auto* db = ctx->GetDB();
-		db->ClearCurrentDB();
+		flush(*ctx->GetDB());
 		return RESPParser::ok_response();
 	}
 
-	for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-		ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex()]() {
-			EngineShard* shard = EngineShard::Tlocal();
-			if (shard) {
-				auto& db = shard->GetDB();
-				db.Select(db_index);
-				db.ClearCurrentDB();
-			}
-		});
+	ctx->shard_set->AwaitOnAll([db_index = ctx->GetDBIndex(), &flush](size_t shard_id) {
+		(void)shard_id;
+		EngineShard* shard = EngineShard::Tlocal();
+		if (shard) {
+			auto& db = shard->GetDB();
+			db.Select(db_index);
+			flush(db);
+		}
+	});
+
+	return RESPParser::ok_response();
+}
+
+std::string StringFamily::FlushAll(const std::vector<NanoObj>& args, CommandContext* ctx) {
+	const std::optional<bool> async = ParseFlushAsync(args);
+	if (!async.has_value()) {
+		return RESPParser::make_error("syntax error");
+	}
+	auto flush = [async = *async](Database& db) {
+		db.Watches().TouchAll();
+		if (async) {
+			db.ClearAllAsync();
+		} else {
+			db.ClearAll();
+		}
+	};
+
+	if (!ctx->shard_set || ctx->IsSingleShard()) {
+		flush(*ctx->GetDB());
+		return RESPParser::ok_response();
 	}
 
+	ctx->shard_set->AwaitOnAll([&flush](size_t shard_id) {
+		(void)shard_id;
+		EngineShard* shard = EngineShard::Tlocal();
+		if (shard) {
+			flush(shard->GetDB());
+		}
+	});
+
 	return RESPParser::ok_response();
 }
 
@@ -796,17 +815,18 @@ std::string StringFamily::DBSize(const std::vector<NanoObj>& args, CommandContex
 		return RESPParser::make_integer(static_cast<int64_t>(count));
 	}
 
+	const std::vector<size_t> shard_counts = ctx->shard_set->AwaitOnAll([db_index = ctx->GetDBIndex()](size_t shard_id) -> size_t {
+		(void)shard_id;
+		EngineShard* shard = EngineShard::Tlocal();
+		if (shard) {
+			auto& db = shard->GetDB();
+			db.Select(db_index);
+			return db.KeyCount();
+		}
+		return 0;
+	});
 	size_t total_count = 0;
-	for (size_t shard_id = 0; shard_id < ctx->shard_set->Size(); ++shard_id) {
-		size_t shard_count = ctx->shard_set->Await(shard_id, [db_index = ctx->GetDBIndex()]() -> size_t {
-			EngineShard* shard = EngineShard::Tlocal();
-			if (shard) {
-				auto& db = shard->GetDB();
-				db.Select(db_index);
-				return db.KeyCount();
-			}
-			return 0;
-		});
+	for (size_t shard_count : shard_counts) {
 		total_count += shard_count;
 	}
 
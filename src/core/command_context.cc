@@ -1,5 +1,6 @@
 #include "core/command_context.h"
 #include "core/database.h"
+#include "core/key_hash.h"
 #include "server/engine_shard.h"
 #include "server/engine_shard_set.h"
 
@@ -17,6 +18,13 @@ Database* CommandContext::GetDB() const {
 	return db;
 }
 
+uint64_t CommandContext::HashOf(const NanoObj& key) const {
+	if (&key == hashed_key) {
+		return hashed_key_hash;
+	}
+	return KeyHash(key);
+}
+
 Database* CommandContext::GetShardDB(size_t shard_id) const {
 	// Unsafe in multi-shard mode. Keep it only for legacy/unit-test code paths.
 	if (!shard_set || shard_count <= 1) {
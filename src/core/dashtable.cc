@@ -1,21 +1,85 @@
 #include "core/dashtable.h"
+#include "core/database.h"
 #include "core/nano_obj.h"
 #include <cassert>
 #include <algorithm>
 #include <iostream>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+template <typename K, typename V>
+uint32_t DashTable<K, V>::Bucket::MatchFingerprint(uint8_t fp) const {
+#if defined(__SSE2__)
+	// 16 个指纹一次比较, 未占用槽位通过 busy 过滤
+	const __m128i needle = _mm_set1_epi8(static_cast<char>(fp));
+	const __m128i hay = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fingerprints));
+	const uint32_t eq = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(needle, hay)));
+	return eq & busy;
+#else
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < kSlotsPerBucket; ++i) {
+		if (fingerprints[i] == fp) {
+			mask |= 1u << i;
+		}
+	}
+	return mask & busy;
+#endif
+}
+
+template <typename K, typename V>
+DashTable<K, V>::Segment::Segment(uint8_t depth, uint32_t id, uint32_t regular_buckets)
+    : local_depth(depth), segment_id(id), bucket_mask(regular_buckets - 1) {
+	Bucket* buckets = Buckets();
+	for (uint32_t b = 0; b < TotalBucketCount(); ++b) {
+		new (&buckets[b]) Bucket();
+	}
+}
+
+template <typename K, typename V>
+DashTable<K, V>::Segment::~Segment() {
+	Bucket* buckets = Buckets();
+	for (uint32_t b = 0; b < TotalBucketCount(); ++b) {
+		uint32_t mask = buckets[b].busy;
+		while (mask != 0) {
+			const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+			mask &= mask - 1;
+			buckets[b].SlotAt(i)->~Slot();
+		}
+	}
+}
+
+template <typename K, typename V>
+std::shared_ptr<typename DashTable<K, V>::Segment> DashTable<K, V>::Segment::Create(uint8_t depth, uint32_t id,
+                                                                                      uint32_t regular_buckets) {
+	const size_t bytes = HeaderSize() + sizeof(Bucket) * (regular_buckets + kStashBucketCount);
+	void* mem = ::operator new(bytes, std::align_val_t {alignof(Bucket)});
+	Segment* seg = new (mem) Segment(depth, id, regular_buckets);
+	return std::shared_ptr<Segment>(seg, [](Segment* s) {
+		s->~Segment();
+		::operator delete(static_cast<void*>(s), std::align_val_t {alignof(Bucket)});
+	});
+}
+
 template <typename K, typename V>
-DashTable<K, V>::DashTable(uint64_t initial_segment_count, uint64_t max_segment_size)
-    : global_depth(0), max_segment_size(max_segment_size) {
+DashTable<K, V>::DashTable(uint64_t initial_segment_count, uint64_t fixed_bucket_count)
+    : global_depth(0), min_depth_(0), fixed_bucket_count(2) {
 	assert(initial_segment_count > 0);
 	assert((initial_segment_count & (initial_segment_count - 1)) == 0);
 
+	// 邻居探测需要至少两个常规 bucket, 且 bucket 下标用掩码计算
+	while (this->fixed_bucket_count < fixed_bucket_count) {
+		this->fixed_bucket_count <<= 1;
+	}
+
 	global_depth = static_cast<uint8_t>(__builtin_ctz(initial_segment_count));
+	min_depth_ = global_depth;
 	segment_directory.reserve(initial_segment_count);
 
 	for (uint32_t i = 0; i < initial_segment_count; ++i) {
-		segment_directory.push_back(std::make_shared<Segment>(global_depth, i, max_segment_size));
+		segment_directory.push_back(Segment::Create(global_depth, i, this->fixed_bucket_count));
 	}
 }
 
@@ -26,11 +90,13 @@ DashTable<K, V>::~DashTable() {
 template <typename K, typename V>
 DashTable<K, V>::DashTable(DashTable&& other) noexcept
     : segment_directory(std::move(other.segment_directory)), global_depth(other.global_depth),
-      max_segment_size(other.max_segment_size) {
+      min_depth_(other.min_depth_), fixed_bucket_count(other.fixed_bucket_count),
+      migration_(std::move(other.migration_)), incremental_split_(other.incremental_split_), size_(other.size_) {
 	other.global_depth = 0;
+	other.min_depth_ = 0;
+	other.size_ = 0;
 	other.segment_directory.clear();
-	other.segment_directory.resize(1);
-	other.segment_directory[0] = std::make_shared<Segment>(other.global_depth, 0, other.max_segment_size);
+	other.segment_directory.push_back(Segment::Create(0, 0, other.fixed_bucket_count));
 }
 
 template <typename K, typename V>
@@ -38,75 +104,287 @@ DashTable<K, V>& DashTable<K, V>::operator=(DashTable&& other) noexcept {
 	if (this != &other) {
 		segment_directory = std::move(other.segment_directory);
 		global_depth = other.global_depth;
-		max_segment_size = other.max_segment_size;
+		min_depth_ = other.min_depth_;
+		fixed_bucket_count = other.fixed_bucket_count;
+		size_ = other.size_;
+		migration_ = std::move(other.migration_);
+		incremental_split_ = other.incremental_split_;
 
 		other.global_depth = 0;
+		other.min_depth_ = 0;
+		other.size_ = 0;
 		other.segment_directory.clear();
-		other.segment_directory.resize(1);
-		other.segment_directory[0] = std::make_shared<Segment>(other.global_depth, 0, other.max_segment_size);
+		other.segment_directory.push_back(Segment::Create(0, 0, other.fixed_bucket_count));
 	}
 	return *this;
 }
 
+template <typename K, typename V>
+bool DashTable<K, V>::FindSlot(const Segment& seg, const K& key, uint64_t hash, SlotPos* pos) const {
+	const Bucket* buckets = seg.Buckets();
+	const uint8_t fp = Fingerprint(hash);
+	const uint32_t home = HomeBucket(seg, hash);
+	const uint32_t neighbour = (home + 1) & seg.bucket_mask;
+
+	auto probe = [&](uint32_t b) {
+		uint32_t mask = buckets[b].MatchFingerprint(fp);
+		while (mask != 0) {
+			const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+			mask &= mask - 1;
+			if (buckets[b].SlotAt(i)->key == key) {
+				*pos = SlotPos {b, i};
+				return true;
+			}
+		}
+		return false;
+	};
+
+	if (probe(home) || probe(neighbour)) {
+		return true;
+	}
+	if (buckets[home].stash_refs == 0) {
+		return false;
+	}
+	for (uint32_t b = seg.RegularBucketCount(); b < seg.TotalBucketCount(); ++b) {
+		if (probe(b)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename K, typename V>
+template <typename BusyFn>
+uint32_t DashTable<K, V>::ChooseBucket(const Segment& seg, uint32_t home, BusyFn&& busy_of) {
+	constexpr uint32_t kFullMask = (1u << kSlotsPerBucket) - 1;
+	if (busy_of(home) != kFullMask) {
+		return home;
+	}
+	const uint32_t neighbour = (home + 1) & seg.bucket_mask;
+	if (busy_of(neighbour) != kFullMask) {
+		return neighbour;
+	}
+	for (uint32_t b = seg.RegularBucketCount(); b < seg.TotalBucketCount(); ++b) {
+		if (busy_of(b) != kFullMask) {
+			return b;
+		}
+	}
+	return seg.TotalBucketCount();
+}
+
+// 只占用槽位并更新元数据, 由调用方在 pos 处构造 Slot
+template <typename K, typename V>
+bool DashTable<K, V>::ReserveSlot(Segment* seg, uint64_t hash, SlotPos* pos) {
+	Bucket* buckets = seg->Buckets();
+	const uint32_t home = HomeBucket(*seg, hash);
+	const uint32_t target = ChooseBucket(*seg, home, [buckets](uint32_t b) { return buckets[b].busy; });
+	if (target == seg->TotalBucketCount()) {
+		return false;
+	}
+	if (target >= seg->RegularBucketCount()) {
+		buckets[home].stash_refs++;
+	}
+
+	Bucket& bucket = buckets[target];
+	const uint32_t i = static_cast<uint32_t>(__builtin_ctz(~static_cast<uint32_t>(bucket.busy)));
+	bucket.fingerprints[i] = Fingerprint(hash);
+	bucket.busy |= static_cast<uint16_t>(1u << i);
+	seg->size++;
+	size_++;
+	*pos = SlotPos {target, i};
+	return true;
+}
+
+// 释放槽位元数据, 调用方负责先析构或移走 Slot
+template <typename K, typename V>
+void DashTable<K, V>::ReleaseSlot(Segment* seg, uint64_t hash, SlotPos pos) {
+	Bucket* buckets = seg->Buckets();
+	buckets[pos.bucket].busy &= static_cast<uint16_t>(~(1u << pos.slot));
+	if (pos.bucket >= seg->RegularBucketCount()) {
+		buckets[HomeBucket(*seg, hash)].stash_refs--;
+	}
+	seg->size--;
+	size_--;
+}
+
+template <typename K, typename V>
+V* DashTable<K, V>::InsertNew(Segment* seg, uint64_t hash, const K& key, V&& value) {
+	SlotPos pos;
+	if (!ReserveSlot(seg, hash, &pos)) {
+		return nullptr;
+	}
+	Slot* slot = new (seg->Buckets()[pos.bucket].storage[pos.slot]) Slot {key, std::move(value)};
+	return &slot->value;
+}
+
+template <typename K, typename V>
+void DashTable<K, V>::EraseAt(Segment* seg, uint64_t hash, SlotPos pos) {
+	seg->Buckets()[pos.bucket].SlotAt(pos.slot)->~Slot();
+	ReleaseSlot(seg, hash, pos);
+}
+
 template <typename K, typename V>
 void DashTable<K, V>::Insert(const K& key, V&& value) {
-	uint64_t seg_idx = GetSegmentIndex(key);
+	Insert(key, Hash(key), std::move(value));
+}
+
+template <typename K, typename V>
+void DashTable<K, V>::Insert(const K& key, const V& value) {
+	Insert(key, Hash(key), V(value));
+}
+
+template <typename K, typename V>
+void DashTable<K, V>::Insert(const K& key, uint64_t hash, V&& value) {
+	uint64_t seg_idx = GetSegmentIndex(hash);
 	if (pre_modify_cb_) {
 		pre_modify_cb_(seg_idx);
 	}
-	Segment* segment = segment_directory[seg_idx].get();
+	MigrateStep(kSplitStepBuckets);
+	Segment* segment = PrepareSegment(seg_idx, hash);
 
-	segment->table.insert_or_assign(key, std::move(value));
+	SlotPos pos;
+	if (FindSlot(*segment, key, hash, &pos)) {
+		segment->Buckets()[pos.bucket].SlotAt(pos.slot)->value = std::move(value);
+		return;
+	}
 
-	while (NeedSplit(seg_idx)) {
+	// segment 没有空槽时分裂, 然后在新的目标 segment 上重试
+	while (InsertNew(segment, hash, key, std::move(value)) == nullptr) {
 		SplitSegment(seg_idx);
-		seg_idx = GetSegmentIndex(key);
-		segment = segment_directory[seg_idx].get();
+		seg_idx = GetSegmentIndex(hash);
+		segment = PrepareSegment(seg_idx, hash);
 	}
 }
 
 template <typename K, typename V>
-void DashTable<K, V>::Insert(const K& key, const V& value) {
-	Insert(key, V(value));
+std::pair<V*, bool> DashTable<K, V>::FindOrInsert(const K& key, uint64_t hash) {
+	uint64_t seg_idx = GetSegmentIndex(hash);
+	if (pre_modify_cb_) {
+		pre_modify_cb_(seg_idx);
+	}
+	MigrateStep(kSplitStepBuckets);
+	Segment* segment = PrepareSegment(seg_idx, hash);
+
+	SlotPos pos;
+	if (FindSlot(*segment, key, hash, &pos)) {
+		return {&segment->Buckets()[pos.bucket].SlotAt(pos.slot)->value, false};
+	}
+
+	V* value = nullptr;
+	while ((value = InsertNew(segment, hash, key, V {})) == nullptr) {
+		SplitSegment(seg_idx);
+		seg_idx = GetSegmentIndex(hash);
+		segment = PrepareSegment(seg_idx, hash);
+	}
+	return {value, true};
+}
+
+template <typename K, typename V>
+V* DashTable<K, V>::FindMutable(const K& key, uint64_t hash) {
+	uint64_t seg_idx = GetSegmentIndex(hash);
+	if (pre_modify_cb_) {
+		pre_modify_cb_(seg_idx);
+	}
+	Segment* segment = PrepareSegment(seg_idx, hash);
+
+	SlotPos pos;
+	if (!FindSlot(*segment, key, hash, &pos)) {
+		return nullptr;
+	}
+	return &segment->Buckets()[pos.bucket].SlotAt(pos.slot)->value;
+}
+
+template <typename K, typename V>
+void DashTable<K, V>::Insert(const K& key, uint64_t hash, const V& value) {
+	Insert(key, hash, V(value));
 }
 
 template <typename K, typename V>
 const V* DashTable<K, V>::Find(const K& key) const {
-	uint64_t seg_idx = GetSegmentIndex(key);
-	const auto& segment = segment_directory[seg_idx];
+	return Find(key, Hash(key));
+}
 
-	auto it = segment->table.find(key);
-	if (it != segment->table.end()) {
-		return &(it->second);
+template <typename K, typename V>
+const V* DashTable<K, V>::Find(const K& key, uint64_t hash) const {
+	const Segment* segment = segment_directory[GetSegmentIndex(hash)].get();
+
+	SlotPos pos;
+	if (!FindSlot(*segment, key, hash, &pos)) {
+		// 迁移未完成时, 属于新 segment 的条目可能还在 source 中
+		if (migration_ == nullptr || segment != migration_->target.get()) {
+			return nullptr;
+		}
+		segment = migration_->source.get();
+		if (!FindSlot(*segment, key, hash, &pos)) {
+			return nullptr;
+		}
+	}
+	return &segment->Buckets()[pos.bucket].SlotAt(pos.slot)->value;
+}
+
+template <typename K, typename V>
+void DashTable<K, V>::FindBatch(size_t count, const K* const* keys, const uint64_t* hashes, const V** results) const {
+	for (size_t base = 0; base < count; base += kBatchPrefetchSize) {
+		const size_t end = std::min(count, base + kBatchPrefetchSize);
+		for (size_t i = base; i < end; ++i) {
+			Prefetch(hashes[i]);
+		}
+		for (size_t i = base; i < end; ++i) {
+			results[i] = Find(*keys[i], hashes[i]);
+		}
 	}
-	return nullptr;
 }
 
 template <typename K, typename V>
 bool DashTable<K, V>::Erase(const K& key) {
-	uint64_t seg_idx = GetSegmentIndex(key);
+	return Erase(key, Hash(key));
+}
+
+template <typename K, typename V>
+bool DashTable<K, V>::Erase(const K& key, uint64_t hash) {
+	uint64_t seg_idx = GetSegmentIndex(hash);
 	if (pre_modify_cb_) {
 		pre_modify_cb_(seg_idx);
 	}
-	auto& segment = segment_directory[seg_idx];
+	MigrateStep(kSplitStepBuckets);
+	Segment* segment = PrepareSegment(seg_idx, hash);
 
-	return segment->table.erase(key) > 0;
+	SlotPos pos;
+	if (!FindSlot(*segment, key, hash, &pos)) {
+		return false;
+	}
+	EraseAt(segment, hash, pos);
+	TryMerge(seg_idx);
+	return true;
 }
 
+// 丢弃所有 segment 并回到构造时的目录, 内存交还给分配器
 template <typename K, typename V>
 void DashTable<K, V>::Clear() {
-	for (auto& segment : segment_directory) {
-		segment->table.clear();
+	uint64_t version = 0;
+	for (size_t i = 0; i < segment_directory.size(); i = NextSeg(i)) {
+		if (pre_modify_cb_) {
+			pre_modify_cb_(i);
+		}
+		version = std::max(version, segment_directory[i]->version);
+	}
+	migration_.reset();
+	size_ = 0;
+
+	const uint32_t segment_count = 1u << min_depth_;
+	segment_directory.clear();
+	segment_directory.shrink_to_fit();
+	segment_directory.reserve(segment_count);
+	global_depth = min_depth_;
+	for (uint32_t i = 0; i < segment_count; ++i) {
+		segment_directory.push_back(Segment::Create(global_depth, i, fixed_bucket_count));
+		segment_directory.back()->version = version;
 	}
 }
 
 template <typename K, typename V>
 uint64_t DashTable<K, V>::Size() const {
-	uint64_t size = 0;
-	for (size_t i = 0; i < segment_directory.size(); i = NextSeg(i)) {
-		size += segment_directory[i]->table.size();
-	}
-	return size;
+	return size_;
 }
 
 template <typename K, typename V>
@@ -118,28 +396,25 @@ template <typename K, typename V>
 uint64_t DashTable<K, V>::BucketCount() const {
 	uint64_t count = 0;
 	for (size_t i = 0; i < segment_directory.size(); i = NextSeg(i)) {
-		count += segment_directory[i]->table.bucket_count();
+		count += segment_directory[i]->TotalBucketCount();
 	}
 	return count;
 }
 
 template <typename K, typename V>
-uint64_t DashTable<K, V>::GetSegmentIndex(const K& key) const {
-	uint64_t hash = ankerl::unordered_dense::hash<K> {}(key);
+uint64_t DashTable<K, V>::GetSegmentIndex(uint64_t hash) const {
 	if (global_depth == 0) {
 		return 0;
 	}
 	return hash >> (64 - global_depth);
 }
 
-template <typename K, typename V>
-bool DashTable<K, V>::NeedSplit(uint32_t seg_id) const {
-	const auto& segment = segment_directory[seg_id];
-	return segment->table.size() >= max_segment_size * kSplitThreshold;
-}
-
 template <typename K, typename V>
 void DashTable<K, V>::SplitSegment(uint32_t seg_id) {
+	if (migration_) {
+		FinishMigration();
+	}
+
 	Segment* source = segment_directory[seg_id].get();
 
 	if (source->local_depth == global_depth) {
@@ -165,37 +440,221 @@ void DashTable<K, V>::SplitSegment(uint32_t seg_id) {
 	uint32_t start_idx = seg_id & (~(chunk_size - 1));
 	uint32_t chunk_mid = start_idx + chunk_size / 2;
 
-	auto new_segment = std::make_shared<Segment>(source->local_depth + 1, chunk_mid, source->table.size() / 2);
+	auto new_segment = Segment::Create(source->local_depth + 1, chunk_mid, source->RegularBucketCount());
 	new_segment->version = source->version;
 
-	auto source_shared_ptr = segment_directory[seg_id];
-
 	source->segment_id = start_idx;
 	source->local_depth++;
 
-	std::vector<std::pair<uint64_t, K>> items;
-	items.reserve(source->table.size());
+	for (uint64_t i = chunk_mid; i < start_idx + chunk_size; ++i) {
+		if (i < segment_directory.size()) {
+			segment_directory[i] = new_segment;
+		}
+	}
 
-	for (auto it = source->table.begin(); it != source->table.end(); ++it) {
-		uint64_t hash = ankerl::unordered_dense::hash<K> {}(it->first);
-		items.push_back({hash, it->first});
+	// stash 在分裂时一次性迁移, 之后 target 的 stash 槽位可以直接用于新插入
+	for (uint32_t b = source->RegularBucketCount(); b < source->TotalBucketCount(); ++b) {
+		MoveBucket(source, new_segment.get(), b);
 	}
 
-	for (const auto& [hash, key] : items) {
-		uint32_t new_idx = hash >> (64 - global_depth);
+	migration_ = std::make_unique<Migration>();
+	migration_->source = segment_directory[start_idx];
+	migration_->target = std::move(new_segment);
+	migration_->done.assign(source->RegularBucketCount(), false);
 
-		if (new_idx >= chunk_mid && new_idx < start_idx + chunk_size) {
-			auto it = source->table.find(key);
-			if (it != source->table.end()) {
-				new_segment->table.insert(std::move(*it));
-				source->table.erase(it);
-			}
+	if (!incremental_split_) {
+		FinishMigration();
+	}
+}
+
+// 两个 segment 的 bucket 几何相同, 条目按原 bucket/slot 位置搬迁, 指纹和 home 不变。
+// target 的 bucket b 只有在 source 的 bucket b 迁移完成后才会接收新插入, 因此目标槽位必然空闲。
+template <typename K, typename V>
+void DashTable<K, V>::MoveBucket(Segment* source, Segment* target, uint32_t b) {
+	Bucket* src_buckets = source->Buckets();
+	Bucket* dst_buckets = target->Buckets();
+	uint32_t mask = src_buckets[b].busy;
+	while (mask != 0) {
+		const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+		mask &= mask - 1;
+
+		Slot* slot = src_buckets[b].SlotAt(i);
+		const uint64_t hash = Hash(slot->key);
+		if (segment_directory[GetSegmentIndex(hash)].get() != target) {
+			continue;
 		}
+
+		new (dst_buckets[b].storage[i]) Slot {std::move(*slot)};
+		slot->~Slot();
+		dst_buckets[b].fingerprints[i] = src_buckets[b].fingerprints[i];
+		dst_buckets[b].busy |= static_cast<uint16_t>(1u << i);
+		src_buckets[b].busy &= static_cast<uint16_t>(~(1u << i));
+		if (b >= source->RegularBucketCount()) {
+			const uint32_t home = HomeBucket(*source, hash);
+			src_buckets[home].stash_refs--;
+			dst_buckets[home].stash_refs++;
+		}
+		source->size--;
+		target->size++;
 	}
+}
 
-	for (uint64_t i = chunk_mid; i < start_idx + chunk_size; ++i) {
-		if (i < segment_directory.size()) {
-			segment_directory[i] = new_segment;
+template <typename K, typename V>
+void DashTable<K, V>::MigrateBucket(uint32_t b) {
+	if (migration_->done[b]) {
+		return;
+	}
+	// 迁移同时修改两个 segment, 快照需要先看到它们迁移前的内容
+	if (pre_modify_cb_) {
+		pre_modify_cb_(migration_->source->segment_id);
+		pre_modify_cb_(migration_->target->segment_id);
+	}
+	MoveBucket(migration_->source.get(), migration_->target.get(), b);
+	migration_->done[b] = true;
+}
+
+template <typename K, typename V>
+bool DashTable<K, V>::MigrateStep(uint32_t max_buckets) {
+	if (migration_ == nullptr) {
+		return false;
+	}
+	const uint32_t bucket_count = static_cast<uint32_t>(migration_->done.size());
+	uint32_t migrated = 0;
+	while (migration_->cursor < bucket_count && migrated < max_buckets) {
+		if (!migration_->done[migration_->cursor]) {
+			MigrateBucket(migration_->cursor);
+			++migrated;
+		}
+		++migration_->cursor;
+	}
+	if (migration_->cursor == bucket_count) {
+		migration_.reset();
+		return false;
+	}
+	return true;
+}
+
+template <typename K, typename V>
+void DashTable<K, V>::FinishMigration() {
+	MigrateStep(static_cast<uint32_t>(migration_->done.size()));
+}
+
+// 写操作落在迁移中的 segment 对上时, 先迁移 key 可能占用的 home 和相邻 bucket:
+// 之后 key 只会出现在目录指向的 segment 中, 且两侧都有了可用的空槽
+template <typename K, typename V>
+typename DashTable<K, V>::Segment* DashTable<K, V>::PrepareSegment(uint64_t seg_idx, uint64_t hash) {
+	Segment* segment = segment_directory[seg_idx].get();
+	if (migration_ != nullptr &&
+	    (segment == migration_->source.get() || segment == migration_->target.get())) {
+		const uint32_t home = HomeBucket(*segment, hash);
+		MigrateBucket(home);
+		MigrateBucket((home + 1) & segment->bucket_mask);
+	}
+	return segment;
+}
+
+template <typename K, typename V>
+void DashTable<K, V>::TryMerge(uint64_t dir_idx) {
+	while (migration_ == nullptr) {
+		Segment* seg = segment_directory[dir_idx].get();
+		const uint64_t low_water = seg->TotalBucketCount() * kSlotsPerBucket / kMergeLowWaterDivisor;
+		if (seg->local_depth <= min_depth_ || seg->size >= low_water) {
+			return;
+		}
+
+		const uint64_t chunk_size = 1ULL << (global_depth - seg->local_depth);
+		const uint64_t start_idx = seg->segment_id;
+		const uint64_t buddy_idx = start_idx ^ chunk_size;
+		Segment* buddy = segment_directory[buddy_idx].get();
+		if (buddy->local_depth != seg->local_depth || buddy->size >= low_water) {
+			return;
+		}
+
+		if (pre_modify_cb_) {
+			pre_modify_cb_(start_idx);
+			pre_modify_cb_(buddy_idx);
+		}
+
+		const uint64_t keep_idx = std::min(start_idx, buddy_idx);
+		const uint64_t drop_idx = std::max(start_idx, buddy_idx);
+		Segment* keep = segment_directory[keep_idx].get();
+		Segment* drop = segment_directory[drop_idx].get();
+		if (!MergeInto(keep, drop)) {
+			return;
+		}
+
+		keep->local_depth--;
+		keep->version = std::min(keep->version, drop->version);
+		for (uint64_t i = drop_idx; i < drop_idx + chunk_size; ++i) {
+			segment_directory[i] = segment_directory[keep_idx];
+		}
+
+		ShrinkDirectory();
+		dir_idx = keep->segment_id;
+	}
+}
+
+// 先只用占用位图模拟一遍, 确认 drop 的条目能全部放进 keep, 再真正搬迁
+template <typename K, typename V>
+bool DashTable<K, V>::MergeInto(Segment* keep, Segment* drop) {
+	std::vector<std::pair<SlotPos, uint64_t>> entries;
+	entries.reserve(drop->size);
+	Bucket* drop_buckets = drop->Buckets();
+	for (uint32_t b = 0; b < drop->TotalBucketCount(); ++b) {
+		uint32_t mask = drop_buckets[b].busy;
+		while (mask != 0) {
+			const uint32_t i = static_cast<uint32_t>(__builtin_ctz(mask));
+			mask &= mask - 1;
+			entries.emplace_back(SlotPos {b, i}, Hash(drop_buckets[b].SlotAt(i)->key));
+		}
+	}
+
+	Bucket* keep_buckets = keep->Buckets();
+	std::vector<uint16_t> busy(keep->TotalBucketCount());
+	for (uint32_t b = 0; b < keep->TotalBucketCount(); ++b) {
+		busy[b] = keep_buckets[b].busy;
+	}
+	for (const auto& [pos, hash] : entries) {
+		const uint32_t target = ChooseBucket(*keep, HomeBucket(*keep, hash), [&busy](uint32_t b) { return busy[b]; });
+		if (target == keep->TotalBucketCount()) {
+			return false;
+		}
+		busy[target] |= static_cast<uint16_t>(busy[target] + 1);
+	}
+
+	for (const auto& [pos, hash] : entries) {
+		SlotPos dst;
+		const bool reserved = ReserveSlot(keep, hash, &dst);
+		assert(reserved);
+		(void)reserved;
+		Slot* src = drop_buckets[pos.bucket].SlotAt(pos.slot);
+		new (keep_buckets[dst.bucket].storage[dst.slot]) Slot {std::move(*src)};
+		src->~Slot();
+		ReleaseSlot(drop, hash, pos);
+	}
+	return true;
+}
+
+// 所有 segment 的 local_depth 都小于 global_depth 时, 每个 segment 至少占两个目录项, 目录可以减半
+template <typename K, typename V>
+void DashTable<K, V>::ShrinkDirectory() {
+	while (global_depth > min_depth_) {
+		for (size_t i = 0; i < segment_directory.size(); i = NextSeg(i)) {
+			if (segment_directory[i]->local_depth == global_depth) {
+				return;
+			}
+		}
+
+		const size_t new_size = segment_directory.size() / 2;
+		for (size_t i = 0; i < new_size; ++i) {
+			segment_directory[i] = segment_directory[i * 2];
+		}
+		segment_directory.resize(new_size);
+		segment_directory.shrink_to_fit();
+		global_depth--;
+
+		for (size_t i = 0; i < segment_directory.size(); i = NextSeg(i)) {
+			segment_directory[i]->segment_id = static_cast<uint32_t>(i);
 		}
 	}
 }
@@ -253,3 +712,4 @@ template class DashTable<int, int>;
 template class DashTable<int, double>;
 template class DashTable<NanoObj, NanoObj>;
 template class DashTable<NanoObj, int64_t>;
+template class DashTable<NanoObj, DbValue>;
@@ -1,12 +1,37 @@
 #include "core/database.h"
 
+#include <algorithm>
 #include <chrono>
 #include <limits>
 
+namespace {
+
+// 与 Redis 相同: 新 key 的 LFU 计数从 5 开始, 避免刚写入就被淘汰; 计数按对数增长
+constexpr uint8_t kLfuInitCounter = 5;
+constexpr double kLfuLogFactor = 10.0;
+// 内存估算中每个 key 的固定开销: 表槽位、DbValue 和一个普通长度的 key
+constexpr int64_t kEntryOverheadBytes = 64;
+
+uint64_t LruClock(int64_t now_ms) {
+	return static_cast<uint64_t>(now_ms / 1000) & 0xFFFF;
+}
+
+uint64_t LfuMinutes(int64_t now_ms) {
+	return static_cast<uint64_t>(now_ms / 60000) & 0xFF;
+}
+
+// 每过一分钟计数减一
+uint8_t DecayedLfuCounter(uint64_t access, int64_t now_ms) {
+	const uint64_t elapsed = (LfuMinutes(now_ms) - (access >> 8)) & 0xFF;
+	const uint64_t counter = access & 0xFF;
+	return elapsed >= counter ? 0 : static_cast<uint8_t>(counter - elapsed);
+}
+
+} // namespace
+
 Database::Database() : current_db(0) {
 	for (size_t i = 0; i < kNumDBs; ++i) {
-		tables[i] = std::make_unique<DashTable<NanoObj, NanoObj>>();
-		expire_tables[i] = std::make_unique<ExpireTable>();
+		tables[i] = std::make_unique<Table>();
 	}
 }
 
@@ -15,58 +40,105 @@ bool Database::Set(const NanoObj& key, const std::string& value) {
 }
 
 std::optional<std::string> Database::Get(const NanoObj& key) {
-	const int64_t now_ms = CurrentTimeMs();
-	PruneExpiredInDB(current_db, key, now_ms);
+	return Get(key, Table::Hash(key));
+}
 
-	const NanoObj* val = tables[current_db]->Find(key);
-	if (val) {
-		return val->ToString();
+std::optional<std::string> Database::Get(const NanoObj& key, uint64_t hash) {
+	const DbValue* entry = FindLive(current_db, key, hash);
+	if (entry) {
+		return entry->obj.ToString();
 	}
 	return std::nullopt;
 }
 
 bool Database::Set(const NanoObj& key, NanoObj&& value) {
-	tables[current_db]->Insert(key, std::move(value));
+	return Set(key, Table::Hash(key), std::move(value));
+}
+
+// 覆盖值时保留原有 TTL (与之前独立 expire 表的语义一致)
+bool Database::Set(const NanoObj& key, uint64_t hash, NanoObj&& value) {
+	return Set(key, hash, std::move(value), SetTtl::kKeep);
+}
+
+bool Database::Set(const NanoObj& key, uint64_t hash, NanoObj&& value, SetTtl ttl_mode, int64_t ttl_ms) {
+	auto [entry, inserted] = tables[current_db]->FindOrInsert(key, hash);
+	TouchAccess(*entry, inserted);
+	const int64_t old_bytes = inserted ? 0 : EntryBytes(entry->obj);
+	int64_t now_ms = 0;
+	bool keep_expire = false;
+	if (!inserted && entry->HasExpire()) {
+		now_ms = CurrentTimeMs();
+		keep_expire = ttl_mode == SetTtl::kKeep && entry->expire_at_ms > now_ms;
+		if (!keep_expire) {
+			UntrackExpire(current_db, hash, entry->expire_at_ms);
+		}
+	}
+	entry->obj = std::move(value);
+	ChargeMemory(current_db, EntryBytes(entry->obj) - old_bytes);
+
+	if (ttl_mode == SetTtl::kSet) {
+		const int64_t expire_at_ms = ExpireAtFromTtl(now_ms != 0 ? now_ms : CurrentTimeMs(), ttl_ms);
+		TrackExpire(current_db, hash, expire_at_ms);
+		entry->expire_at_ms = expire_at_ms;
+		entry->obj.SetExpireFlag(true);
+		return true;
+	}
+	if (!keep_expire) {
+		entry->expire_at_ms = 0;
+	}
+	entry->obj.SetExpireFlag(keep_expire);
 	return true;
 }
 
 bool Database::Set(const NanoObj& key, const NanoObj& value) {
-	tables[current_db]->Insert(key, value);
-	return true;
+	return Set(key, Table::Hash(key), value);
+}
+
+bool Database::Set(const NanoObj& key, uint64_t hash, const NanoObj& value) {
+	return Set(key, hash, NanoObj(value));
 }
 
 bool Database::Del(const NanoObj& key) {
-	const int64_t now_ms = CurrentTimeMs();
-	PruneExpiredInDB(current_db, key, now_ms);
+	return Del(key, Table::Hash(key));
+}
 
-	const bool deleted = tables[current_db]->Erase(key);
-	if (deleted) {
-		(void)expire_tables[current_db]->Erase(key);
+bool Database::Del(const NanoObj& key, uint64_t hash) {
+	const DbValue* entry = FindLive(current_db, key, hash);
+	if (entry == nullptr) {
+		return false;
 	}
-	return deleted;
+	if (entry->HasExpire()) {
+		UntrackExpire(current_db, hash, entry->expire_at_ms);
+	}
+	ChargeMemory(current_db, -EntryBytes(entry->obj));
+	return tables[current_db]->Erase(key, hash);
 }
 
 bool Database::Exists(const NanoObj& key) {
-	const int64_t now_ms = CurrentTimeMs();
-	PruneExpiredInDB(current_db, key, now_ms);
-	return tables[current_db]->Find(key) != nullptr;
+	return Exists(key, Table::Hash(key));
+}
+
+bool Database::Exists(const NanoObj& key, uint64_t hash) {
+	return FindLive(current_db, key, hash) != nullptr;
 }
 
+// 与 Redis 的 DBSIZE 一样, 已过期但尚未回收的 key 也计入
 size_t Database::KeyCount() {
-	const int64_t now_ms = CurrentTimeMs();
-	std::vector<NanoObj> expired_keys;
-	expire_tables[current_db]->ForEach([&](const NanoObj& key, const int64_t& expire_at_ms) {
-		if (expire_at_ms <= now_ms) {
-			expired_keys.push_back(key);
-		}
-	});
+	return tables[current_db]->Size();
+}
 
-	for (const auto& key : expired_keys) {
-		(void)tables[current_db]->Erase(key);
-		(void)expire_tables[current_db]->Erase(key);
+KeyspaceStats Database::GetKeyspaceStats(size_t db_index) const {
+	KeyspaceStats stats;
+	if (db_index >= kNumDBs) {
+		return stats;
 	}
-
-	return tables[current_db]->Size();
+	stats.keys = tables[db_index]->Size();
+	stats.expires = expiring_counts[db_index];
+	if (stats.expires > 0) {
+		const int64_t avg_expire_at_ms = static_cast<int64_t>(expire_at_sums[db_index] / stats.expires);
+		stats.avg_ttl_ms = std::max<int64_t>(avg_expire_at_ms - CurrentTimeMs(), 0);
+	}
+	return stats;
 }
 
 bool Database::Select(size_t db_index) {
@@ -78,149 +150,517 @@ bool Database::Select(size_t db_index) {
 }
 
 void Database::ClearCurrentDB() {
+	ChargeMemory(current_db, -used_bytes[current_db]);
 	tables[current_db]->Clear();
-	expire_tables[current_db]->Clear();
+	expiring_counts[current_db] = 0;
+	expire_at_sums[current_db] = 0;
+	expire_indexes[current_db].Clear();
 }
 
 void Database::ClearAll() {
 	for (size_t i = 0; i < kNumDBs; ++i) {
+		ChargeMemory(i, -used_bytes[i]);
 		tables[i]->Clear();
-		expire_tables[i]->Clear();
+		expiring_counts[i] = 0;
+		expire_at_sums[i] = 0;
+		expire_indexes[i].Clear();
 	}
 }
 
-std::vector<std::string> Database::Keys() {
-	const int64_t now_ms = CurrentTimeMs();
-	std::vector<NanoObj> expired_keys;
-	expire_tables[current_db]->ForEach([&](const NanoObj& key, const int64_t& expire_at_ms) {
-		if (expire_at_ms <= now_ms) {
-			expired_keys.push_back(key);
+void Database::ClearCurrentDBAsync() {
+	DetachDB(current_db);
+}
+
+void Database::ClearAllAsync() {
+	for (size_t i = 0; i < kNumDBs; ++i) {
+		DetachDB(i);
+	}
+}
+
+void Database::DetachDB(size_t db_index) {
+	// 摘下的表随后才分批释放, 这里先从估算中扣掉, 实际用量由下一次校准修正
+	ChargeMemory(db_index, -used_bytes[db_index]);
+	if (tables[db_index]->HasPreModifyCallback()) {
+		// 快照正在遍历这张表, 不能换掉; 退回同步清空, Clear 会先序列化各 segment
+		tables[db_index]->Clear();
+	} else if (tables[db_index]->Size() > 0) {
+		detached_tables.push_back(std::move(tables[db_index]));
+		tables[db_index] = std::make_unique<Table>();
+	}
+	if (expire_indexes[db_index].Size() > 0) {
+		detached_expire_indexes.push_back(std::move(expire_indexes[db_index]));
+	}
+	expire_indexes[db_index].Clear();
+	expiring_counts[db_index] = 0;
+	expire_at_sums[db_index] = 0;
+}
+
+// 先拆摘下的表: 表中的大对象移进 lazy_free, 其余随 segment 一起释放; 再释放过期索引和大对象
+bool Database::LazyFreeStep(size_t max_items) {
+	size_t freed = 0;
+	while (freed < max_items && !detached_tables.empty()) {
+		Table* table = detached_tables.back().get();
+		freed += table->ReleaseStep(max_items - freed, [this](const NanoObj& key, DbValue& value) {
+			(void)key;
+			if (LazyFreeQueue::ShouldFreeLazily(value.obj)) {
+				lazy_free.Push(std::move(value.obj));
+			}
+		});
+		if (table->DirSize() == 0) {
+			detached_tables.pop_back();
 		}
-	});
-	for (const auto& key : expired_keys) {
-		(void)tables[current_db]->Erase(key);
-		(void)expire_tables[current_db]->Erase(key);
 	}
+	while (freed < max_items && !detached_expire_indexes.empty()) {
+		freed += detached_expire_indexes.back().ReleaseStep(max_items - freed);
+		if (detached_expire_indexes.back().Size() == 0) {
+			detached_expire_indexes.pop_back();
+		}
+	}
+	if (freed < max_items) {
+		freed += lazy_free.Step(max_items - freed);
+	}
+	return HasPendingLazyFree();
+}
+
+bool Database::HasPendingLazyFree() const {
+	return !detached_tables.empty() || !detached_expire_indexes.empty() || !lazy_free.Empty();
+}
+
+std::vector<std::string> Database::Keys() {
+	(void)PruneExpiredInDB(current_db);
 
 	std::vector<std::string> keys;
-	tables[current_db]->ForEach([&keys](const NanoObj& key, const NanoObj& value) {
+	tables[current_db]->ForEach([&keys](const NanoObj& key, const DbValue& value) {
 		(void)value;
 		keys.push_back(key.ToString());
 	});
 	return keys;
 }
 
-const NanoObj* Database::Find(const NanoObj& key) {
+void Database::FindBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes, const NanoObj** out) {
+	std::vector<const DbValue*> entries(count);
+	tables[current_db]->FindBatch(count, keys, hashes, entries.data());
+
 	const int64_t now_ms = CurrentTimeMs();
-	PruneExpiredInDB(current_db, key, now_ms);
-	return tables[current_db]->Find(key);
+	std::vector<size_t> expired;
+	for (size_t i = 0; i < count; ++i) {
+		if (entries[i] != nullptr && entries[i]->IsExpired(now_ms)) {
+			expired.push_back(i);
+		}
+	}
+	if (!expired.empty()) {
+		// 删除会搬动条目 (合并), 之前拿到的指针全部失效: 先按 key 惰性删除, 再重新查一遍
+		for (size_t i : expired) {
+			(void)FindLive(current_db, *keys[i], hashes[i]);
+		}
+		tables[current_db]->FindBatch(count, keys, hashes, entries.data());
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		const DbValue* entry = entries[i];
+		if (entry == nullptr || entry->IsExpired(now_ms)) {
+			out[i] = nullptr;
+			continue;
+		}
+		TouchAccess(*entry, false);
+		out[i] = &entry->obj;
+	}
 }
 
-bool Database::Expire(const NanoObj& key, int64_t ttl_ms) {
+size_t Database::DelBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes) {
+	const int64_t now_ms = CurrentTimeMs();
+	size_t deleted = 0;
+	(void)tables[current_db]->EraseBatch(count, keys, hashes, [this, now_ms, &deleted](uint64_t hash, const DbValue& value) {
+		ChargeMemory(current_db, -EntryBytes(value.obj));
+		if (value.HasExpire()) {
+			UntrackExpire(current_db, hash, value.expire_at_ms);
+			if (value.expire_at_ms <= now_ms) {
+				return;
+			}
+		}
+		++deleted;
+	});
+	return deleted;
+}
+
+size_t Database::UnlinkBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes) {
+	size_t unlinked = 0;
+	for (size_t i = 0; i < count; ++i) {
+		unlinked += Unlink(current_db, *keys[i], hashes[i]) ? 1 : 0;
+	}
+	return unlinked;
+}
+
+bool Database::Unlink(size_t db_index, const NanoObj& key, uint64_t hash) {
+	DbValue* entry = FindLiveMutable(db_index, key, hash);
+	if (entry == nullptr) {
+		return false;
+	}
+	if (entry->HasExpire()) {
+		UntrackExpire(db_index, hash, entry->expire_at_ms);
+	}
+	ChargeMemory(db_index, -EntryBytes(entry->obj));
+	if (LazyFreeQueue::ShouldFreeLazily(entry->obj)) {
+		lazy_free.Push(std::move(entry->obj));
+	}
+	return tables[db_index]->Erase(key, hash);
+}
+
+void Database::SetBatch(size_t count, const NanoObj* const* keys, const uint64_t* hashes,
+                        const NanoObj* const* values) {
+	constexpr size_t kPrefetchBatch = 16;
+	for (size_t base = 0; base < count; base += kPrefetchBatch) {
+		const size_t end = std::min(count, base + kPrefetchBatch);
+		for (size_t i = base; i < end; ++i) {
+			tables[current_db]->Prefetch(hashes[i]);
+		}
+		// MSET 语义: 覆盖值并清除 TTL; 每个 key 只探测一次, 过期标记就地清掉
+		for (size_t i = base; i < end; ++i) {
+			auto [entry, inserted] = tables[current_db]->FindOrInsert(*keys[i], hashes[i]);
+			TouchAccess(*entry, inserted);
+			const int64_t old_bytes = inserted ? 0 : EntryBytes(entry->obj);
+			if (!inserted && entry->HasExpire()) {
+				UntrackExpire(current_db, hashes[i], entry->expire_at_ms);
+				entry->expire_at_ms = 0;
+			}
+			entry->obj = NanoObj(*values[i]);
+			entry->obj.SetExpireFlag(false);
+			ChargeMemory(current_db, EntryBytes(entry->obj) - old_bytes);
+		}
+	}
+}
+
+void Database::Prefetch(size_t db_index, uint64_t hash) const {
+	if (db_index < kNumDBs) {
+		tables[db_index]->Prefetch(hash);
+	}
+}
+
+// 与 Redis 的 dbRandomKey 一样一直采样到活着的 key 或表为空: 每次采到已过期的 key 都会把它删掉,
+// 表严格变小, 循环必然结束。Redis 只在从库上限制次数 (从库不删过期 key), 这里没有从库
+std::optional<std::string> Database::RandomKey() {
+	const int64_t now_ms = CurrentTimeMs();
+	for (;;) {
+		auto [key, value] = tables[current_db]->RandomEntry(random_engine);
+		if (key == nullptr) {
+			return std::nullopt;
+		}
+		if (!value->IsExpired(now_ms)) {
+			return key->ToString();
+		}
+		// 采到已过期的 key 时顺便删除; 删除会释放 key 所在的槽位, 先复制一份
+		const NanoObj expired_key = *key;
+		(void)FindLive(current_db, expired_key, Table::Hash(expired_key));
+	}
+}
+
+uint64_t Database::Scan(uint64_t cursor, size_t count, std::vector<std::string>* keys) {
 	const int64_t now_ms = CurrentTimeMs();
-	PruneExpiredInDB(current_db, key, now_ms);
+	return tables[current_db]->Scan(cursor, count, [now_ms, keys](const NanoObj& key, const DbValue& value) {
+		if (!value.IsExpired(now_ms)) {
+			keys->push_back(key.ToString());
+		}
+	});
+}
+
+const NanoObj* Database::Find(const NanoObj& key) {
+	return Find(key, Table::Hash(key));
+}
 
-	if (tables[current_db]->Find(key) == nullptr) {
+const NanoObj* Database::Find(const NanoObj& key, uint64_t hash) {
+	const DbValue* entry = FindLive(current_db, key, hash);
+	return entry != nullptr ? &entry->obj : nullptr;
+}
+
+bool Database::Expire(const NanoObj& key, int64_t ttl_ms) {
+	return Expire(key, Table::Hash(key), ttl_ms);
+}
+
+bool Database::Expire(const NanoObj& key, uint64_t hash, int64_t ttl_ms) {
+	DbValue* entry = FindLiveMutable(current_db, key, hash);
+	if (entry == nullptr) {
 		return false;
 	}
 
 	if (ttl_ms <= 0) {
-		(void)tables[current_db]->Erase(key);
-		(void)expire_tables[current_db]->Erase(key);
+		if (entry->HasExpire()) {
+			UntrackExpire(current_db, hash, entry->expire_at_ms);
+		}
+		ChargeMemory(current_db, -EntryBytes(entry->obj));
+		(void)tables[current_db]->Erase(key, hash);
 		return true;
 	}
 
-	int64_t expire_at_ms = now_ms;
-	if (ttl_ms >= std::numeric_limits<int64_t>::max() - now_ms) {
-		expire_at_ms = std::numeric_limits<int64_t>::max();
-	} else {
-		expire_at_ms += ttl_ms;
+	const int64_t expire_at_ms = ExpireAtFromTtl(CurrentTimeMs(), ttl_ms);
+	if (entry->HasExpire()) {
+		UntrackExpire(current_db, hash, entry->expire_at_ms);
 	}
-	expire_tables[current_db]->Insert(key, expire_at_ms);
+	TrackExpire(current_db, hash, expire_at_ms);
+	entry->obj.SetExpireFlag(true);
+	entry->expire_at_ms = expire_at_ms;
 	return true;
 }
 
 bool Database::Persist(const NanoObj& key) {
-	const int64_t now_ms = CurrentTimeMs();
-	PruneExpiredInDB(current_db, key, now_ms);
+	return Persist(key, Table::Hash(key));
+}
 
-	if (tables[current_db]->Find(key) == nullptr) {
+bool Database::Persist(const NanoObj& key, uint64_t hash) {
+	DbValue* entry = FindLiveMutable(current_db, key, hash);
+	if (entry == nullptr || !entry->HasExpire()) {
 		return false;
 	}
-	return expire_tables[current_db]->Erase(key);
+	UntrackExpire(current_db, hash, entry->expire_at_ms);
+	entry->obj.SetExpireFlag(false);
+	entry->expire_at_ms = 0;
+	return true;
 }
 
 int64_t Database::TTL(const NanoObj& key) {
-	const int64_t now_ms = CurrentTimeMs();
-	PruneExpiredInDB(current_db, key, now_ms);
+	return TTL(key, Table::Hash(key));
+}
 
-	if (tables[current_db]->Find(key) == nullptr) {
+int64_t Database::TTL(const NanoObj& key, uint64_t hash) {
+	const DbValue* entry = FindLive(current_db, key, hash);
+	if (entry == nullptr) {
 		return -2;
 	}
-
-	const int64_t* expire_at_ms = expire_tables[current_db]->Find(key);
-	if (expire_at_ms == nullptr) {
+	if (!entry->HasExpire()) {
 		return -1;
 	}
 
-	if (*expire_at_ms <= now_ms) {
-		(void)tables[current_db]->Erase(key);
-		(void)expire_tables[current_db]->Erase(key);
-		return -2;
-	}
-
-	const int64_t remaining_ms = *expire_at_ms - now_ms;
+	const int64_t remaining_ms = entry->expire_at_ms - CurrentTimeMs();
 	return remaining_ms / 1000;
 }
 
-size_t Database::ActiveExpireCycle(size_t max_keys_per_db) {
+// 只处理过期索引中已到期的条目, 代价与到期 key 数成正比。
+// 索引与主表中的 TTL 一一对应; 按哈希删除时仍校验已过期, 以防两个 key 哈希相同。
+size_t Database::ActiveExpireCycle(size_t max_keys_per_db, ExpireCycleStats* stats) {
 	if (max_keys_per_db == 0) {
 		return 0;
 	}
 
 	const int64_t now_ms = CurrentTimeMs();
 	size_t deleted_count = 0;
+	std::vector<ExpireIndex::Entry> due;
 
 	for (size_t db_index = 0; db_index < kNumDBs; ++db_index) {
-		size_t scanned = 0;
-		std::vector<NanoObj> expired_keys;
-		expire_tables[db_index]->ForEach([&](const NanoObj& key, const int64_t& expire_at_ms) {
-			if (scanned >= max_keys_per_db) {
-				return;
-			}
-			++scanned;
-			if (expire_at_ms <= now_ms) {
-				expired_keys.push_back(key);
-			}
-		});
+		if (expire_indexes[db_index].Size() == 0) {
+			continue;
+		}
 
-		for (const auto& key : expired_keys) {
-			if (tables[db_index]->Erase(key)) {
+		due.clear();
+		const bool more_due = expire_indexes[db_index].PopDue(now_ms, max_keys_per_db, &due);
+		Table* table = tables[db_index].get();
+		for (const auto& item : due) {
+			// 条目已从索引中弹出, 这里只更新计数器
+			const bool erased = table->EraseByHash(item.hash, [&](const DbValue& value) {
+				if (!value.IsExpired(now_ms)) {
+					return false;
+				}
+				--expiring_counts[db_index];
+				expire_at_sums[db_index] -= value.expire_at_ms;
+				ChargeMemory(db_index, -EntryBytes(value.obj));
+				return true;
+			});
+			if (erased) {
 				++deleted_count;
 			}
-			(void)expire_tables[db_index]->Erase(key);
+		}
+
+		if (stats != nullptr) {
+			stats->sampled += due.size();
+			stats->more_due |= more_due;
 		}
 	}
 
+	if (stats != nullptr) {
+		stats->expired += deleted_count;
+	}
 	return deleted_count;
 }
 
+bool Database::SplitMigrationStep(uint32_t max_buckets_per_table) {
+	bool pending = false;
+	for (size_t db_index = 0; db_index < kNumDBs; ++db_index) {
+		pending |= tables[db_index]->MigrateStep(max_buckets_per_table);
+	}
+	return pending;
+}
+
+bool Database::EvictOne(EvictionPolicy policy) {
+	if (policy == EvictionPolicy::kNoEviction) {
+		return false;
+	}
+	const bool volatile_only = policy == EvictionPolicy::kVolatileLru || policy == EvictionPolicy::kVolatileTtl;
+	// volatile 策略下采样可能落在不带 TTL 的 key 上, 多试几次
+	const size_t max_tries = volatile_only ? kEvictionSamples * 4 : kEvictionSamples;
+	const int64_t now_ms = CurrentTimeMs();
+
+	size_t victim_db = kNumDBs;
+	NanoObj victim_key;
+	uint64_t victim_score = 0;
+	for (size_t db_index = 0; db_index < kNumDBs; ++db_index) {
+		const Table* table = tables[db_index].get();
+		if (table->Size() == 0 || (volatile_only && expiring_counts[db_index] == 0)) {
+			continue;
+		}
+		size_t sampled = 0;
+		for (size_t attempt = 0; attempt < max_tries && sampled < kEvictionSamples; ++attempt) {
+			auto [key, value] = table->RandomEntry(random_engine);
+			if (key == nullptr) {
+				break;
+			}
+			if (volatile_only && !value->HasExpire()) {
+				continue;
+			}
+			++sampled;
+			const uint64_t score = EvictionScore(policy, *value, now_ms);
+			if (victim_db == kNumDBs || score > victim_score) {
+				victim_db = db_index;
+				victim_key = *key;
+				victim_score = score;
+			}
+		}
+	}
+	if (victim_db == kNumDBs) {
+		return false;
+	}
+
+	Table* table = tables[victim_db].get();
+	const uint64_t hash = Table::Hash(victim_key);
+	const DbValue* entry = table->Find(victim_key, hash);
+	if (entry == nullptr) {
+		return false;
+	}
+	if (entry->HasExpire()) {
+		UntrackExpire(victim_db, hash, entry->expire_at_ms);
+	}
+	ChargeMemory(victim_db, -EntryBytes(entry->obj));
+	return table->Erase(victim_key, hash);
+}
+
+// 分数越大越先淘汰
+uint64_t Database::EvictionScore(EvictionPolicy policy, const DbValue& value, int64_t now_ms) const {
+	if (value.IsExpired(now_ms)) {
+		return std::numeric_limits<uint64_t>::max();
+	}
+	switch (policy) {
+	case EvictionPolicy::kVolatileTtl:
+		return static_cast<uint64_t>(DbValue::kMaxExpireAtMs - value.expire_at_ms);
+	case EvictionPolicy::kAllKeysLfu:
+		return 0xFF - DecayedLfuCounter(value.access, now_ms);
+	default:
+		return (LruClock(now_ms) - value.access) & 0xFFFF;
+	}
+}
+
+void Database::TouchAccess(const DbValue& value, bool inserted) {
+	const EvictionPolicy policy = MemoryBudget::Policy();
+	if (policy == EvictionPolicy::kNoEviction || policy == EvictionPolicy::kVolatileTtl) {
+		return;
+	}
+	const int64_t now_ms = CurrentTimeMs();
+	if (policy != EvictionPolicy::kAllKeysLfu) {
+		value.access = LruClock(now_ms);
+		return;
+	}
+
+	uint8_t counter = kLfuInitCounter;
+	if (!inserted) {
+		counter = DecayedLfuCounter(value.access, now_ms);
+		// 计数越大, 再加一的概率越小: p = 1 / ((counter - init) * factor + 1)
+		if (counter < 0xFF) {
+			const double base = counter > kLfuInitCounter ? counter - kLfuInitCounter : 0;
+			if (base == 0 || std::uniform_real_distribution<double>(0.0, 1.0)(random_engine) <
+			                     1.0 / (base * kLfuLogFactor + 1.0)) {
+				++counter;
+			}
+		}
+	}
+	value.access = (LfuMinutes(now_ms) << 8) | counter;
+}
+
+int64_t Database::EntryBytes(const NanoObj& value) {
+	if (value.IsInt()) {
+		return kEntryOverheadBytes;
+	}
+	const size_t size = value.Size();
+	return kEntryOverheadBytes + static_cast<int64_t>(size > kInlineLen ? size : 0);
+}
+
+void Database::ChargeMemory(size_t db_index, int64_t bytes) {
+	used_bytes[db_index] += bytes;
+	MemoryBudget::Charge(bytes);
+}
+
+int64_t Database::ExpireAtFromTtl(int64_t now_ms, int64_t ttl_ms) {
+	if (ttl_ms >= DbValue::kMaxExpireAtMs - now_ms) {
+		return DbValue::kMaxExpireAtMs;
+	}
+	return now_ms + ttl_ms;
+}
+
 int64_t Database::CurrentTimeMs() {
 	using Clock = std::chrono::steady_clock;
 	using Milliseconds = std::chrono::milliseconds;
 	return std::chrono::duration_cast<Milliseconds>(Clock::now().time_since_epoch()).count();
 }
 
-bool Database::IsExpiredInDB(size_t db_index, const NanoObj& key, int64_t now_ms) const {
-	const int64_t* expire_at_ms = expire_tables[db_index]->Find(key);
-	return expire_at_ms != nullptr && *expire_at_ms <= now_ms;
+const DbValue* Database::FindLive(size_t db_index, const NanoObj& key, uint64_t hash) {
+	const DbValue* entry = tables[db_index]->Find(key, hash);
+	if (entry == nullptr) {
+		return nullptr;
+	}
+	if (!entry->HasExpire() || entry->expire_at_ms > CurrentTimeMs()) {
+		TouchAccess(*entry, false);
+		return entry;
+	}
+	UntrackExpire(db_index, hash, entry->expire_at_ms);
+	ChargeMemory(db_index, -EntryBytes(entry->obj));
+	(void)tables[db_index]->Erase(key, hash);
+	return nullptr;
 }
 
-void Database::PruneExpiredInDB(size_t db_index, const NanoObj& key, int64_t now_ms) {
-	if (!IsExpiredInDB(db_index, key, now_ms)) {
-		return;
+DbValue* Database::FindLiveMutable(size_t db_index, const NanoObj& key, uint64_t hash) {
+	if (FindLive(db_index, key, hash) == nullptr) {
+		return nullptr;
+	}
+	return tables[db_index]->FindMutable(key, hash);
+}
+
+size_t Database::PruneExpiredInDB(size_t db_index) {
+	if (expiring_counts[db_index] == 0) {
+		return 0;
+	}
+
+	const int64_t now_ms = CurrentTimeMs();
+	std::vector<std::pair<NanoObj, int64_t>> expired_keys;
+	int64_t expired_bytes = 0;
+	tables[db_index]->ForEach([&](const NanoObj& key, const DbValue& value) {
+		if (value.IsExpired(now_ms)) {
+			expired_keys.emplace_back(key, static_cast<int64_t>(value.expire_at_ms));
+			expired_bytes += EntryBytes(value.obj);
+		}
+	});
+
+	for (const auto& [key, expire_at_ms] : expired_keys) {
+		const uint64_t hash = Table::Hash(key);
+		(void)tables[db_index]->Erase(key, hash);
+		UntrackExpire(db_index, hash, expire_at_ms);
 	}
+	ChargeMemory(db_index, -expired_bytes);
+	return expired_keys.size();
+}
+
+void Database::TrackExpire(size_t db_index, uint64_t hash, int64_t expire_at_ms) {
+	++expiring_counts[db_index];
+	expire_at_sums[db_index] += expire_at_ms;
+	expire_indexes[db_index].Add(hash, expire_at_ms);
+}
 
-	(void)tables[db_index]->Erase(key);
-	(void)expire_tables[db_index]->Erase(key);
+void Database::UntrackExpire(size_t db_index, uint64_t hash, int64_t expire_at_ms) {
+	--expiring_counts[db_index];
+	expire_at_sums[db_index] -= expire_at_ms;
+	expire_indexes[db_index].Remove(hash, expire_at_ms);
 }
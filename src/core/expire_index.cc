@@ -0,0 +1,79 @@
+#include "core/expire_index.h"
+
+#include <algorithm>
+
+void ExpireIndex::Add(uint64_t hash, int64_t expire_at_ms) {
+	auto [it, inserted] = buckets_[expire_at_ms / kBucketMs].try_emplace(hash, Slot {expire_at_ms, 1});
+	if (!inserted) {
+		it->second.expire_at_ms = std::min(it->second.expire_at_ms, expire_at_ms);
+		++it->second.count;
+	}
+	++size_;
+}
+
+void ExpireIndex::Remove(uint64_t hash, int64_t expire_at_ms) {
+	auto bucket = buckets_.find(expire_at_ms / kBucketMs);
+	if (bucket == buckets_.end()) {
+		return;
+	}
+	auto it = bucket->second.find(hash);
+	if (it == bucket->second.end()) {
+		return;
+	}
+	if (--it->second.count == 0) {
+		bucket->second.erase(it);
+		if (bucket->second.empty()) {
+			buckets_.erase(bucket);
+		}
+	}
+	--size_;
+}
+
+bool ExpireIndex::PopDue(int64_t now_ms, size_t max_entries, std::vector<Entry>* out) {
+	const int64_t now_bucket = now_ms / kBucketMs;
+	size_t popped = 0;
+	auto it = buckets_.begin();
+	while (it != buckets_.end() && it->first <= now_bucket) {
+		Bucket& entries = it->second;
+		// 早于当前时间的桶整个到期; 当前时间所在的桶只取已到期的条目
+		const bool whole_bucket = it->first < now_bucket;
+		for (auto entry = entries.begin(); entry != entries.end() && popped < max_entries;) {
+			if (!whole_bucket && entry->second.expire_at_ms > now_ms) {
+				++entry;
+				continue;
+			}
+			for (uint32_t i = 0; i < entry->second.count; ++i) {
+				out->push_back(Entry {entry->first, entry->second.expire_at_ms});
+			}
+			popped += entry->second.count;
+			entry = entries.erase(entry);
+		}
+
+		if (entries.empty()) {
+			it = buckets_.erase(it);
+		} else if (popped >= max_entries) {
+			break;
+		} else {
+			++it;
+		}
+	}
+	size_ -= popped;
+	return popped >= max_entries && !buckets_.empty() && buckets_.begin()->first <= now_bucket;
+}
+
+void ExpireIndex::Clear() {
+	buckets_.clear();
+	size_ = 0;
+}
+
+size_t ExpireIndex::ReleaseStep(size_t max_entries) {
+	size_t released = 0;
+	while (released < max_entries && !buckets_.empty()) {
+		auto it = buckets_.begin();
+		released += it->second.size();
+		buckets_.erase(it);
+	}
+	// 共用条目的计数可能大于 1, 释放完时直接归零
+	size_ = buckets_.empty() ? 0 : size_ - std::min(released, size_);
+	return released;
+}
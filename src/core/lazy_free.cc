@@ -0,0 +1,75 @@
+#include "core/lazy_free.h"
+
+#include "core/unordered_dense.h"
+
+namespace {
+using ListType = std::deque<NanoObj>;
+using SetType = ankerl::unordered_dense::set<std::string, ankerl::unordered_dense::hash<std::string>>;
+using HashType = ankerl::unordered_dense::map<std::string, std::string, ankerl::unordered_dense::hash<std::string>>;
+
+template <typename Vec>
+size_t PopBack(Vec* values, size_t max_items) {
+	size_t freed = 0;
+	while (freed < max_items && !values->empty()) {
+		values->pop_back();
+		++freed;
+	}
+	if (values->empty()) {
+		Vec().swap(*values);
+	}
+	return freed;
+}
+} // namespace
+
+size_t LazyFreeQueue::FreeEffort(const NanoObj& obj) {
+	if (obj.IsList()) {
+		const auto* list = obj.GetObj<ListType>();
+		return list != nullptr ? list->size() : 1;
+	}
+	if (obj.IsSet()) {
+		const auto* set = obj.GetObj<SetType>();
+		return set != nullptr ? set->size() : 1;
+	}
+	if (obj.IsHash()) {
+		const auto* hash = obj.GetObj<HashType>();
+		return hash != nullptr ? hash->size() : 1;
+	}
+	return 1;
+}
+
+void LazyFreeQueue::Push(NanoObj&& obj) {
+	objects_.push_back(std::move(obj));
+}
+
+size_t LazyFreeQueue::Step(size_t max_items) {
+	size_t freed = 0;
+	while (freed < max_items) {
+		if (!set_members_.empty()) {
+			freed += PopBack(&set_members_, max_items - freed);
+			continue;
+		}
+		if (!hash_fields_.empty()) {
+			freed += PopBack(&hash_fields_, max_items - freed);
+			continue;
+		}
+		if (objects_.empty()) {
+			break;
+		}
+
+		NanoObj& obj = objects_.front();
+		if (auto* list = obj.IsList() ? obj.GetObj<ListType>() : nullptr; list != nullptr) {
+			freed += PopBack(list, max_items - freed);
+			if (!list->empty()) {
+				break;
+			}
+		} else if (auto* set = obj.IsSet() ? obj.GetObj<SetType>() : nullptr; set != nullptr) {
+			// extract 后 set 只剩 bucket 数组, 随 obj 一次释放
+			set_members_ = std::move(*set).extract();
+		} else if (auto* hash = obj.IsHash() ? obj.GetObj<HashType>() : nullptr; hash != nullptr) {
+			hash_fields_ = std::move(*hash).extract();
+		}
+		objects_.pop_front();
+		++freed;
+	}
+	return freed;
+}
@@ -0,0 +1,169 @@
+#include "core/memory_budget.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#ifdef NANO_REDIS_USE_MIMALLOC
+#include <mimalloc.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "core/database.h"
+#include "core/util.h"
+
+namespace {
+
+// 空闲/过期 tick 上重新统计堆用量的最短间隔
+constexpr int64_t kCalibrateIntervalUsec = 100 * 1000;
+
+std::atomic<uint64_t> max_memory {0};
+std::atomic<EvictionPolicy> eviction_policy {EvictionPolicy::kNoEviction};
+std::atomic<size_t> num_shards {1};
+// 每个分片线程各自的用量估算: 上次统计堆得到的基线, 加上此后 Database 增删 key 记下的字节差
+thread_local uint64_t calibrated_used_memory = 0;
+thread_local int64_t charged_bytes = 0;
+thread_local int64_t calibrated_at_usec = 0;
+thread_local bool calibrated = false;
+
+int64_t NowUsec() {
+	using Clock = std::chrono::steady_clock;
+	return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+#ifdef NANO_REDIS_USE_MIMALLOC
+// 只访问页 (area), 不逐块访问; 每页在用块数乘以块大小
+bool AddAreaUsed(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+	(void)heap;
+	(void)block;
+	(void)block_size;
+	*static_cast<uint64_t*>(arg) += static_cast<uint64_t>(area->used) * area->block_size;
+	return true;
+}
+#endif
+
+uint64_t MeasureShardUsedMemory() {
+#ifdef NANO_REDIS_USE_MIMALLOC
+	uint64_t used = 0;
+	(void)mi_heap_visit_blocks(mi_heap_get_default(), false, &AddAreaUsed, &used);
+	return used;
+#else
+	const struct mallinfo2 info = mallinfo2();
+	const uint64_t used = static_cast<uint64_t>(info.uordblks) + static_cast<uint64_t>(info.hblkhd);
+	return used / num_shards.load(std::memory_order_relaxed);
+#endif
+}
+
+struct PolicyName {
+	const char* name;
+	EvictionPolicy policy;
+};
+
+constexpr PolicyName kPolicyNames[] = {
+    {"noeviction", EvictionPolicy::kNoEviction},   {"allkeys-lru", EvictionPolicy::kAllKeysLru},
+    {"allkeys-lfu", EvictionPolicy::kAllKeysLfu},  {"volatile-lru", EvictionPolicy::kVolatileLru},
+    {"volatile-ttl", EvictionPolicy::kVolatileTtl},
+};
+
+} // namespace
+
+std::optional<EvictionPolicy> ParseEvictionPolicy(std::string_view name) {
+	for (const auto& entry : kPolicyNames) {
+		if (EqualsIgnoreCase(name, entry.name)) {
+			return entry.policy;
+		}
+	}
+	return std::nullopt;
+}
+
+const char* EvictionPolicyName(EvictionPolicy policy) {
+	for (const auto& entry : kPolicyNames) {
+		if (entry.policy == policy) {
+			return entry.name;
+		}
+	}
+	return "noeviction";
+}
+
+void MemoryBudget::SetMaxMemory(uint64_t bytes) {
+	max_memory.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t MemoryBudget::MaxMemory() {
+	return max_memory.load(std::memory_order_relaxed);
+}
+
+void MemoryBudget::SetPolicy(EvictionPolicy policy) {
+	eviction_policy.store(policy, std::memory_order_relaxed);
+}
+
+EvictionPolicy MemoryBudget::Policy() {
+	return eviction_policy.load(std::memory_order_relaxed);
+}
+
+void MemoryBudget::SetNumShards(size_t count) {
+	num_shards.store(count > 0 ? count : 1, std::memory_order_relaxed);
+}
+
+uint64_t MemoryBudget::ShardBudget() {
+	const uint64_t limit = MaxMemory();
+	if (limit == 0) {
+		return 0;
+	}
+	return std::max<uint64_t>(limit / num_shards.load(std::memory_order_relaxed), 1);
+}
+
+uint64_t MemoryBudget::UsedMemory() {
+	if (!calibrated) {
+		Calibrate();
+	}
+	const int64_t used = static_cast<int64_t>(calibrated_used_memory) + charged_bytes;
+	return used > 0 ? static_cast<uint64_t>(used) : 0;
+}
+
+void MemoryBudget::Charge(int64_t bytes) {
+	charged_bytes += bytes;
+}
+
+void MemoryBudget::Calibrate() {
+	calibrated_used_memory = MeasureShardUsedMemory();
+	charged_bytes = 0;
+	calibrated_at_usec = NowUsec();
+	calibrated = true;
+}
+
+void MemoryBudget::CalibrateIfDue() {
+	if (MaxMemory() == 0) {
+		return;
+	}
+	if (!calibrated || NowUsec() - calibrated_at_usec >= kCalibrateIntervalUsec) {
+		Calibrate();
+	}
+}
+
+bool MemoryBudget::OverLimit() {
+	const uint64_t budget = ShardBudget();
+	return budget != 0 && UsedMemory() > budget;
+}
+
+bool MemoryBudget::ReclaimForWrite(Database* db) {
+	if (!OverLimit()) {
+		return true;
+	}
+	const EvictionPolicy policy = Policy();
+	if (policy == EvictionPolicy::kNoEviction || db == nullptr) {
+		return false;
+	}
+
+	// 每淘汰一个 key, Database 都会把它的字节数从估算中扣掉, 这里只比较估算值
+	size_t evicted = 0;
+	while (evicted < kMaxEvictionsPerWrite && db->EvictOne(policy)) {
+		++evicted;
+		if (!OverLimit()) {
+			return true;
+		}
+	}
+	// 淘汰了一部分但仍超出时放行本条命令 (与 Redis 一致), 后续写命令继续淘汰
+	return evicted > 0;
+}
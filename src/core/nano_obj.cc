@@ -21,7 +21,8 @@ void NanoObj::CopyFrom(const NanoObj& other) {
 		std::memcpy(u.data, other.u.data, tag);
 	} else if (tag == INT_TAG) {
 		u.ival = other.u.ival;
-	} else if (tag == SMALL_STR_TAG) {
+	} else if (tag == SMALL_STR_TAG || tag == VIEW_TAG) {
+		taglen = SMALL_STR_TAG;
 		u.small_str.length = other.u.small_str.length;
 		std::memcpy(u.small_str.prefix, other.u.small_str.prefix, 4);
 		u.small_str.ptr = static_cast<char*>(::operator new(other.u.small_str.length));
@@ -32,6 +33,11 @@ void NanoObj::CopyFrom(const NanoObj& other) {
 }
 
 void NanoObj::MoveFrom(NanoObj& other) noexcept {
+	if (other.taglen == VIEW_TAG) {
+		// 借用的内存不能随对象一起带走, 移出时转为自有副本
+		CopyFrom(other);
+		return;
+	}
 	taglen = other.taglen;
 	flag = other.flag;
 	u = other.u;
@@ -149,6 +155,10 @@ void NanoObj::SetFlag(uint8_t flag_value) {
 	flag = flag_value;
 }
 
+void NanoObj::SetExpireFlag(bool has_expire) {
+	flag = has_expire ? static_cast<uint8_t>(flag | kFlagExpire) : static_cast<uint8_t>(flag & ~kFlagExpire);
+}
+
 bool NanoObj::IsNull() const {
 	return taglen == NULL_TAG;
 }
@@ -156,7 +166,7 @@ bool NanoObj::IsInt() const {
 	return taglen == INT_TAG;
 }
 bool NanoObj::IsString() const {
-	return taglen <= kInlineLen || taglen == SMALL_STR_TAG;
+	return taglen <= kInlineLen || taglen == SMALL_STR_TAG || taglen == VIEW_TAG;
 }
 bool NanoObj::IsHash() const {
 	return taglen == ROBJ_TAG && u.robj.type == OBJ_HASH;
@@ -191,7 +201,7 @@ std::string NanoObj::ToString() const {
 	if (taglen == INT_TAG) {
 		return std::to_string(u.ival);
 	}
-	if (taglen == SMALL_STR_TAG) {
+	if (taglen == SMALL_STR_TAG || taglen == VIEW_TAG) {
 		return std::string(u.small_str.ptr, u.small_str.length);
 	}
 	return "";
@@ -205,7 +215,7 @@ std::string_view NanoObj::GetStringView() const {
 	if (taglen <= kInlineLen) {
 		return std::string_view(reinterpret_cast<const char*>(u.data), taglen);
 	}
-	if (taglen == SMALL_STR_TAG) {
+	if (taglen == SMALL_STR_TAG || taglen == VIEW_TAG) {
 		return std::string_view(u.small_str.ptr, u.small_str.length);
 	}
 	return {};
@@ -231,6 +241,7 @@ uint8_t NanoObj::GetEncoding() const {
 	case INT_TAG:
 		return OBJ_ENCODING_INT;
 	case SMALL_STR_TAG:
+	case VIEW_TAG:
 		return OBJ_ENCODING_RAW;
 	case ROBJ_TAG:
 		return u.robj.encoding;
@@ -243,7 +254,7 @@ size_t NanoObj::Size() const {
 	if (taglen <= kInlineLen) {
 		return taglen;
 	}
-	if (taglen == SMALL_STR_TAG) {
+	if (taglen == SMALL_STR_TAG || taglen == VIEW_TAG) {
 		return u.small_str.length;
 	}
 	if (taglen == INT_TAG) {
@@ -323,6 +334,16 @@ void NanoObj::SetSmallString(std::string_view str) {
 	std::memcpy(u.small_str.ptr, str.data(), str.size());
 }
 
+void NanoObj::SetView(std::string_view str) {
+	Clear();
+	u.small_str.length = static_cast<uint16_t>(str.size());
+	taglen = VIEW_TAG;
+	flag = 0;
+	size_t prefix_len = std::min(str.size(), size_t {4});
+	std::memcpy(u.small_str.prefix, str.data(), prefix_len);
+	u.small_str.ptr = const_cast<char*>(str.data());
+}
+
 void NanoObj::SetStringKey(std::string_view str) {
 	if (str.size() <= 20) {
 		int64_t ival;
@@ -396,8 +417,8 @@ bool NanoObj::operator==(const NanoObj& other) const {
 	if (taglen == INT_TAG && other.taglen == INT_TAG) {
 		return u.ival == other.u.ival;
 	}
-	bool this_str = (taglen <= kInlineLen || taglen == SMALL_STR_TAG);
-	bool other_str = (other.taglen <= kInlineLen || other.taglen == SMALL_STR_TAG);
+	bool this_str = IsString();
+	bool other_str = other.IsString();
 	if (this_str && other_str) {
 		return GetStringView() == other.GetStringView();
 	}
@@ -0,0 +1,70 @@
+#include "core/watch_registry.h"
+
+#include <atomic>
+
+namespace {
+
+// 所有分片上被 WATCH 的 key 条目总数, 写路径据此跳过 Touch
+std::atomic<size_t> watched_count {0};
+
+} // namespace
+
+WatchRegistry::WatchRegistry(size_t num_dbs) : watched(num_dbs), db_epochs(num_dbs, 0) {
+}
+
+WatchRegistry::~WatchRegistry() {
+	for (const auto& keys : watched) {
+		watched_count.fetch_sub(keys.size(), std::memory_order_relaxed);
+	}
+}
+
+uint64_t WatchRegistry::Watch(size_t db_index, std::string_view key) {
+	auto [it, inserted] = watched[db_index].try_emplace(key);
+	if (inserted) {
+		watched_count.fetch_add(1, std::memory_order_release);
+	}
+	++it->second.watchers;
+	return it->second.version + db_epochs[db_index];
+}
+
+void WatchRegistry::Unwatch(size_t db_index, std::string_view key) {
+	auto it = watched[db_index].find(key);
+	if (it == watched[db_index].end()) {
+		return;
+	}
+	if (--it->second.watchers == 0) {
+		watched[db_index].erase(it);
+		watched_count.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+uint64_t WatchRegistry::Version(size_t db_index, std::string_view key) const {
+	auto it = watched[db_index].find(key);
+	return (it != watched[db_index].end() ? it->second.version : 0) + db_epochs[db_index];
+}
+
+void WatchRegistry::Touch(size_t db_index, std::string_view key) {
+	if (watched[db_index].empty()) {
+		return;
+	}
+	auto it = watched[db_index].find(key);
+	if (it != watched[db_index].end()) {
+		++it->second.version;
+	}
+}
+
+void WatchRegistry::TouchDb(size_t db_index) {
+	if (db_index < db_epochs.size()) {
+		++db_epochs[db_index];
+	}
+}
+
+void WatchRegistry::TouchAll() {
+	for (uint64_t& epoch : db_epochs) {
+		++epoch;
+	}
+}
+
+bool WatchRegistry::Empty() {
+	return watched_count.load(std::memory_order_acquire) == 0;
+}
@@ -0,0 +1,54 @@
+#include "protocol/reply_builder.h"
+
+#include <charconv>
+
+void ReplyBuilder::AppendLength(char prefix, int64_t value) {
+	// 前缀 + 最长 20 位数字 + CRLF, 一次 append 写入
+	char buf[24];
+	buf[0] = prefix;
+	auto res = std::to_chars(buf + 1, buf + sizeof(buf) - 2, value);
+	char* end = res.ptr;
+	*end++ = '\r';
+	*end++ = '\n';
+	out->append(buf, static_cast<size_t>(end - buf));
+}
+
+void ReplyBuilder::SimpleString(std::string_view s) {
+	out->push_back('+');
+	out->append(s.data(), s.size());
+	out->append("\r\n", 2);
+}
+
+void ReplyBuilder::Error(std::string_view msg) {
+	out->append("-ERR ", 5);
+	out->append(msg.data(), msg.size());
+	out->append("\r\n", 2);
+}
+
+void ReplyBuilder::Integer(int64_t value) {
+	AppendLength(':', value);
+}
+
+void ReplyBuilder::BulkString(std::string_view s) {
+	AppendLength('$', static_cast<int64_t>(s.size()));
+	out->append(s.data(), s.size());
+	out->append("\r\n", 2);
+}
+
+void ReplyBuilder::BulkString(const NanoObj& value) {
+	if (value.IsInt()) {
+		char buf[24];
+		auto res = std::to_chars(buf, buf + sizeof(buf), value.AsInt());
+		BulkString(std::string_view(buf, static_cast<size_t>(res.ptr - buf)));
+		return;
+	}
+	BulkString(value.GetStringView());
+}
+
+void ReplyBuilder::NullBulkString() {
+	out->append("$-1\r\n", 5);
+}
+
+void ReplyBuilder::ArrayHeader(size_t count) {
+	AppendLength('*', static_cast<int64_t>(count));
+}
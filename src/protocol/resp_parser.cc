@@ -2,12 +2,18 @@
 #include "core/util.h"
 #include <photon/common/alog.h>
 #include <photon/net/socket.h>
+#include <algorithm>
 #include <charconv>
 #include <cctype>
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <system_error>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace {
 
 const std::string kOkResponse = "+OK\r\n";
@@ -21,20 +27,104 @@ inline int ToChars(char* first, char* last, INT_T value) {
 	return res.ec == std::errc() ? static_cast<int>(res.ptr - first) : -1;
 }
 
-// Find first CR or LF in [start, start+avail). Returns {terminator_ptr, is_cr}.
-inline std::pair<const char*, bool> FindTerminator(const char* start, size_t avail) {
-	const char* lf = static_cast<const char*>(std::memchr(start, '\n', avail));
-	const char* cr = static_cast<const char*>(std::memchr(start, '\r', avail));
-	if (lf && cr) {
-		return (lf < cr) ? std::make_pair(lf, false) : std::make_pair(cr, true);
+#if defined(__SSE2__)
+// 从 16 字节对齐的 i 开始按块处理, 返回第一个未处理的下标
+size_t IndexBlocksSse2(const char* data, size_t i, size_t end, uint64_t* bits) {
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	for (; i + 16 <= end; i += 16) {
+		const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		const __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf));
+		const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+		bits[i / 64] |= static_cast<uint64_t>(mask) << (i % 64);
+	}
+	return i;
+}
+
+// 同上, 32 字节一块。默认构建不带 -mavx2, 只在运行时确认 CPU 支持后调用
+__attribute__((target("avx2"))) size_t IndexBlocksAvx2(const char* data, size_t i, size_t end, uint64_t* bits) {
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	for (; i + 32 <= end; i += 32) {
+		const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		const __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf));
+		const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+		bits[i / 64] |= static_cast<uint64_t>(mask) << (i % 64);
+	}
+	return i;
+}
+
+bool CpuHasAvx2() {
+	static const bool has_avx2 = [] {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	}();
+	return has_avx2;
+}
+#endif
+
+// 把 data[begin, end) 中 CR / LF 的位置写入位图 bits (第 i 位对应 data[i]), 该范围原有的位先清掉。
+// 向量循环从 32 (或 16) 字节对齐的下标开始, 每块的掩码不会跨越 64 位字
+void IndexTerminators(const char* data, size_t begin, size_t end, uint64_t* bits) {
+	for (size_t word = begin / 64; word * 64 < end; ++word) {
+		const size_t low = std::max(begin, word * 64) - word * 64;
+		bits[word] &= low == 0 ? 0 : ~(~uint64_t {0} << low);
+	}
+
+	size_t i = begin;
+	auto scalar = [data, bits](size_t pos) {
+		if (data[pos] == '\r' || data[pos] == '\n') {
+			bits[pos / 64] |= uint64_t {1} << (pos % 64);
+		}
+	};
+#if defined(__SSE2__)
+	const bool avx2 = CpuHasAvx2();
+	const size_t block = avx2 ? 32 : 16;
+	for (; i < end && i % block != 0; ++i) {
+		scalar(i);
+	}
+	i = avx2 ? IndexBlocksAvx2(data, i, end, bits) : IndexBlocksSse2(data, i, end, bits);
+#endif
+	for (; i < end; ++i) {
+		scalar(i);
 	}
-	if (lf) {
-		return {lf, false};
+}
+
+// 数组头的 reserve 上限, 避免客户端声明一个巨大的参数个数就先分配内存
+constexpr int64_t kMaxReservedArgs = 1024;
+
+// 读缓冲区按需伸缩: 新连接从小缓冲区开始, 读满后加倍, 连续多次只读到一小部分后减半
+constexpr size_t kMinReadBufferBytes = 1024;
+constexpr size_t kMaxReadBufferBytes = 64 * 1024;
+constexpr size_t kShrinkAfterSmallReads = 16;
+// bulk 剩余长度达到这个值时直接 recv 进参数的内存
+constexpr size_t kDirectReadMinBytes = 8 * 1024;
+
+// 空闲读缓冲区池, 每个 vCPU 线程一份, 按容量 (1KB .. 64KB) 分级。
+// 一块内存 = 数据区 + 紧随其后的 CR / LF 位图; 空闲连接把缓冲区还回来, 有数据到达时再取
+constexpr size_t kReadBufferClasses = 7;
+constexpr size_t kMaxPooledPerClass = 32;
+thread_local std::vector<std::unique_ptr<char[]>> g_free_read_buffers[kReadBufferClasses];
+
+size_t ReadBufferClass(size_t capacity) {
+	return static_cast<size_t>(__builtin_ctzll(capacity / kMinReadBufferBytes));
+}
+
+std::unique_ptr<char[]> AcquireReadBuffer(size_t capacity) {
+	auto& free_list = g_free_read_buffers[ReadBufferClass(capacity)];
+	if (free_list.empty()) {
+		return std::make_unique<char[]>(capacity + capacity / 8);
 	}
-	if (cr) {
-		return {cr, true};
+	std::unique_ptr<char[]> block = std::move(free_list.back());
+	free_list.pop_back();
+	return block;
+}
+
+void RecycleReadBuffer(std::unique_ptr<char[]> block, size_t capacity) {
+	auto& free_list = g_free_read_buffers[ReadBufferClass(capacity)];
+	if (block != nullptr && free_list.size() < kMaxPooledPerClass) {
+		free_list.push_back(std::move(block));
 	}
-	return {nullptr, false};
 }
 
 } // namespace
@@ -52,325 +142,375 @@ const std::string& RESPParser::EmptyArrayResponse() {
 	return kEmptyArrayResponse;
 }
 
-int RESPParser::FillBuffer() {
+char* RESPParser::WritableData() {
+	// 大 bulk 的剩余部分直接读进参数自己的内存, 不经过读缓冲区再拷贝一次
+	direct_read = state == State::kBulkData && buffer_pos >= buffer_size &&
+	              bulk_len - bulk_copied >= kDirectReadMinBytes;
+	if (direct_read) {
+		return bulk_data + bulk_copied;
+	}
 	if (buffer_pos >= buffer_size) {
-		if (!allow_socket_read) {
-			no_read_need_more = true;
-			return -1;
-		}
-		ssize_t n = stream->recv(buffer, sizeof(buffer));
-		if (n <= 0) {
-			return -1;
-		}
-		buffer_size = n;
 		buffer_pos = 0;
+		buffer_size = 0;
+		ResizeBuffer();
+	} else if (buffer_size == buffer_capacity && buffer_pos > 0) {
+		// 调用方在数据未消费完时读入: 把剩余数据移到开头
+		buffer_size -= buffer_pos;
+		std::memmove(buffer.get(), buffer.get() + buffer_pos, buffer_size);
+		buffer_pos = 0;
+		IndexTerminators(buffer.get(), 0, buffer_size, terminator_bits);
 	}
-	return 0;
+	return buffer.get() + buffer_size;
 }
 
-char RESPParser::ReadChar() {
-	return FillBuffer() < 0 ? '\0' : buffer[buffer_pos++];
+size_t RESPParser::WritableSize() const {
+	if (direct_read) {
+		return bulk_len - bulk_copied;
+	}
+	return buffer_capacity - buffer_size;
 }
 
-void RESPParser::ConsumeCRLF(bool term_is_cr) {
-	if (!term_is_cr) {
+void RESPParser::CommitRead(size_t n) {
+	if (direct_read) {
+		direct_read = false;
+		bulk_copied += n;
+		if (bulk_copied == bulk_len) {
+			FinishBulkData();
+		}
 		return;
 	}
-	// Handle CRLF across recv() boundaries
-	if (buffer_pos >= buffer_size) {
-		(void)FillBuffer();
+	// 读满了本次可用的空间, 说明数据来得比缓冲区快
+	read_filled_buffer = buffer_size + n == buffer_capacity;
+	small_reads = n < buffer_capacity / 8 ? small_reads + 1 : 0;
+	// 只对新读入的字节做向量化扫描, 之后找行尾只需查位图
+	IndexTerminators(buffer.get(), buffer_size, buffer_size + n, terminator_bits);
+	buffer_size += n;
+}
+
+// 只在缓冲区为空时调整大小, 不需要搬移数据; 之前借用缓冲区的参数本来就只活到下一次读入
+void RESPParser::ResizeBuffer() {
+	size_t capacity = buffer_capacity;
+	if (capacity == 0) {
+		capacity = kMinReadBufferBytes;
+	} else if (read_filled_buffer && capacity < kMaxReadBufferBytes) {
+		capacity *= 2;
+	} else if (small_reads >= kShrinkAfterSmallReads && capacity > kMinReadBufferBytes) {
+		capacity /= 2;
+	}
+	if (buffer != nullptr && capacity == buffer_capacity) {
+		return;
 	}
-	if (buffer_pos < buffer_size && buffer[buffer_pos] == '\n') {
-		buffer_pos++;
+	if (buffer != nullptr) {
+		RecycleReadBuffer(std::move(buffer), buffer_capacity);
 	}
+	buffer = AcquireReadBuffer(capacity);
+	terminator_bits = reinterpret_cast<uint64_t*>(buffer.get() + capacity);
+	buffer_capacity = capacity;
+	read_filled_buffer = false;
+	small_reads = 0;
 }
 
-int RESPParser::ReadLineView(std::string_view* out) {
-	scratch_line.clear();
-	bool used_scratch = false;
-
-	for (;;) {
-		if (FillBuffer() < 0) {
-			*out = {};
-			return -1;
-		}
-		const char* start = buffer + buffer_pos;
-		size_t avail = buffer_size - buffer_pos;
-		auto [term, is_cr] = FindTerminator(start, avail);
-
-		if (!term) {
-			used_scratch = true;
-			scratch_line.append(start, avail);
-			buffer_pos = buffer_size;
-			continue;
-		}
-
-		size_t seg_len = static_cast<size_t>(term - start);
-		if (used_scratch) {
-			scratch_line.append(start, seg_len);
-			*out = scratch_line;
-		} else {
-			*out = std::string_view(start, seg_len);
-		}
-		buffer_pos = static_cast<size_t>((term - buffer) + 1);
-		ConsumeCRLF(is_cr);
-		return 0;
+bool RESPParser::ReleaseBuffer() {
+	if (HasBufferedData()) {
+		return false;
+	}
+	if (buffer != nullptr) {
+		RecycleReadBuffer(std::move(buffer), buffer_capacity);
+		terminator_bits = nullptr;
+	}
+	buffer_pos = 0;
+	buffer_size = 0;
+	// 上一条命令留下的大块临时内存也一起释放; pending 的容量留着, 下一条命令解析参数时不用重新分配
+	if (partial_line.capacity() > kMinReadBufferBytes) {
+		std::string().swap(partial_line);
 	}
+	return true;
 }
 
-int RESPParser::ReadInlineLineView(char first_char, std::string_view* out) {
-	const char* first_ptr = (buffer_pos > 0) ? (buffer + buffer_pos - 1) : nullptr;
-	scratch_inline.clear();
-	bool used_scratch = false;
-
+// Find first CR or LF in [start, start+avail). Returns {terminator_ptr, is_cr}.
+std::pair<const char*, bool> RESPParser::FindTerminator(const char* start, size_t avail) const {
+	if (avail == 0) {
+		return {nullptr, false};
+	}
+	const auto begin = static_cast<size_t>(start - buffer.get());
+	const size_t end = begin + avail;
+	size_t word = begin / 64;
+	uint64_t bits = terminator_bits[word] & (~uint64_t {0} << (begin % 64));
 	for (;;) {
-		if (FillBuffer() < 0) {
-			*out = {};
-			return -1;
-		}
-		const char* start = buffer + buffer_pos;
-		size_t avail = buffer_size - buffer_pos;
-		auto [term, is_cr] = FindTerminator(start, avail);
-
-		if (!term) {
-			if (!used_scratch) {
-				used_scratch = true;
-				scratch_inline.push_back(first_char);
+		if (bits != 0) {
+			const size_t pos = word * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+			if (pos >= end) {
+				return {nullptr, false};
 			}
-			scratch_inline.append(start, avail);
-			buffer_pos = buffer_size;
-			continue;
+			return {buffer.get() + pos, buffer[pos] == '\r'};
 		}
-
-		size_t seg_len = static_cast<size_t>(term - start);
-		if (used_scratch) {
-			scratch_inline.append(start, seg_len);
-			*out = scratch_inline;
-		} else if (first_ptr) {
-			*out = std::string_view(first_ptr, static_cast<size_t>(term - first_ptr));
-		} else {
-			scratch_inline.push_back(first_char);
-			scratch_inline.append(start, seg_len);
-			*out = scratch_inline;
+		++word;
+		if (word * 64 >= end) {
+			return {nullptr, false};
 		}
-		buffer_pos = static_cast<size_t>((term - buffer) + 1);
-		ConsumeCRLF(is_cr);
-		return 0;
+		bits = terminator_bits[word];
 	}
 }
 
-std::string RESPParser::ReadLine() {
-	std::string_view sv;
-	return ReadLineView(&sv) < 0 ? std::string {} : std::string(sv);
-}
+bool RESPParser::TakeLine(std::string_view* out) {
+	const char* start = buffer.get() + buffer_pos;
+	const size_t avail = buffer_size - buffer_pos;
+	auto [term, is_cr] = FindTerminator(start, avail);
+	if (term == nullptr) {
+		// 行跨越多次读: 已有部分先存起来, 缓冲区可以整体复用
+		partial_line.append(start, avail);
+		buffer_pos = buffer_size;
+		return false;
+	}
 
-std::string RESPParser::ReadBulkString(int64_t len) {
-	if (len < 0) {
-		return "";
+	const auto seg_len = static_cast<size_t>(term - start);
+	if (!partial_line.empty()) {
+		partial_line.append(start, seg_len);
+		*out = partial_line;
+	} else {
+		*out = std::string_view(start, seg_len);
 	}
-	std::string result;
-	result.reserve(len);
-	for (size_t total = 0; total < static_cast<size_t>(len);) {
-		if (FillBuffer() < 0) {
-			return "";
-		}
-		size_t chunk = std::min(buffer_size - buffer_pos, static_cast<size_t>(len) - total);
-		result.append(buffer + buffer_pos, chunk);
-		buffer_pos += chunk;
-		total += chunk;
+	buffer_pos = static_cast<size_t>(term - buffer.get()) + 1;
+	// CR 之后的 LF 可能在下一次读里
+	skip_lf = is_cr;
+	if (skip_lf && buffer_pos < buffer_size && buffer[buffer_pos] == '\n') {
+		++buffer_pos;
+		skip_lf = false;
 	}
-	ReadChar();
-	ReadChar(); // consume trailing CRLF
-	return result;
+	return true;
 }
 
-int RESPParser::ReadBulkStringInto(int64_t len, NanoObj& out) {
-	if (len < 0) {
-		out = NanoObj();
-		return 0;
-	}
-	char* dst = out.PrepareStringBuffer(static_cast<size_t>(len));
-	for (size_t total = 0; total < static_cast<size_t>(len);) {
-		if (FillBuffer() < 0) {
-			out = NanoObj();
-			return -1;
-		}
-		size_t chunk = std::min(buffer_size - buffer_pos, static_cast<size_t>(len) - total);
-		std::memcpy(dst + total, buffer + buffer_pos, chunk);
-		buffer_pos += chunk;
-		total += chunk;
+void RESPParser::BeginArg() {
+	if (args_left == 0) {
+		state = State::kStart;
+		return;
 	}
-	ReadChar();
-	ReadChar(); // consume trailing CRLF
-	out.FinalizePreparedString();
-	out.MaybeConvertToInt();
-	return 0;
+	state = State::kArgType;
 }
 
-int RESPParser::ParseInlineCommand(std::string_view line, std::vector<NanoObj>& args) {
-	const char* p = line.data();
-	const char* end = p + line.size();
-	while (p < end) {
-		while (p < end && (*p == ' ' || *p == '\t')) {
-			++p;
-		}
-		if (p >= end) {
-			break;
-		}
-		const char* token_start = p;
-		while (p < end && *p != ' ' && *p != '\t') {
-			++p;
-		}
-		if (p > token_start) {
-			args.push_back(NanoObj::FromKey(std::string_view(token_start, p - token_start)));
-		}
-	}
-	return args.empty() ? -1 : 0;
+void RESPParser::FinishArg() {
+	--args_left;
+	BeginArg();
 }
 
-int RESPParser::ParseArray(std::vector<NanoObj>& args) {
-	std::string_view line;
-	if (ReadLineView(&line) < 0 || line.empty()) {
-		return -1;
-	}
+void RESPParser::FinishBulkData() {
+	NanoObj& bulk = pending.back();
+	bulk.FinalizePreparedString();
+	bulk.MaybeConvertToInt();
+	crlf_left = 2;
+	state = State::kBulkCRLF;
+}
 
-	int64_t count = 0;
-	if (!String2ll(line.data(), line.size(), &count)) {
-		return -1;
-	}
-	if (count < 0) {
-		return 0;
-	}
-	if (count > 0) {
-		args.reserve(static_cast<size_t>(count));
+void RESPParser::MaterializePending() {
+	for (NanoObj& arg : pending) {
+		if (arg.IsView()) {
+			arg = NanoObj(arg);
+		}
 	}
+}
+
+RESPParser::TryParseResult RESPParser::Fail(std::vector<NanoObj>& args) {
+	state = State::kStart;
+	args_left = 0;
+	skip_lf = false;
+	pending.clear();
+	partial_line.clear();
+	args.clear();
+	return TryParseResult::ERROR;
+}
 
-	for (int64_t i = 0; i < count; ++i) {
-		char c = ReadChar();
-		if (c == '\r' || c == '\n') {
-			c = ReadChar();
+RESPParser::TryParseResult RESPParser::Parse(std::vector<NanoObj>& args) {
+	args.clear();
+	for (;;) {
+		if (skip_lf && buffer_pos < buffer_size) {
+			if (buffer[buffer_pos] == '\n') {
+				++buffer_pos;
+			}
+			skip_lf = false;
+		}
+		if (buffer_pos >= buffer_size) {
+			// 数据用完: 之后的读会覆盖缓冲区, 已解析出的借用参数先转为自有副本
+			MaterializePending();
+			return TryParseResult::NEED_MORE;
 		}
 
-		if (c == '$') {
-			std::string_view len_str;
-			if (ReadLineView(&len_str) < 0) {
-				return -1;
+		switch (state) {
+		case State::kStart: {
+			const char c = buffer[buffer_pos];
+			if (c == '\r' || c == '\n') {
+				++buffer_pos;
+				break;
 			}
-			int64_t len = 0;
-			if (!String2ll(len_str.data(), len_str.size(), &len)) {
-				return -1;
+			pending.clear();
+			if (c == '*') {
+				++buffer_pos;
+				state = State::kArrayLen;
+			} else {
+				state = State::kInline;
 			}
-			NanoObj bulk;
-			if (ReadBulkStringInto(len, bulk) < 0) {
-				return -1;
+			break;
+		}
+		case State::kArrayLen: {
+			std::string_view line;
+			if (!TakeLine(&line)) {
+				break;
 			}
-			args.push_back(std::move(bulk));
-		} else if (c == '+' || c == ':' || c == '-') {
-			std::string_view sv;
-			if (ReadLineView(&sv) < 0) {
-				return -1;
+			int64_t count = 0;
+			if (line.empty() || !String2ll(line.data(), line.size(), &count)) {
+				return Fail(args);
 			}
-			args.push_back(NanoObj::FromKey(sv));
-		} else {
-			return -1;
-		}
-	}
-	return static_cast<int>(args.size());
-}
-
-int RESPParser::ParseValue(ParsedValue& value) {
-	char c = ReadChar();
-	if (c == '\r' || c == '\n') {
-		c = ReadChar();
-	}
-
-	std::string_view sv;
-	switch (c) {
-	case '+':
-		value.type = DataType::SIMPLE_STRING;
-		if (ReadLineView(&sv) < 0) {
-			return -1;
+			partial_line.clear();
+			// 与之前一致: 空数组与 null 数组都当作没有参数的命令
+			args_left = count > 0 ? count : 0;
+			pending.reserve(static_cast<size_t>(std::min(args_left, kMaxReservedArgs)));
+			BeginArg();
+			if (state == State::kStart) {
+				args.swap(pending);
+				return TryParseResult::OK;
+			}
+			break;
 		}
-		value.obj_value = NanoObj::FromKey(sv);
-		return 0;
-	case '-':
-		value.type = DataType::ERROR;
-		if (ReadLineView(&sv) < 0) {
-			return -1;
+		case State::kArgType: {
+			const char c = buffer[buffer_pos++];
+			if (c == '$') {
+				state = State::kBulkLen;
+			} else if (c == '+' || c == ':' || c == '-') {
+				state = State::kSimpleArg;
+			} else if (c != '\r' && c != '\n') {
+				return Fail(args);
+			}
+			break;
 		}
-		value.obj_value = NanoObj::FromKey(sv);
-		return 0;
-	case ':':
-		value.type = DataType::INTEGER;
-		if (ReadLineView(&sv) < 0) {
-			return -1;
+		case State::kBulkLen: {
+			std::string_view line;
+			if (!TakeLine(&line)) {
+				break;
+			}
+			int64_t len = 0;
+			if (!String2ll(line.data(), line.size(), &len)) {
+				return Fail(args);
+			}
+			partial_line.clear();
+			NanoObj& bulk = pending.emplace_back();
+			if (len < 0) {
+				FinishArg();
+				break;
+			}
+			bulk_len = static_cast<size_t>(len);
+			// 内容已完整在缓冲区时直接借用 (见 NanoObj::SetView); 短参数内联存放本来就不分配
+			if (bulk_len > kInlineLen && bulk_len + 2 <= buffer_size - buffer_pos) {
+				bulk.SetView(std::string_view(buffer.get() + buffer_pos, bulk_len));
+				bulk.MaybeConvertToInt();
+				buffer_pos += bulk_len;
+				crlf_left = 2;
+				state = State::kBulkCRLF;
+				break;
+			}
+			bulk_data = bulk.PrepareStringBuffer(bulk_len);
+			bulk_copied = 0;
+			state = State::kBulkData;
+			break;
 		}
-		{
-			int64_t v;
-			if (!String2ll(sv.data(), sv.size(), &v)) {
-				return -1;
+		case State::kBulkData: {
+			const size_t chunk = std::min(buffer_size - buffer_pos, bulk_len - bulk_copied);
+			std::memcpy(bulk_data + bulk_copied, buffer.get() + buffer_pos, chunk);
+			buffer_pos += chunk;
+			bulk_copied += chunk;
+			if (bulk_copied == bulk_len) {
+				FinishBulkData();
 			}
-			value.obj_value = NanoObj::FromInt(v);
+			break;
 		}
-		return 0;
-	case '$': {
-		if (ReadLineView(&sv) < 0) {
-			return -1;
+		case State::kBulkCRLF: {
+			const size_t skip = std::min(buffer_size - buffer_pos, crlf_left);
+			buffer_pos += skip;
+			crlf_left -= skip;
+			if (crlf_left == 0) {
+				FinishArg();
+				if (state == State::kStart) {
+					args.swap(pending);
+					return TryParseResult::OK;
+				}
+			}
+			break;
 		}
-		int64_t len;
-		if (!String2ll(sv.data(), sv.size(), &len)) {
-			return -1;
+		case State::kSimpleArg: {
+			std::string_view line;
+			if (!TakeLine(&line)) {
+				break;
+			}
+			pending.push_back(NanoObj::FromKey(line));
+			partial_line.clear();
+			FinishArg();
+			if (state == State::kStart) {
+				args.swap(pending);
+				return TryParseResult::OK;
+			}
+			break;
 		}
-		value.type = DataType::BULK_STRING;
-		if (len >= 0) {
-			if (ReadBulkStringInto(len, value.obj_value) < 0) {
-				return -1;
+		case State::kInline: {
+			std::string_view line;
+			if (!TakeLine(&line)) {
+				break;
+			}
+			const int ret = ParseInlineCommand(line, pending);
+			partial_line.clear();
+			state = State::kStart;
+			if (ret < 0) {
+				return Fail(args);
 			}
-		} else {
-			value.obj_value = NanoObj();
+			args.swap(pending);
+			return TryParseResult::OK;
+		}
 		}
-		return 0;
-	}
-	default:
-		return -1;
 	}
 }
 
+bool RESPParser::HasBufferedData() const {
+	return buffer_pos < buffer_size || state != State::kStart;
+}
+
 int RESPParser::ParseCommand(std::vector<NanoObj>& args) {
-	no_read_need_more = false;
-	args.clear();
-	char c = ReadChar();
-	if (c == '\0') {
-		return -1;
-	}
-	if (c == '*') {
-		return ParseArray(args);
-	}
-	std::string_view line;
-	if (ReadInlineLineView(c, &line) < 0) {
-		return -1;
+	for (;;) {
+		const TryParseResult result = Parse(args);
+		if (result == TryParseResult::OK) {
+			return static_cast<int>(args.size());
+		}
+		if (result == TryParseResult::ERROR || stream == nullptr) {
+			return -1;
+		}
+		char* data = WritableData();
+		const ssize_t n = stream->recv(data, WritableSize());
+		if (n <= 0) {
+			return -1;
+		}
+		CommitRead(static_cast<size_t>(n));
 	}
-	return ParseInlineCommand(line, args);
 }
 
 RESPParser::TryParseResult RESPParser::TryParseCommandNoRead(std::vector<NanoObj>& args) {
-	const size_t saved_buffer_pos = buffer_pos;
-	const size_t saved_buffer_size = buffer_size;
-	const bool saved_allow_socket_read = allow_socket_read;
-
-	allow_socket_read = false;
-	int ret = ParseCommand(args);
-	const bool need_more_data = no_read_need_more;
-	allow_socket_read = saved_allow_socket_read;
+	return Parse(args);
+}
 
-	if (ret >= 0) {
-		return TryParseResult::OK;
+int RESPParser::ParseInlineCommand(std::string_view line, std::vector<NanoObj>& args) {
+	const char* p = line.data();
+	const char* end = p + line.size();
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t')) {
+			++p;
+		}
+		if (p >= end) {
+			break;
+		}
+		const char* token_start = p;
+		while (p < end && *p != ' ' && *p != '\t') {
+			++p;
+		}
+		if (p > token_start) {
+			args.push_back(NanoObj::FromKey(std::string_view(token_start, p - token_start)));
+		}
 	}
-
-	buffer_pos = saved_buffer_pos;
-	buffer_size = saved_buffer_size;
-	args.clear();
-	return need_more_data ? TryParseResult::NEED_MORE : TryParseResult::ERROR;
+	return args.empty() ? -1 : 0;
 }
 
 // --- Response Builders ---
@@ -393,7 +533,7 @@ std::string RESPParser::MakeError(const std::string& msg) {
 	return r;
 }
 
-std::string RESPParser::MakeBulkString(const std::string& s) {
+std::string RESPParser::MakeBulkString(std::string_view s) {
 	char buf[24];
 	int n = ToChars(buf, buf + sizeof(buf), s.size());
 	if (n < 0) {
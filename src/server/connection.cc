@@ -1,9 +1,16 @@
 #include "server/connection.h"
 #include "core/database.h"
+#include <gflags/gflags.h>
 #include <photon/common/alog.h>
+#include <photon/io/fd-events.h>
+#include <sys/socket.h>
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 
+DECLARE_bool(release_idle_buffers);
+
 namespace {
 
 int64_t CurrentTimeMs() {
@@ -14,6 +21,13 @@ int64_t CurrentTimeMs() {
 
 std::atomic<uint64_t> g_next_client_id {1};
 
+// 不小于该长度的回复不再拷贝进 write_buffer
+constexpr size_t kVectoredReplyMinBytes = 4 * 1024;
+// 单次 writev 的 iovec 数上限, 远小于 IOV_MAX
+constexpr size_t kMaxIovecsPerWrite = 64;
+// 空闲时 write_buffer 超过这个容量才释放, 小缓冲区留着避免反复分配
+constexpr size_t kIdleWriteBufferBytes = 4 * 1024;
+
 } // namespace
 
 Connection::Connection(photon::net::ISocketStream* socket_value) : socket(socket_value), parser(socket_value) {
@@ -30,7 +44,49 @@ void Connection::Close() {
 }
 
 int Connection::ParseCommand(std::vector<NanoObj>& args) {
-	return parser.ParseCommand(args);
+	for (;;) {
+		const RESPParser::TryParseResult result = parser.Parse(args);
+		if (result == RESPParser::TryParseResult::OK) {
+			return static_cast<int>(args.size());
+		}
+		if (result == RESPParser::TryParseResult::ERROR || !ReadInput()) {
+			return -1;
+		}
+	}
+}
+
+// 缓冲区里没有未处理的输入时先不阻塞地读一次, 读到数据就直接交给 parser, 请求-应答和流水线都走这里。
+// 只有 socket 确实暂无数据 (且回复已发完) 时连接才算空闲: 先把读缓冲区和较大的写缓冲区还掉,
+// 等 socket 可读后才重新取读缓冲区, 大量空闲连接因此只占用连接对象本身和 fiber 栈
+bool Connection::ReadInput() {
+	const int fd = socket->get_underlay_fd();
+	if (FLAGS_release_idle_buffers && fd >= 0 && !parser.HasBufferedData() && PendingResponseBytes() == 0) {
+		char* data = parser.WritableData();
+		const ssize_t n = ::recv(fd, data, parser.WritableSize(), MSG_DONTWAIT);
+		if (n > 0) {
+			parser.CommitRead(static_cast<size_t>(n));
+			return true;
+		}
+		if (n == 0) {
+			return false;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			(void)parser.ReleaseBuffer();
+			if (write_buffer.capacity() > kIdleWriteBufferBytes) {
+				std::string().swap(write_buffer);
+			}
+			if (photon::wait_for_fd_readable(fd) != 0) {
+				return false;
+			}
+		}
+	}
+	char* data = parser.WritableData();
+	const ssize_t n = socket->recv(data, parser.WritableSize());
+	if (n <= 0) {
+		return false;
+	}
+	parser.CommitRead(static_cast<size_t>(n));
+	return true;
 }
 
 RESPParser::TryParseResult Connection::TryParseCommandNoRead(std::vector<NanoObj>& args) {
@@ -77,15 +133,33 @@ void Connection::AppendResponse(std::string_view response) {
 	write_buffer.append(response.data(), response.size());
 }
 
+void Connection::AppendResponse(std::string&& response) {
+	if (response.size() < kVectoredReplyMinBytes) {
+		AppendResponse(std::string_view(response));
+		return;
+	}
+	// 排在 write_buffer 当前末尾之后: 之前的小回复先发, 之后追加的回复后发
+	pending_reply_bytes += response.size();
+	pending_replies.push_back(PendingReply {write_buffer.size(), std::move(response)});
+}
+
 bool Connection::Flush() {
-	if (write_buffer.empty()) {
+	if (pending_replies.empty()) {
+		if (write_buffer.empty()) {
+			return true;
+		}
+		if (!SendRaw(write_buffer)) {
+			return false;
+		}
+		write_buffer.clear();
 		return true;
 	}
-	if (!SendRaw(write_buffer)) {
-		return false;
-	}
+
+	const bool sent = SendVectored();
+	pending_replies.clear();
+	pending_reply_bytes = 0;
 	write_buffer.clear();
-	return true;
+	return sent;
 }
 
 bool Connection::SetDBIndex(size_t index) {
@@ -119,3 +193,46 @@ bool Connection::SendRaw(std::string_view data) {
 
 	return true;
 }
+
+// write_buffer 按大回复的插入位置切段, 与大回复交替作为 iovec 提交, 处理部分写
+bool Connection::SendVectored() {
+	if (!socket) {
+		LOG_ERROR("Socket is null");
+		return false;
+	}
+
+	iovecs.clear();
+	size_t buffer_pos = 0;
+	for (PendingReply& reply : pending_replies) {
+		if (reply.buffer_offset > buffer_pos) {
+			iovecs.push_back({write_buffer.data() + buffer_pos, reply.buffer_offset - buffer_pos});
+			buffer_pos = reply.buffer_offset;
+		}
+		iovecs.push_back({reply.data.data(), reply.data.size()});
+	}
+	if (write_buffer.size() > buffer_pos) {
+		iovecs.push_back({write_buffer.data() + buffer_pos, write_buffer.size() - buffer_pos});
+	}
+
+	size_t index = 0;
+	while (index < iovecs.size()) {
+		const size_t count = std::min(iovecs.size() - index, kMaxIovecsPerWrite);
+		ssize_t ret = socket->writev(iovecs.data() + index, static_cast<int>(count));
+		if (ret <= 0) {
+			LOG_ERROR("Failed to write to socket");
+			return false;
+		}
+		auto written = static_cast<size_t>(ret);
+		while (written > 0) {
+			iovec& iov = iovecs[index];
+			if (written < iov.iov_len) {
+				iov.iov_base = static_cast<char*>(iov.iov_base) + written;
+				iov.iov_len -= written;
+				break;
+			}
+			written -= iov.iov_len;
+			++index;
+		}
+	}
+	return true;
+}
@@ -1,6 +1,12 @@
 #include "server/engine_shard.h"
 
 #include <photon/common/alog.h>
+#include <photon/thread/thread.h>
+
+namespace {
+// 冻结通常只持续一次多分片事务, 轮询间隔取一个较短的值
+constexpr uint64_t kFrozenPollUsec = 20;
+} // namespace
 
 __thread EngineShard* EngineShard::tlocal_shard = nullptr;
 
@@ -13,3 +19,9 @@ void EngineShard::InitializeInThread() {
 	tlocal_shard = this;
 	LOG_INFO("EngineShard initialized in thread", shard_id);
 }
+
+void EngineShard::WaitUntilUnfrozen() {
+	while (IsFrozen()) {
+		photon::thread_usleep(kFrozenPollUsec);
+	}
+}
@@ -0,0 +1,93 @@
+#include "server/pipeline.h"
+
+#include <string_view>
+
+#include "command/command_registry.h"
+#include "core/command_context.h"
+#include "protocol/resp_parser.h"
+#include "server/engine_shard.h"
+#include "server/engine_shard_set.h"
+#include "server/sharding.h"
+
+RoutedCommand RouteCommand(const std::vector<NanoObj>& args, CommandRegistry& registry, size_t vcpu_index,
+                           size_t num_shards) {
+	RoutedCommand route;
+	route.target_shard = vcpu_index;
+	if (args.empty()) {
+		return route;
+	}
+
+	const std::string_view cmd_sv = args[0].GetStringView();
+	const CommandRegistry::CommandMeta* meta =
+	    !cmd_sv.empty() ? registry.FindMeta(cmd_sv) : registry.FindMeta(args[0].ToString());
+	if (meta == nullptr) {
+		return route;
+	}
+
+	const bool is_no_key = (meta->flags & CommandRegistry::kCmdFlagNoKey) != 0;
+	if (is_no_key || meta->first_key <= 0) {
+		return route;
+	}
+	const size_t first_key_index = static_cast<size_t>(meta->first_key);
+	if (first_key_index >= args.size()) {
+		return route;
+	}
+
+	const uint64_t first_hash = KeyHash(args[first_key_index]);
+	const size_t first_shard = ShardOfKey(args[first_key_index], first_hash, num_shards);
+	// 多 key 命令只有在所有 key 同属一个分片时 (通常借助 hash tag) 才整体路由过去,
+	// 否则留在本地由命令自己分发或返回 CROSSSLOT
+	if ((meta->flags & CommandRegistry::kCmdFlagMultiKey) != 0) {
+		const size_t last_key_index = CommandRegistry::LastKeyIndex(*meta, args);
+		const size_t key_step = meta->key_step > 0 ? static_cast<size_t>(meta->key_step) : 1;
+		for (size_t i = first_key_index + key_step; i <= last_key_index && i < args.size(); i += key_step) {
+			if (Shard(args[i], num_shards) != first_shard) {
+				return route;
+			}
+		}
+	}
+
+	route.key = &args[first_key_index];
+	route.key_hash = first_hash;
+	route.target_shard = first_shard;
+	route.forward = route.target_shard != vcpu_index;
+	return route;
+}
+
+size_t SquashedRunEnd(const std::vector<RoutedCommand>& routes, size_t begin, size_t batch_size) {
+	size_t end = begin + 1;
+	while (end < batch_size && routes[end].key != nullptr) {
+		++end;
+	}
+	return end;
+}
+
+void ExecuteSquashed(std::vector<std::vector<NanoObj>>& batch, const std::vector<RoutedCommand>& routes, size_t begin,
+                     size_t end, EngineShardSet* shard_set, size_t num_shards, size_t conn_db_index,
+                     Connection* connection, std::vector<std::string>* responses) {
+	std::vector<std::vector<size_t>> shard_commands(num_shards);
+	std::vector<size_t> shard_ids;
+	for (size_t i = begin; i < end; ++i) {
+		auto& commands = shard_commands[routes[i].target_shard];
+		if (commands.empty()) {
+			shard_ids.push_back(routes[i].target_shard);
+		}
+		commands.push_back(i);
+	}
+
+	responses->assign(end - begin, std::string());
+	shard_set->AwaitAll(shard_ids, [&](size_t shard_id) {
+		EngineShard* shard = EngineShard::Tlocal();
+		for (size_t i : shard_commands[shard_id]) {
+			if (shard == nullptr) {
+				(*responses)[i - begin] = RESPParser::MakeError("ERR internal shard context");
+				continue;
+			}
+			// 只有在本分片内联执行时才能访问连接对象
+			CommandContext ctx(shard, shard_set, num_shards, conn_db_index,
+			                   routes[i].forward ? nullptr : connection);
+			ctx.SetKeyHash(routes[i].key, routes[i].key_hash);
+			(*responses)[i - begin] = CommandRegistry::Instance().Execute(batch[i], &ctx);
+		}
+	});
+}
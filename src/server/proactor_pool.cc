@@ -2,7 +2,9 @@
 #include "server/connection.h"
 #include "server/engine_shard.h"
 #include "server/engine_shard_set.h"
+#include "server/pipeline.h"
 #include "server/sharding.h"
+#include "server/transaction.h"
 #include "protocol/resp_parser.h"
 #include "command/command_registry.h"
 #include "core/util.h"
@@ -22,17 +24,27 @@
 #include <algorithm>
 #include <chrono>
 #include <limits>
+#include <optional>
 #include <absl/container/flat_hash_map.h>
 #include <gflags/gflags.h>
 
 DECLARE_bool(tcp_nodelay);
 DECLARE_bool(use_iouring_tcp_server);
+DECLARE_bool(migrate_connections);
 
 namespace {
 
 constexpr size_t kPipelineFlushThresholdBytes = 16 * 1024;
 constexpr uint64_t kActiveExpireIntervalUsec = 100 * 1000;
+// 上一 tick 用完预算仍有积压时, 下一 tick 提前到来
+constexpr uint64_t kActiveExpireBacklogIntervalUsec = 1000;
+constexpr int64_t kActiveExpireBudgetUsec = 2500;
 constexpr size_t kActiveExpireKeysPerDb = 32;
+constexpr uint32_t kIdleSplitBucketsPerTable = 16;
+// lazy free 每批释放的元素数和每个 tick 的 CPU 预算
+constexpr size_t kLazyFreeChunkItems = 1024;
+constexpr int64_t kLazyFreeBudgetUsec = 1000;
+constexpr size_t kPipelineBatchSize = 16;
 
 using ConnectionMap = absl::flat_hash_map<uint64_t, Connection*>;
 thread_local ConnectionMap tlocal_connections;
@@ -57,6 +69,51 @@ void PauseIfNeeded() {
 	}
 }
 
+// photon 只能迁移 READY 状态的 fiber: 创建一个辅助 fiber 并让出 CPU, 由它把当前 fiber 迁到 target,
+// 当前 fiber 恢复运行时已在 target 上。迁移失败时留在原 vCPU。
+bool MigrateCurrentFiber(photon::vcpu_base* target) {
+	photon::thread* self = photon::CURRENT;
+	photon::thread* helper =
+	    photon::thread_create11([self, target]() { (void)photon::thread_migrate(self, target); });
+	if (helper == nullptr) {
+		return false;
+	}
+	photon::thread_yield_to(helper);
+	return photon::get_vcpu() == target;
+}
+
+// Redis 风格的自适应循环: 本轮取出的条目中超过 1/4 确实过期、且还有到期条目时继续,
+// 直到用完本 tick 的 CPU 预算。返回 true 表示预算用完时仍有积压。
+bool RunActiveExpire(Database& db) {
+	using Clock = std::chrono::steady_clock;
+	const auto start = Clock::now();
+	for (;;) {
+		ExpireCycleStats stats;
+		(void)db.ActiveExpireCycle(kActiveExpireKeysPerDb, &stats);
+		if (!stats.more_due || stats.expired * 4 <= stats.sampled) {
+			return false;
+		}
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+		if (elapsed.count() >= kActiveExpireBudgetUsec) {
+			return true;
+		}
+	}
+}
+
+// 分批释放 UNLINK / FLUSH ASYNC 摘下的数据, 每个 tick 最多占用 kLazyFreeBudgetUsec。
+// 返回 true 表示预算用完时仍有待释放的
+bool RunLazyFree(Database& db) {
+	using Clock = std::chrono::steady_clock;
+	const auto start = Clock::now();
+	while (db.LazyFreeStep(kLazyFreeChunkItems)) {
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+		if (elapsed.count() >= kLazyFreeBudgetUsec) {
+			return true;
+		}
+	}
+	return false;
+}
+
 } // namespace
 
 ProactorPool::ProactorPool(size_t num_vcpus_value, uint16_t port_value) : num_vcpus(num_vcpus_value), port(port_value) {
@@ -274,8 +331,12 @@ void ProactorPool::VcpuMain(size_t vcpu_index) {
 	photon::join_handle* expiry_handle = nullptr;
 	if (auto* expiry_fiber = photon::thread_create11([this, shard]() {
 		    while (running.load()) {
-			    shard->GetDB().ActiveExpireCycle(kActiveExpireKeysPerDb);
-			    photon::thread_usleep(kActiveExpireIntervalUsec);
+			    bool backlog = RunActiveExpire(shard->GetDB());
+			    backlog |= RunLazyFree(shard->GetDB());
+			    shard->GetDB().SplitMigrationStep(kIdleSplitBucketsPerTable);
+			    // 统计堆用量要遍历所有页, 只在这里做, 写路径只读 O(1) 的估算
+			    MemoryBudget::CalibrateIfDue();
+			    photon::thread_usleep(backlog ? kActiveExpireBacklogIntervalUsec : kActiveExpireIntervalUsec);
 		    }
 	    })) {
 		expiry_handle = photon::thread_enable_join(expiry_fiber);
@@ -308,10 +369,21 @@ int ProactorPool::HandleConnection(photon::net::ISocketStream* stream) {
 	DEFER(UnregisterLocalConnection(connection.GetClientId()));
 	CommandRegistry& registry = CommandRegistry::Instance();
 
-	std::vector<NanoObj> args;
-	args.reserve(8);
+	// 缓冲区中已到达的流水线命令一次解析最多 kPipelineBatchSize 条: 先统一路由并预取本分片的表,
+	// 再按顺序执行, 各命令的 cache miss 可以重叠
+	std::vector<std::vector<NanoObj>> batch(kPipelineBatchSize);
+	for (auto& args : batch) {
+		args.reserve(8);
+	}
+	std::vector<RoutedCommand> routes(kPipelineBatchSize);
 	std::vector<NanoObj> forwarded_args;
 	forwarded_args.reserve(8);
+	std::vector<std::string> squashed_responses;
+	// 连接落在哪个 vCPU 由 SO_REUSEPORT 决定; 若它的 key 集中在另一个分片, 迁过去可省掉几乎所有跨分片跳转
+	const bool track_affinity = FLAGS_migrate_connections && num_vcpus > 1;
+	ShardAffinity affinity(num_vcpus);
+	Transaction transaction(shard_set.get(), num_vcpus, &connection);
+	std::optional<size_t> migrate_to;
 
 	while (running) {
 		PauseIfNeeded();
@@ -319,14 +391,42 @@ int ProactorPool::HandleConnection(photon::net::ISocketStream* stream) {
 			return 0;
 		}
 
-		args.clear();
-		if (connection.ParseCommand(args) < 0) {
+		batch[0].clear();
+		if (connection.ParseCommand(batch[0]) < 0) {
 			return 0;
 		}
+		size_t batch_size = 1;
 		bool should_close = false;
 		bool parse_error = false;
 		while (running) {
-			if (!args.empty()) {
+			RESPParser::TryParseResult try_parse_result = RESPParser::TryParseResult::OK;
+			while (batch_size < kPipelineBatchSize) {
+				batch[batch_size].clear();
+				try_parse_result = connection.TryParseCommandNoRead(batch[batch_size]);
+				if (try_parse_result != RESPParser::TryParseResult::OK) {
+					break;
+				}
+				++batch_size;
+			}
+
+			for (size_t i = 0; i < batch_size; ++i) {
+				routes[i] = RouteCommand(batch[i], registry, vcpu_index, num_vcpus);
+				if (routes[i].key != nullptr && !routes[i].forward) {
+					local_shard->GetDB().Prefetch(connection.GetDBIndex(), routes[i].key_hash);
+				}
+				if (track_affinity && routes[i].key != nullptr) {
+					if (auto target = affinity.Record(routes[i].target_shard, vcpu_index)) {
+						migrate_to = target;
+					}
+				}
+			}
+
+			for (size_t i = 0; i < batch_size; ++i) {
+				std::vector<NanoObj>& args = batch[i];
+				const RoutedCommand& route = routes[i];
+				if (args.empty()) {
+					continue;
+				}
 				PauseIfNeeded();
 				if (connection.IsCloseRequested()) {
 					should_close = true;
@@ -342,89 +442,103 @@ int ProactorPool::HandleConnection(photon::net::ISocketStream* stream) {
 				if (!cmd_sv.empty() && EqualsIgnoreCase(cmd_sv, "QUIT")) {
 					connection.AppendResponse(RESPParser::OkResponse());
 					should_close = true;
-				} else {
-					// IMPORTANT:
-					// Route requests to the owning shard based on the key. For same-shard requests, we can
-					// execute directly on the current vCPU (fast path). For cross-shard requests, we hop via
-					// TaskQueue to preserve shard ownership.
-					std::string response;
-					size_t target_shard = vcpu_index;
-					bool should_forward = false;
-
-					const CommandRegistry::CommandMeta* meta = nullptr;
-					if (!cmd_sv.empty()) {
-						meta = registry.FindMeta(cmd_sv);
-					} else {
-						meta = registry.FindMeta(args[0].ToString());
-					}
+					break;
+				}
 
-					if (meta != nullptr) {
-						const bool is_no_key = (meta->flags & CommandRegistry::kCmdFlagNoKey) != 0;
-						const bool is_multi_key = (meta->flags & CommandRegistry::kCmdFlagMultiKey) != 0;
-						if (!is_no_key && !is_multi_key && meta->first_key > 0) {
-							size_t first_key_index = static_cast<size_t>(meta->first_key);
-							if (first_key_index < args.size()) {
-								// NOTE: keys may be INT_TAG internally; hash via string form.
-								const std::string key = args[first_key_index].ToString();
-								target_shard = Shard(key, num_vcpus);
-								should_forward = target_shard != vcpu_index;
+				// 需要跨分片的命令与其后连续的单 key 命令合并: 每个目标分片只跳一次, 回复按原顺序追加。
+				// 上面的暂停和关闭检查对整段生效: 段内没有无 key 命令, 不会有命令改变这两个状态
+				if (route.forward && !transaction.InMulti()) {
+					const size_t run_end = SquashedRunEnd(routes, i, batch_size);
+					if (run_end - i > 1) {
+						const std::vector<NanoObj>& last_args = batch[run_end - 1];
+						const std::string_view last_sv = last_args[0].GetStringView();
+						if (!last_sv.empty()) {
+							connection.SetLastCommand(last_sv);
+						} else {
+							connection.SetLastCommand(last_args[0].ToString());
+						}
+						ExecuteSquashed(batch, routes, i, run_end, shard_set.get(), num_vcpus, connection.GetDBIndex(),
+						                &connection, &squashed_responses);
+						for (std::string& squashed : squashed_responses) {
+							connection.AppendResponse(std::move(squashed));
+						}
+						i = run_end - 1;
+						if (connection.PendingResponseBytes() >= kPipelineFlushThresholdBytes) {
+							if (!connection.Flush()) {
+								return -1;
 							}
 						}
+						continue;
 					}
+				}
 
-					if (!should_forward) {
-						CommandContext ctx(local_shard, shard_set.get(), num_vcpus, connection.GetDBIndex(),
-						                   &connection);
-						response = registry.Execute(args, &ctx);
-					} else {
-						// Avoid per-command heap churn:
-						// - Keep `args` capacity stable for parsing
-						// - Keep `forwarded_args` buffer stable across requests
-						// - Pass args by reference since Await() is synchronous
-						forwarded_args.clear();
-						forwarded_args.swap(args);
-						const size_t conn_db_index = connection.GetDBIndex();
-
-						response =
-						    shard_set->Await(target_shard, [this, &forwarded_args, conn_db_index]() -> std::string {
-							    EngineShard* shard = EngineShard::Tlocal();
-							    if (shard == nullptr) {
-								    return RESPParser::MakeError("ERR internal shard context");
-							    }
-							    CommandContext ctx(shard, shard_set.get(), num_vcpus, conn_db_index, nullptr);
-							    return CommandRegistry::Instance().Execute(forwarded_args, &ctx);
-						    });
-						forwarded_args.clear();
-					}
-
-					connection.AppendResponse(response);
+				// IMPORTANT:
+				// Route requests to the owning shard based on the key. For same-shard requests, we can
+				// execute directly on the current vCPU (fast path). For cross-shard requests, we hop via
+				// TaskQueue to preserve shard ownership.
+				std::string response;
+				if (transaction.Handle(args, local_shard, &response)) {
+					// MULTI / EXEC / WATCH 等, 或 MULTI 状态下入队
+				} else if (!route.forward) {
+					local_shard->WaitUntilUnfrozen();
+					CommandContext ctx(local_shard, shard_set.get(), num_vcpus, connection.GetDBIndex(), &connection);
+					ctx.SetKeyHash(route.key, route.key_hash);
+					ctx.reply_buffer = connection.ReplyBuffer();
+					response = registry.Execute(args, &ctx);
+				} else {
+					// Avoid per-command heap churn:
+					// - Keep `args` capacity stable for parsing
+					// - Keep `forwarded_args` buffer stable across requests
+					// - Pass args by reference since Await() is synchronous
+					forwarded_args.clear();
+					forwarded_args.swap(args);
+					const size_t conn_db_index = connection.GetDBIndex();
+					const NanoObj* routed_key = route.key;
+					const uint64_t routed_key_hash = route.key_hash;
+					std::string* reply_buffer = connection.ReplyBuffer();
+
+					// swap() 保留元素地址, routed_key 仍指向 forwarded_args 中的 key;
+					// 聚合回复由目标分片直接写进本连接的缓冲区, 不经过中间字符串
+					response = shard_set->Await(route.target_shard, [this, &forwarded_args, conn_db_index, routed_key,
+					                                                 routed_key_hash, reply_buffer]() -> std::string {
+						EngineShard* shard = EngineShard::Tlocal();
+						if (shard == nullptr) {
+							return RESPParser::MakeError("ERR internal shard context");
+						}
+						CommandContext ctx(shard, shard_set.get(), num_vcpus, conn_db_index, nullptr);
+						ctx.SetKeyHash(routed_key, routed_key_hash);
+						ctx.reply_buffer = reply_buffer;
+						return CommandRegistry::Instance().Execute(forwarded_args, &ctx);
+					});
+					forwarded_args.clear();
 				}
 
+				connection.AppendResponse(std::move(response));
+
 				// Keep args buffer reasonably sized.
 				if (args.capacity() < 8) {
 					args.reserve(8);
 				}
-			}
 
-			if (connection.PendingResponseBytes() >= kPipelineFlushThresholdBytes) {
-				if (!connection.Flush()) {
-					return -1;
+				if (connection.PendingResponseBytes() >= kPipelineFlushThresholdBytes) {
+					if (!connection.Flush()) {
+						return -1;
+					}
 				}
 			}
 
 			if (should_close) {
 				break;
 			}
-
-			args.clear();
-			RESPParser::TryParseResult try_parse_result = connection.TryParseCommandNoRead(args);
-			if (try_parse_result == RESPParser::TryParseResult::OK) {
-				continue;
-			}
 			if (try_parse_result == RESPParser::TryParseResult::ERROR) {
 				parse_error = true;
+				break;
 			}
-			break;
+			// 批次没有填满说明缓冲区里已经没有完整的命令
+			if (batch_size < kPipelineBatchSize) {
+				break;
+			}
+			batch_size = 0;
 		}
 
 		if (!connection.Flush()) {
@@ -440,6 +554,20 @@ int ProactorPool::HandleConnection(photon::net::ISocketStream* stream) {
 		if (connection.IsCloseRequested()) {
 			return 0;
 		}
+
+		// 回复都已发出, 在读下一批之前迁移; 未解析的输入留在 connection 中随 fiber 一起迁走
+		if (migrate_to.has_value()) {
+			photon::vcpu_base* target = GetVcpu(*migrate_to);
+			migrate_to.reset();
+			if (target != nullptr) {
+				UnregisterLocalConnection(connection.GetClientId());
+				if (MigrateCurrentFiber(target)) {
+					local_shard = EngineShard::Tlocal();
+					vcpu_index = local_shard->ShardId();
+				}
+				RegisterLocalConnection(&connection);
+			}
+		}
 	}
 
 	return 0;
@@ -86,7 +86,7 @@ std::error_code LoadFromFile(const std::string& file_path, ProactorPool* pool, b
 		if (dbid >= Database::kNumDBs) {
 			return std::make_error_code(std::errc::invalid_argument);
 		}
-		const size_t shard_id = Shard(key.GetStringView(), shard_count);
+		const size_t shard_id = Shard(key, shard_count);
 		return shard_set->Await(shard_id, [dbid, key, value, expire_ms]() -> std::error_code {
 			                        EngineShard* shard = EngineShard::Tlocal();
 			                        if (shard == nullptr) {
@@ -70,25 +70,18 @@ void SliceSnapshot::SerializeSegment(size_t db_index, size_t dir_idx) {
 		return;
 	}
 
-	const auto* expire_table = db_->GetExpireTable(db_index);
 	const int64_t now_ms = CurrentTimeMs();
 	const uint32_t dbid = static_cast<uint32_t>(db_index);
 
-	table->ForEachInSeg(dir_idx, [&](const NanoObj& key, const NanoObj& value) {
+	table->ForEachInSeg(dir_idx, [&](const NanoObj& key, const DbValue& value) {
 		if (error_) {
 			return;
 		}
-		int64_t expire_ms = 0;
-		if (expire_table != nullptr) {
-			const int64_t* exp = expire_table->Find(key);
-			if (exp != nullptr) {
-				if (*exp <= now_ms) {
-					return;
-				}
-				expire_ms = *exp;
-			}
+		if (value.IsExpired(now_ms)) {
+			return;
 		}
-		error_ = serializer_->SaveEntry(key, value, expire_ms, dbid);
+		const int64_t expire_ms = value.HasExpire() ? value.expire_at_ms : 0;
+		error_ = serializer_->SaveEntry(key, value.obj, expire_ms, dbid);
 	});
 }
 
@@ -0,0 +1,368 @@
+#include "server/transaction.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+
+#include <photon/thread/thread.h>
+
+#include "command/command_registry.h"
+#include "core/command_context.h"
+#include "core/util.h"
+#include "core/watch_registry.h"
+#include "protocol/resp_parser.h"
+#include "server/connection.h"
+#include "server/engine_shard.h"
+#include "server/engine_shard_set.h"
+#include "server/sharding.h"
+
+namespace {
+
+const std::string kQueuedResponse = "+QUEUED\r\n";
+const std::string kNullArrayResponse = "*-1\r\n";
+
+std::string CommandName(const std::vector<NanoObj>& args) {
+	const std::string_view name = args[0].GetStringView();
+	return !name.empty() ? std::string(name) : args[0].ToString();
+}
+
+std::string WrongArity(const std::string& name) {
+	return RESPParser::MakeError("wrong number of arguments for '" + name + "' command");
+}
+
+} // namespace
+
+Transaction::Transaction(EngineShardSet* shard_set_value, size_t num_shards_value, Connection* connection_value)
+    : shard_set(shard_set_value), num_shards(num_shards_value), connection(connection_value) {
+}
+
+Transaction::~Transaction() {
+	UnwatchAll();
+}
+
+bool Transaction::Handle(std::vector<NanoObj>& args, EngineShard* local_shard, std::string* response) {
+	const std::string name = CommandName(args);
+	if (EqualsIgnoreCase(name, "MULTI")) {
+		if (in_multi) {
+			*response = RESPParser::MakeError("MULTI calls can not be nested");
+		} else {
+			in_multi = true;
+			*response = RESPParser::OkResponse();
+		}
+		return true;
+	}
+	if (EqualsIgnoreCase(name, "EXEC")) {
+		*response = in_multi ? Exec(local_shard) : RESPParser::MakeError("EXEC without MULTI");
+		return true;
+	}
+	if (EqualsIgnoreCase(name, "DISCARD")) {
+		if (!in_multi) {
+			*response = RESPParser::MakeError("DISCARD without MULTI");
+		} else {
+			Reset();
+			UnwatchAll();
+			*response = RESPParser::OkResponse();
+		}
+		return true;
+	}
+	if (EqualsIgnoreCase(name, "WATCH")) {
+		*response = in_multi ? RESPParser::MakeError("WATCH inside MULTI is not allowed") : Watch(args);
+		return true;
+	}
+	if (EqualsIgnoreCase(name, "UNWATCH")) {
+		// 与 Redis 一致: MULTI 中的 UNWATCH 只入队, 不生效
+		if (in_multi) {
+			*response = kQueuedResponse;
+		} else {
+			UnwatchAll();
+			*response = RESPParser::OkResponse();
+		}
+		return true;
+	}
+	if (!in_multi) {
+		return false;
+	}
+	*response = Queue(args);
+	return true;
+}
+
+std::string Transaction::Queue(std::vector<NanoObj>& args) {
+	const std::string name = CommandName(args);
+	const CommandRegistry::CommandMeta* meta = CommandRegistry::Instance().FindMeta(name);
+	if (meta == nullptr) {
+		dirty = true;
+		return RESPParser::MakeError("unknown command '" + name + "'");
+	}
+	const auto argc = static_cast<int64_t>(args.size());
+	if ((meta->arity > 0 && argc != meta->arity) || (meta->arity < 0 && argc < -meta->arity)) {
+		dirty = true;
+		return WrongArity(name);
+	}
+
+	QueuedCommand command;
+	const bool has_keys = (meta->flags & CommandRegistry::kCmdFlagNoKey) == 0 && meta->first_key > 0 &&
+	                      static_cast<size_t>(meta->first_key) < args.size();
+	if (has_keys) {
+		const size_t first_key = static_cast<size_t>(meta->first_key);
+		const size_t last_key = CommandRegistry::LastKeyIndex(*meta, args);
+		const size_t step = meta->key_step > 0 ? static_cast<size_t>(meta->key_step) : 1;
+		command.shard = Shard(args[first_key], num_shards);
+		for (size_t i = first_key + step; i <= last_key && i < args.size(); i += step) {
+			if (Shard(args[i], num_shards) != command.shard) {
+				dirty = true;
+				return RESPParser::MakeError("CROSSSLOT Keys in request don't hash to the same slot");
+			}
+		}
+	}
+	// 逐个移动而不是整体移走 vector: 借用读缓冲区的参数在这里转为自有副本, 入队的命令要活过之后的读
+	command.args.reserve(args.size());
+	for (NanoObj& arg : args) {
+		command.args.push_back(std::move(arg));
+	}
+	queued.push_back(std::move(command));
+	return kQueuedResponse;
+}
+
+template <typename F>
+void Transaction::ForEachWatchShard(size_t begin, F&& func) {
+	std::vector<size_t> shard_ids;
+	for (size_t i = begin; i < watched.size(); ++i) {
+		if (std::find(shard_ids.begin(), shard_ids.end(), watched[i].shard) == shard_ids.end()) {
+			shard_ids.push_back(watched[i].shard);
+		}
+	}
+	EngineShard* local_shard = EngineShard::Tlocal();
+	for (size_t shard_id : shard_ids) {
+		if (local_shard != nullptr && (shard_set == nullptr || local_shard->ShardId() == shard_id)) {
+			func(shard_id, local_shard->GetDB().Watches());
+		} else if (shard_set != nullptr) {
+			shard_set->Await(shard_id, [&func, shard_id]() {
+				if (EngineShard* shard = EngineShard::Tlocal()) {
+					func(shard_id, shard->GetDB().Watches());
+				}
+			});
+		}
+	}
+}
+
+std::string Transaction::Watch(const std::vector<NanoObj>& args) {
+	if (args.size() < 2) {
+		return WrongArity("watch");
+	}
+	const size_t db_index = DBIndex();
+	const size_t begin = watched.size();
+	for (size_t i = 1; i < args.size(); ++i) {
+		WatchedKey watched_key;
+		watched_key.db_index = db_index;
+		watched_key.key = args[i].ToString();
+		watched_key.shard = Shard(watched_key.key, num_shards);
+		watched.push_back(std::move(watched_key));
+	}
+	ForEachWatchShard(begin, [this, begin](size_t shard_id, WatchRegistry& registry) {
+		for (size_t i = begin; i < watched.size(); ++i) {
+			if (watched[i].shard == shard_id) {
+				watched[i].version = registry.Watch(watched[i].db_index, watched[i].key);
+			}
+		}
+	});
+	return RESPParser::OkResponse();
+}
+
+void Transaction::Reset() {
+	in_multi = false;
+	dirty = false;
+	queued.clear();
+}
+
+void Transaction::UnwatchAll() {
+	if (watched.empty()) {
+		return;
+	}
+	ForEachWatchShard(0, [this](size_t shard_id, WatchRegistry& registry) {
+		for (const WatchedKey& watched_key : watched) {
+			if (watched_key.shard == shard_id) {
+				registry.Unwatch(watched_key.db_index, watched_key.key);
+			}
+		}
+	});
+	watched.clear();
+}
+
+bool Transaction::WatchedKeysUnchangedOn(size_t shard_id, const WatchRegistry& registry) const {
+	for (const WatchedKey& watched_key : watched) {
+		if (watched_key.shard == shard_id &&
+		    registry.Version(watched_key.db_index, watched_key.key) != watched_key.version) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Transaction::WatchedKeysUnchanged() {
+	bool unchanged = true;
+	ForEachWatchShard(0, [this, &unchanged](size_t shard_id, WatchRegistry& registry) {
+		unchanged = unchanged && WatchedKeysUnchangedOn(shard_id, registry);
+	});
+	return unchanged;
+}
+
+size_t Transaction::DBIndex() const {
+	return connection != nullptr ? connection->GetDBIndex() : 0;
+}
+
+std::string Transaction::Exec(EngineShard* local_shard) {
+	if (dirty) {
+		Reset();
+		UnwatchAll();
+		return "-EXECABORT Transaction discarded because of previous errors.\r\n";
+	}
+	in_multi = false;
+
+	std::vector<std::string> replies(queued.size());
+	bool watch_pending = !watched.empty();
+	bool watch_failed = false;
+	size_t begin = 0;
+	while (begin < queued.size() && !watch_failed) {
+		if (queued[begin].shard == kNoShard) {
+			// 无 key 命令在连接自己的 vCPU 上执行, 可以访问连接状态 (SELECT 等)
+			if (watch_pending && !WatchedKeysUnchanged()) {
+				watch_failed = true;
+				break;
+			}
+			watch_pending = false;
+			CommandContext ctx(local_shard, shard_set, num_shards, DBIndex(), connection);
+			replies[begin] = CommandRegistry::Instance().Execute(queued[begin].args, &ctx);
+			++begin;
+			continue;
+		}
+		size_t end = begin + 1;
+		while (end < queued.size() && queued[end].shard != kNoShard) {
+			++end;
+		}
+		watch_failed = !RunSegment(begin, end, local_shard, watch_pending, &replies);
+		watch_pending = false;
+		begin = end;
+	}
+	Reset();
+	UnwatchAll();
+	if (watch_failed) {
+		return kNullArrayResponse;
+	}
+
+	std::string response = RESPParser::MakeArray(static_cast<int64_t>(replies.size()));
+	for (const std::string& reply : replies) {
+		response += reply;
+	}
+	return response;
+}
+
+bool Transaction::RunSegment(size_t begin, size_t end, EngineShard* local_shard, bool check_watch,
+                             std::vector<std::string>* replies) {
+	const size_t db_index = DBIndex();
+	std::vector<size_t> shard_ids;
+	std::vector<std::vector<size_t>> commands(num_shards > 0 ? num_shards : 1);
+	for (size_t i = begin; i < end; ++i) {
+		const size_t shard_id = queued[i].shard;
+		if (commands[shard_id].empty()) {
+			shard_ids.push_back(shard_id);
+		}
+		commands[shard_id].push_back(i);
+	}
+	// 被 WATCH 的 key 的版本要在其所在分片上、与本段一起冻结后检查, 这些分片没有命令也加入本段
+	if (check_watch) {
+		for (const WatchedKey& watched_key : watched) {
+			if (std::find(shard_ids.begin(), shard_ids.end(), watched_key.shard) == shard_ids.end()) {
+				shard_ids.push_back(watched_key.shard);
+			}
+		}
+	}
+
+	// 在 shard 上按顺序执行本段落在该分片的命令; 整个过程不会让出 CPU, 对该分片是原子的
+	auto run_on_shard = [this, &commands, replies, db_index](EngineShard* shard, size_t shard_id,
+	                                                         Connection* conn) {
+		for (size_t i : commands[shard_id]) {
+			CommandContext ctx(shard, shard_set, num_shards, db_index, conn);
+			(*replies)[i] = CommandRegistry::Instance().Execute(queued[i].args, &ctx);
+		}
+	};
+
+	if (shard_ids.size() > 1 && shard_set != nullptr) {
+		std::sort(shard_ids.begin(), shard_ids.end());
+		return RunFrozenSegment(shard_ids, commands, db_index, check_watch, replies);
+	}
+
+	// 单分片快速路径
+	const size_t shard_id = shard_ids[0];
+	if (shard_set == nullptr || (local_shard != nullptr && local_shard->ShardId() == shard_id)) {
+		if (local_shard != nullptr) {
+			local_shard->WaitUntilUnfrozen();
+		}
+		if (check_watch && local_shard != nullptr &&
+		    !WatchedKeysUnchangedOn(shard_id, local_shard->GetDB().Watches())) {
+			return false;
+		}
+		run_on_shard(local_shard, shard_id, connection);
+		return true;
+	}
+	return shard_set->Await(shard_id, [this, &run_on_shard, shard_id, check_watch]() -> bool {
+		if (check_watch && !WatchedKeysUnchangedOn(shard_id, EngineShard::Tlocal()->GetDB().Watches())) {
+			return false;
+		}
+		run_on_shard(EngineShard::Tlocal(), shard_id, nullptr);
+		return true;
+	});
+}
+
+bool Transaction::RunFrozenSegment(const std::vector<size_t>& shard_ids,
+                                   const std::vector<std::vector<size_t>>& commands, size_t db_index,
+                                   bool check_watch, std::vector<std::string>* replies) {
+	photon::semaphore arrived(0);
+	photon::semaphore go(0);
+	photon::semaphore done(0);
+	bool abort = false;
+	std::atomic<bool> watch_changed {false};
+
+	// 每个分片上的事务任务: 冻结分片 -> 检查本分片上被 WATCH 的 key -> 通知已到达 -> 等待协调者放行 ->
+	// 执行本分片的命令 -> 解冻。冻结之后本分片上的 key 不会再被写入, 各分片各自检查即可。
+	// 等待期间任务队列被占住, 其他连接发往该分片的请求排在后面
+	auto freeze_task = [this, &commands, replies, db_index, &arrived, &go, &done, &abort, &watch_changed,
+	                    check_watch](size_t shard_id) {
+		EngineShard* shard = EngineShard::Tlocal();
+		shard->Freeze();
+		if (check_watch && !WatchedKeysUnchangedOn(shard_id, shard->GetDB().Watches())) {
+			watch_changed.store(true, std::memory_order_relaxed);
+		}
+		arrived.signal(1);
+		go.wait(1);
+		if (!abort) {
+			shard->SetTransactionRunning(true);
+			for (size_t i : commands[shard_id]) {
+				CommandContext ctx(shard, shard_set, num_shards, db_index, nullptr);
+				(*replies)[i] = CommandRegistry::Instance().Execute(queued[i].args, &ctx);
+			}
+			shard->SetTransactionRunning(false);
+		}
+		shard->Unfreeze();
+		done.signal(1);
+	};
+
+	// 按分片号升序逐个加锁, 拿到前一个分片后再申请下一个
+	uint64_t frozen = 0;
+	for (size_t shard_id : shard_ids) {
+		if (!shard_set->GetShard(shard_id)->GetTaskQueue()->Add([&freeze_task, shard_id]() { freeze_task(shard_id); })) {
+			abort = true;
+			break;
+		}
+		arrived.wait(1);
+		++frozen;
+	}
+
+	if (watch_changed.load(std::memory_order_relaxed)) {
+		abort = true;
+	}
+	// 任务队列关闭 (停机) 时也按放弃处理, 已冻结的分片照常解冻
+	const bool executed = !abort;
+	go.signal(frozen);
+	done.wait(frozen);
+	return executed;
+}
@@ -5,6 +5,7 @@
 #include <photon/common/alog.h>
 #include <netinet/tcp.h>
 
+#include "core/memory_budget.h"
 #include "server/sharded_server.h"
 
 DEFINE_int32(port, 9527, "Server listen port");
@@ -14,8 +15,20 @@ DEFINE_bool(tcp_nodelay, true,
 DEFINE_bool(use_iouring_tcp_server, true,
             "Use Photon io_uring TCP server implementation (fallback to syscall-based server if unavailable)");
 
+DEFINE_bool(migrate_connections, true,
+            "Move a connection to the vCPU owning the shard that most of its keys map to");
+
 DEFINE_uint64(photon_handler_stack_kb, 256,
-              "Photon per-connection handler fiber stack size in KB (default Photon is 8192KB)");
+              "Photon per-connection handler fiber stack size in KB (default Photon is 8192KB); "
+              "lowered to 64KB when --release_idle_buffers is on and this flag is not set");
+DEFINE_bool(release_idle_buffers, true,
+            "Return an idle connection's read/write buffers to a per-vCPU pool while it waits for input");
+
+DEFINE_uint64(maxmemory, 0,
+              "Memory limit in bytes for the whole process; each shard evicts against maxmemory / num_shards "
+              "(0 = unlimited)");
+DEFINE_string(maxmemory_policy, "noeviction",
+              "Eviction policy when over maxmemory: noeviction, allkeys-lru, allkeys-lfu, volatile-lru, volatile-ttl");
 
 // NOLINTNEXTLINE(readability-identifier-naming)
 extern "C" uint64_t nano_redis_photon_handler_stack_size() {
@@ -24,6 +37,10 @@ extern "C" uint64_t nano_redis_photon_handler_stack_size() {
 
 namespace {
 
+// 空闲连接已经交还读写缓冲区时, fiber 栈是每个连接剩下的最大一块; 处理函数的调用深度很浅,
+// 未显式指定栈大小时改用较小的栈
+constexpr uint64_t kIdleReleaseHandlerStackKb = 64;
+
 std::unique_ptr<ShardedServer> sharded_server;
 
 void HandleNull(int) {
@@ -41,6 +58,16 @@ void HandleTerm(int signum) {
 int main(int argc, char** argv) {
 	gflags::ParseCommandLineFlags(&argc, &argv, true);
 	set_log_output_level(ALOG_INFO);
+	if (FLAGS_release_idle_buffers && gflags::GetCommandLineFlagInfoOrDie("photon_handler_stack_kb").is_default) {
+		FLAGS_photon_handler_stack_kb = kIdleReleaseHandlerStackKb;
+	}
+
+	const auto eviction_policy = ParseEvictionPolicy(FLAGS_maxmemory_policy);
+	if (!eviction_policy.has_value()) {
+		LOG_ERROR_RETURN(0, -1, "Invalid --maxmemory_policy `", FLAGS_maxmemory_policy.c_str());
+	}
+	MemoryBudget::SetMaxMemory(FLAGS_maxmemory);
+	MemoryBudget::SetPolicy(*eviction_policy);
 
 	photon::PhotonOptions photon_options;
 	photon_options.use_pooled_stack_allocator = true;
@@ -66,6 +93,7 @@ int main(int argc, char** argv) {
 	photon::sync_signal(SIGINT, &HandleTerm);
 
 	const size_t shard_count = FLAGS_num_shards > 0 ? static_cast<size_t>(FLAGS_num_shards) : 1;
+	MemoryBudget::SetNumShards(shard_count);
 	if (shard_count == 1) {
 		LOG_INFO("Starting in unified server mode with single shard");
 	} else {
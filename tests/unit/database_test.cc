@@ -1,9 +1,11 @@
 #include <gtest/gtest.h>
 #include <cstdint>
+#include <deque>
 #include <chrono>
 #include <string>
 #include <set>
 #include <thread>
+#include <vector>
 #include "core/database.h"
 #include "core/nano_obj.h"
 
@@ -210,6 +212,139 @@ TEST_F(DatabaseTest, KeysEmpty) {
 	EXPECT_EQ(keys.size(), 0);
 }
 
+TEST_F(DatabaseTest, ScanReturnsAllKeysAcrossCalls) {
+	for (int i = 0; i < 1000; ++i) {
+		db.Set(NanoObj::FromKey("key" + std::to_string(i)), "v");
+	}
+
+	std::set<std::string> seen;
+	uint64_t cursor = 0;
+	do {
+		std::vector<std::string> batch;
+		cursor = db.Scan(cursor, 50, &batch);
+		seen.insert(batch.begin(), batch.end());
+	} while (cursor != 0);
+
+	EXPECT_EQ(seen.size(), 1000U);
+	EXPECT_EQ(seen.count("key0"), 1U);
+	EXPECT_EQ(seen.count("key999"), 1U);
+}
+
+TEST_F(DatabaseTest, BatchLookupAndDelete) {
+	std::vector<NanoObj> keys;
+	for (int i = 0; i < 40; ++i) {
+		keys.push_back(NanoObj::FromKey("key" + std::to_string(i)));
+	}
+	for (int i = 0; i < 40; i += 2) {
+		db.Set(keys[i], "v" + std::to_string(i));
+	}
+	ASSERT_TRUE(db.Expire(keys[2], 1));
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	// key0 出现两次, DEL 只应计数一次
+	keys.push_back(NanoObj::FromKey("key0"));
+	std::vector<const NanoObj*> ptrs;
+	std::vector<uint64_t> hashes;
+	for (const auto& key : keys) {
+		ptrs.push_back(&key);
+		hashes.push_back(Database::Table::Hash(key));
+	}
+
+	std::vector<const NanoObj*> found(keys.size());
+	db.FindBatch(keys.size(), ptrs.data(), hashes.data(), found.data());
+	for (int i = 0; i < 40; ++i) {
+		if (i % 2 == 0 && i != 2) {
+			ASSERT_NE(found[i], nullptr) << "key" << i;
+			EXPECT_EQ(found[i]->ToString(), "v" + std::to_string(i));
+		} else {
+			EXPECT_EQ(found[i], nullptr) << "key" << i;
+		}
+	}
+	EXPECT_NE(found[40], nullptr);
+
+	EXPECT_EQ(db.DelBatch(keys.size(), ptrs.data(), hashes.data()), 19U);
+	EXPECT_EQ(db.KeyCount(), 0U);
+}
+
+TEST_F(DatabaseTest, SetBatchOverwritesAndClearsTTL) {
+	db.Set(NanoObj::FromKey("a"), "old");
+	ASSERT_TRUE(db.Expire(NanoObj::FromKey("a"), 10000));
+
+	const std::vector<NanoObj> keys = {NanoObj::FromKey("a"), NanoObj::FromKey("b")};
+	const std::vector<NanoObj> values = {NanoObj::FromKey("1"), NanoObj::FromKey("2")};
+	std::vector<const NanoObj*> key_ptrs;
+	std::vector<const NanoObj*> value_ptrs;
+	std::vector<uint64_t> hashes;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		key_ptrs.push_back(&keys[i]);
+		value_ptrs.push_back(&values[i]);
+		hashes.push_back(Database::Table::Hash(keys[i]));
+	}
+	db.SetBatch(keys.size(), key_ptrs.data(), hashes.data(), value_ptrs.data());
+
+	EXPECT_EQ(db.Get(keys[0]), "1");
+	EXPECT_EQ(db.Get(keys[1]), "2");
+	EXPECT_EQ(db.TTL(keys[0]), -1);
+	EXPECT_EQ(db.GetKeyspaceStats(0).expires, 0U);
+}
+
+TEST_F(DatabaseTest, RandomKeySkipsExpired) {
+	EXPECT_FALSE(db.RandomKey().has_value());
+
+	db.Set(NanoObj::FromKey("live"), "v");
+	db.Set(NanoObj::FromKey("gone"), "v");
+	ASSERT_TRUE(db.Expire(NanoObj::FromKey("gone"), 1));
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	for (int i = 0; i < 20; ++i) {
+		EXPECT_EQ(db.RandomKey(), std::optional<std::string> {"live"});
+	}
+}
+
+TEST_F(DatabaseTest, RandomKeyFindsLiveKeyAmongManyExpired) {
+	// 远多于旧的 16 次采样上限的过期 key, 仍要找到唯一活着的 key
+	for (int i = 0; i < 500; ++i) {
+		const NanoObj key = NanoObj::FromKey("gone" + std::to_string(i));
+		db.Set(key, "v");
+		ASSERT_TRUE(db.Expire(key, 1));
+	}
+	db.Set(NanoObj::FromKey("live"), "v");
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	EXPECT_EQ(db.RandomKey(), std::optional<std::string> {"live"});
+	EXPECT_EQ(db.RandomKey(), std::optional<std::string> {"live"});
+}
+
+TEST_F(DatabaseTest, KeyspaceStatsTrackExpires) {
+	EXPECT_EQ(db.GetKeyspaceStats(0).keys, 0U);
+
+	db.Set(NanoObj::FromKey("a"), "v");
+	db.Set(NanoObj::FromKey("b"), "v");
+	db.Set(NanoObj::FromKey("c"), "v");
+	ASSERT_TRUE(db.Expire(NanoObj::FromKey("a"), 10000));
+	ASSERT_TRUE(db.Expire(NanoObj::FromKey("b"), 30000));
+
+	KeyspaceStats stats = db.GetKeyspaceStats(0);
+	EXPECT_EQ(stats.keys, 3U);
+	EXPECT_EQ(stats.expires, 2U);
+	EXPECT_GT(stats.avg_ttl_ms, 19000);
+	EXPECT_LE(stats.avg_ttl_ms, 20000);
+
+	// 改 TTL、PERSIST、删除都要同步计数器
+	ASSERT_TRUE(db.Expire(NanoObj::FromKey("a"), 50000));
+	stats = db.GetKeyspaceStats(0);
+	EXPECT_EQ(stats.expires, 2U);
+	EXPECT_GT(stats.avg_ttl_ms, 39000);
+
+	ASSERT_TRUE(db.Persist(NanoObj::FromKey("b")));
+	ASSERT_TRUE(db.Del(NanoObj::FromKey("a")));
+	stats = db.GetKeyspaceStats(0);
+	EXPECT_EQ(stats.keys, 2U);
+	EXPECT_EQ(stats.expires, 0U);
+	EXPECT_EQ(stats.avg_ttl_ms, 0);
+	EXPECT_EQ(db.GetKeyspaceStats(1).keys, 0U);
+}
+
 TEST_F(DatabaseTest, ExpireAndTTL) {
 	const NanoObj key = NanoObj::FromKey("ttl_key");
 	db.Set(key, "value");
@@ -260,3 +395,241 @@ TEST_F(DatabaseTest, ActiveExpireCycleRemovesExpiredKeys) {
 	db.Select(1);
 	EXPECT_FALSE(db.Exists(key1));
 }
+
+TEST_F(DatabaseTest, ActiveExpireCycleReclaimsOnlyDueKeys) {
+	for (int i = 0; i < 500; ++i) {
+		const NanoObj key = NanoObj::FromKey("short" + std::to_string(i));
+		db.Set(key, "v");
+		ASSERT_TRUE(db.Expire(key, 200));
+	}
+	for (int i = 0; i < 500; ++i) {
+		const NanoObj key = NanoObj::FromKey("long" + std::to_string(i));
+		db.Set(key, "v");
+		ASSERT_TRUE(db.Expire(key, 100000));
+	}
+	// 延长 TTL 和 PERSIST 后, 索引里的旧条目不能删掉 key
+	ASSERT_TRUE(db.Expire(NanoObj::FromKey("short0"), 100000));
+	ASSERT_TRUE(db.Persist(NanoObj::FromKey("short1")));
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+	ExpireCycleStats stats;
+	EXPECT_EQ(db.ActiveExpireCycle(100, &stats), 100U);
+	EXPECT_TRUE(stats.more_due);
+	EXPECT_EQ(stats.sampled, 100U);
+
+	size_t total = 100;
+	for (int round = 0; round < 10; ++round) {
+		total += db.ActiveExpireCycle(100);
+	}
+	EXPECT_EQ(total, 498U);
+	EXPECT_EQ(db.KeyCount(), 502U);
+	EXPECT_TRUE(db.Exists(NanoObj::FromKey("short0")));
+	EXPECT_TRUE(db.Exists(NanoObj::FromKey("short1")));
+}
+
+TEST_F(DatabaseTest, ExpireIndexDropsEntriesOnTTLChangeAndDelete) {
+	for (int i = 0; i < 300; ++i) {
+		const NanoObj key = NanoObj::FromKey("idx" + std::to_string(i));
+		db.Set(key, "v");
+		ASSERT_TRUE(db.Expire(key, 50));
+	}
+	// 反复刷新 TTL 不应留下旧条目
+	for (int round = 0; round < 10; ++round) {
+		for (int i = 0; i < 100; ++i) {
+			ASSERT_TRUE(db.Expire(NanoObj::FromKey("idx" + std::to_string(i)), 100000 + round));
+		}
+	}
+	for (int i = 100; i < 200; ++i) {
+		ASSERT_TRUE(db.Persist(NanoObj::FromKey("idx" + std::to_string(i))));
+	}
+	for (int i = 200; i < 300; ++i) {
+		ASSERT_TRUE(db.Del(NanoObj::FromKey("idx" + std::to_string(i))));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	// 没有 key 到期, 主动过期一个条目都取不到
+	ExpireCycleStats stats;
+	EXPECT_EQ(db.ActiveExpireCycle(1000, &stats), 0U);
+	EXPECT_EQ(stats.sampled, 0U);
+	EXPECT_FALSE(stats.more_due);
+	EXPECT_EQ(db.KeyCount(), 200U);
+}
+
+TEST_F(DatabaseTest, SetAppliesTtlModeInPlace) {
+	const NanoObj key = NanoObj::FromKey("ttl_mode");
+	const uint64_t hash = Database::Table::Hash(key);
+	db.Set(key, hash, NanoObj::FromString("v1"), Database::SetTtl::kSet, 100000);
+	EXPECT_GT(db.TTL(key), 0);
+	EXPECT_EQ(db.GetKeyspaceStats(0).expires, 1U);
+
+	db.Set(key, hash, NanoObj::FromString("v2"), Database::SetTtl::kKeep);
+	EXPECT_GT(db.TTL(key), 0);
+	db.Set(key, hash, NanoObj::FromString("v3"), Database::SetTtl::kSet, 200000);
+	EXPECT_GT(db.TTL(key), 100);
+	EXPECT_EQ(db.GetKeyspaceStats(0).expires, 1U);
+
+	db.Set(key, hash, NanoObj::FromString("v4"), Database::SetTtl::kClear);
+	EXPECT_EQ(db.Get(key), "v4");
+	EXPECT_EQ(db.TTL(key), -1);
+	EXPECT_EQ(db.GetKeyspaceStats(0).expires, 0U);
+}
+
+TEST_F(DatabaseTest, OverwriteKeepsTTLUntilPersist) {
+	const NanoObj key = NanoObj::FromKey("ttl_keep");
+	db.Set(key, "v1");
+	EXPECT_TRUE(db.Expire(key, 100000));
+
+	db.Set(key, "v2");
+	EXPECT_EQ(db.Get(key), "v2");
+	EXPECT_GE(db.TTL(key), 0);
+	EXPECT_TRUE(db.Find(key)->HasExpire());
+
+	EXPECT_TRUE(db.Persist(key));
+	EXPECT_EQ(db.TTL(key), -1);
+	EXPECT_FALSE(db.Find(key)->HasExpire());
+}
+
+TEST_F(DatabaseTest, ExpiredKeyIsReplacedWithoutTTL) {
+	const NanoObj key = NanoObj::FromKey("ttl_stale");
+	db.Set(key, "old");
+	EXPECT_TRUE(db.Expire(key, 1));
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	db.Set(key, "new");
+	EXPECT_EQ(db.Get(key), "new");
+	EXPECT_EQ(db.TTL(key), -1);
+	EXPECT_EQ(db.KeyCount(), 1U);
+	EXPECT_EQ(db.ActiveExpireCycle(64), 0U);
+}
+
+TEST_F(DatabaseTest, EvictionPoliciesChooseSampledVictims) {
+	EXPECT_FALSE(db.EvictOne(EvictionPolicy::kVolatileLru));
+	for (int i = 0; i < 20; ++i) {
+		db.Set(NanoObj::FromKey("plain" + std::to_string(i)), "v");
+	}
+	// 没有带 TTL 的 key 时 volatile 策略无可淘汰
+	EXPECT_FALSE(db.EvictOne(EvictionPolicy::kVolatileTtl));
+	EXPECT_FALSE(db.EvictOne(EvictionPolicy::kNoEviction));
+	ASSERT_TRUE(db.EvictOne(EvictionPolicy::kAllKeysLru));
+	EXPECT_EQ(db.KeyCount(), 19U);
+	db.ClearCurrentDB();
+
+	// volatile-ttl 每次淘汰采样中截止时间最近的: 淘汰四分之三后, 截止时间最近的一批几乎不剩
+	for (int i = 0; i < 200; ++i) {
+		const NanoObj key = NanoObj::FromKey("ttl" + std::to_string(i));
+		db.Set(key, "v");
+		ASSERT_TRUE(db.Expire(key, 100000 + i * 1000));
+	}
+	for (int i = 0; i < 150; ++i) {
+		ASSERT_TRUE(db.EvictOne(EvictionPolicy::kVolatileTtl));
+	}
+	EXPECT_EQ(db.GetKeyspaceStats(0).expires, 50U);
+	size_t near_survivors = 0;
+	for (int i = 0; i < 50; ++i) {
+		near_survivors += db.Exists(NanoObj::FromKey("ttl" + std::to_string(i))) ? 1 : 0;
+	}
+	EXPECT_LE(near_survivors, 5U);
+}
+
+TEST_F(DatabaseTest, AllKeysLfuKeepsHotKey) {
+	MemoryBudget::SetPolicy(EvictionPolicy::kAllKeysLfu);
+	const NanoObj hot = NanoObj::FromKey("hot");
+	db.Set(hot, "v");
+	for (int i = 0; i < 50; ++i) {
+		db.Set(NanoObj::FromKey("cold" + std::to_string(i)), "v");
+	}
+	for (int i = 0; i < 200; ++i) {
+		(void)db.Get(hot);
+	}
+
+	for (int i = 0; i < 40; ++i) {
+		ASSERT_TRUE(db.EvictOne(EvictionPolicy::kAllKeysLfu));
+	}
+	EXPECT_EQ(db.KeyCount(), 11U);
+	EXPECT_TRUE(db.Exists(hot));
+	MemoryBudget::SetPolicy(EvictionPolicy::kNoEviction);
+}
+
+TEST_F(DatabaseTest, ChargesMemoryEstimateOnWriteAndDelete) {
+	MemoryBudget::Calibrate();
+	const uint64_t before = MemoryBudget::UsedMemory();
+	const NanoObj key = NanoObj::FromKey("big");
+	db.Set(key, std::string(4096, 'x'));
+	EXPECT_GE(MemoryBudget::UsedMemory(), before + 4096);
+	// 覆盖写只记新旧值的差
+	db.Set(key, std::string(1024, 'y'));
+	EXPECT_GE(MemoryBudget::UsedMemory(), before + 1024);
+	EXPECT_LT(MemoryBudget::UsedMemory(), before + 4096);
+	EXPECT_TRUE(db.Del(key));
+	EXPECT_EQ(MemoryBudget::UsedMemory(), before);
+
+	db.Set(key, std::string(4096, 'x'));
+	db.ClearCurrentDB();
+	EXPECT_EQ(MemoryBudget::UsedMemory(), before);
+}
+
+TEST_F(DatabaseTest, UnlinkDefersLargeObjectsToLazyFree) {
+	auto* items = new std::deque<NanoObj>();
+	NanoObj list = NanoObj::FromList();
+	list.SetObj(items);
+	for (int i = 0; i < 1000; ++i) {
+		items->push_back(NanoObj::FromKey("item" + std::to_string(i)));
+	}
+	const NanoObj big = NanoObj::FromKey("big");
+	const NanoObj small = NanoObj::FromKey("small");
+	db.Set(big, std::move(list));
+	db.Set(small, "v");
+	ASSERT_TRUE(db.Expire(big, 100000));
+
+	const NanoObj* keys[] = {&big, &small};
+	const uint64_t hashes[] = {Database::Table::Hash(big), Database::Table::Hash(small)};
+	EXPECT_EQ(db.UnlinkBatch(2, keys, hashes), 2U);
+	EXPECT_FALSE(db.Exists(big));
+	EXPECT_EQ(db.KeyCount(), 0U);
+	EXPECT_EQ(db.GetKeyspaceStats(0).expires, 0U);
+
+	// 只有大对象进入队列, 按批释放
+	ASSERT_TRUE(db.HasPendingLazyFree());
+	size_t steps = 0;
+	while (db.LazyFreeStep(100)) {
+		++steps;
+	}
+	EXPECT_GE(steps, 9U);
+	EXPECT_FALSE(db.HasPendingLazyFree());
+}
+
+TEST_F(DatabaseTest, ClearAsyncSwapsTablesAndFreesInBackground) {
+	for (int i = 0; i < 2000; ++i) {
+		const NanoObj key = NanoObj::FromKey("key" + std::to_string(i));
+		db.Set(key, "v");
+		if (i % 2 == 0) {
+			ASSERT_TRUE(db.Expire(key, 100000));
+		}
+	}
+	db.Select(1);
+	db.Set(NanoObj::FromKey("other"), "v");
+
+	db.Select(0);
+	db.ClearCurrentDBAsync();
+	EXPECT_EQ(db.KeyCount(), 0U);
+	EXPECT_EQ(db.GetKeyspaceStats(0).expires, 0U);
+	EXPECT_FALSE(db.Exists(NanoObj::FromKey("key1")));
+	db.Set(NanoObj::FromKey("key1"), "new");
+	EXPECT_EQ(db.Get(NanoObj::FromKey("key1")), "new");
+	EXPECT_EQ(db.GetKeyspaceStats(1).keys, 1U);
+
+	ASSERT_TRUE(db.HasPendingLazyFree());
+	size_t steps = 0;
+	while (db.LazyFreeStep(256)) {
+		++steps;
+	}
+	EXPECT_GE(steps, 3U);
+	EXPECT_EQ(db.Get(NanoObj::FromKey("key1")), "new");
+
+	db.ClearAllAsync();
+	EXPECT_EQ(db.GetKeyspaceStats(1).keys, 0U);
+	while (db.LazyFreeStep(256)) {
+	}
+	EXPECT_EQ(db.KeyCount(), 0U);
+	EXPECT_EQ(db.ActiveExpireCycle(64), 0U);
+}
@@ -141,6 +141,26 @@ TEST_F(HashFamilyTest, HGetAll) {
 	EXPECT_TRUE(result.find("value2") != std::string::npos);
 }
 
+TEST_F(HashFamilyTest, HGetAllWritesIntoReplyBuffer) {
+	CommandContext ctx(db.get(), 0);
+
+	std::vector<NanoObj> args = {NanoObj::FromKey("HSET"), NanoObj::FromKey("myhash"), NanoObj::FromKey("field1"),
+	                             NanoObj::FromKey("value1")};
+	HashFamily::HSet(args, &ctx);
+
+	// 设置了连接缓冲区时回复直接追加在已有回复之后, 返回空串
+	std::string reply_buffer = "+OK\r\n";
+	ctx.reply_buffer = &reply_buffer;
+	args = {NanoObj::FromKey("HGETALL"), NanoObj::FromKey("myhash")};
+	EXPECT_EQ(HashFamily::HGetAll(args, &ctx), "");
+	EXPECT_EQ(reply_buffer, "+OK\r\n*2\r\n$6\r\nfield1\r\n$6\r\nvalue1\r\n");
+
+	// 错误在写缓冲区之前返回
+	args = {NanoObj::FromKey("HGETALL")};
+	EXPECT_EQ(HashFamily::HGetAll(args, &ctx).rfind("-ERR", 0), 0U);
+	EXPECT_EQ(reply_buffer.size(), 33U);
+}
+
 TEST_F(HashFamilyTest, HIncrBy) {
 	CommandContext ctx(db.get(), 0);
 
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <cstdint>
+#include <random>
 #include <string>
 #include <vector>
 #include "core/dashtable.h"
@@ -420,3 +421,278 @@ TEST_F(DashTableTest, RehashAfterChainedNodes) {
 		EXPECT_EQ(*table.Find(key), key);
 	}
 }
+
+TEST_F(DashTableTest, EraseReinsertAcrossSplits) {
+	DashTable<int, int> table(1, 2);
+	for (int i = 0; i < 5000; ++i) {
+		table.Insert(i, i * 2);
+	}
+	for (int i = 0; i < 5000; i += 2) {
+		EXPECT_TRUE(table.Erase(i));
+	}
+	for (int i = 0; i < 5000; i += 2) {
+		table.Insert(i, -i);
+	}
+
+	EXPECT_EQ(table.Size(), 5000U);
+	EXPECT_TRUE(table.IsDirectoryConsistent());
+	for (int i = 0; i < 5000; ++i) {
+		const int* value = table.Find(i);
+		ASSERT_NE(value, nullptr);
+		EXPECT_EQ(*value, (i % 2 == 0) ? -i : i * 2);
+	}
+
+	size_t visited = 0;
+	table.ForEach([&visited](const int&, const int&) { ++visited; });
+	EXPECT_EQ(visited, 5000U);
+}
+
+TEST_F(DashTableTest, IncrementalSplitKeepsEntriesVisible) {
+	DashTable<int, int> table(1, 2);
+	bool saw_migration = false;
+	for (int i = 0; i < 2000; ++i) {
+		table.Insert(i, i);
+		saw_migration |= table.IsMigrating();
+		if (i % 97 == 0) {
+			for (int j = 0; j <= i; ++j) {
+				const int* value = table.Find(j);
+				ASSERT_NE(value, nullptr) << "key " << j << " lost at insert " << i;
+				EXPECT_EQ(*value, j);
+			}
+		}
+	}
+	EXPECT_TRUE(saw_migration);
+
+	while (table.MigrateStep(1)) {
+	}
+	EXPECT_FALSE(table.IsMigrating());
+	EXPECT_EQ(table.Size(), 2000U);
+	for (int i = 0; i < 2000; ++i) {
+		EXPECT_TRUE(table.Erase(i));
+	}
+	EXPECT_EQ(table.Size(), 0U);
+}
+
+TEST_F(DashTableTest, SynchronousSplitMode) {
+	DashTable<int, int> table(1, 2);
+	table.SetIncrementalSplit(false);
+	for (int i = 0; i < 1000; ++i) {
+		table.Insert(i, i);
+		EXPECT_FALSE(table.IsMigrating());
+	}
+	EXPECT_EQ(table.Size(), 1000U);
+	EXPECT_TRUE(table.IsDirectoryConsistent());
+}
+
+TEST_F(DashTableTest, EraseMergesSegmentsAndShrinksDirectory) {
+	DashTable<int, int> table(1, 2);
+	for (int i = 0; i < 5000; ++i) {
+		table.Insert(i, i);
+	}
+	EXPECT_GT(table.GetGlobalDepth(), 0);
+
+	for (int i = 0; i < 5000; ++i) {
+		ASSERT_TRUE(table.Erase(i)) << "key " << i;
+		if (i % 211 == 0) {
+			for (int j = i + 1; j < 5000; j += 37) {
+				ASSERT_NE(table.Find(j), nullptr) << "key " << j << " lost at erase " << i;
+			}
+		}
+	}
+	EXPECT_EQ(table.Size(), 0U);
+	EXPECT_EQ(table.GetGlobalDepth(), 0);
+	EXPECT_EQ(table.DirSize(), 1U);
+	EXPECT_TRUE(table.IsDirectoryConsistent());
+
+	table.Insert(7, 7);
+	ASSERT_NE(table.Find(7), nullptr);
+	EXPECT_EQ(*table.Find(7), 7);
+}
+
+TEST_F(DashTableTest, ClearReleasesSegments) {
+	DashTable<int, int> table(2, 2);
+	for (int i = 0; i < 3000; ++i) {
+		table.Insert(i, i);
+	}
+	EXPECT_GT(table.DirSize(), 2U);
+
+	table.Clear();
+	EXPECT_EQ(table.Size(), 0U);
+	EXPECT_EQ(table.DirSize(), 2U);
+	EXPECT_EQ(table.GetGlobalDepth(), 1);
+	EXPECT_FALSE(table.IsMigrating());
+	EXPECT_TRUE(table.IsDirectoryConsistent());
+
+	for (int i = 0; i < 100; ++i) {
+		table.Insert(i, i);
+	}
+	EXPECT_EQ(table.Size(), 100U);
+}
+
+TEST_F(DashTableTest, ScanVisitsEveryKeyInBoundedSteps) {
+	DashTable<int, int> table(1, 4);
+	for (int i = 0; i < 3000; ++i) {
+		table.Insert(i, i);
+	}
+
+	// 以 home bucket 为单位返回, 最后一个 bucket 可能让本批超出 count
+	const size_t kMaxBatch = 10 + (2 + DashTable<int, int>::kStashBucketCount) * DashTable<int, int>::kSlotsPerBucket;
+	std::vector<int> seen(3000, 0);
+	uint64_t cursor = 0;
+	size_t calls = 0;
+	do {
+		size_t batch = 0;
+		cursor = table.Scan(cursor, 10, [&](const int& key, const int& value) {
+			EXPECT_EQ(key, value);
+			++seen[key];
+			++batch;
+		});
+		EXPECT_LE(batch, kMaxBatch);
+		++calls;
+	} while (cursor != 0);
+
+	EXPECT_GT(calls, 100U);
+	for (int i = 0; i < 3000; ++i) {
+		EXPECT_EQ(seen[i], 1) << "key " << i;
+	}
+}
+
+TEST_F(DashTableTest, ScanSurvivesSplitsAndMerges) {
+	DashTable<int, int> table(1, 2);
+	for (int i = 0; i < 500; ++i) {
+		table.Insert(i, i);
+	}
+
+	std::vector<int> seen(500, 0);
+	uint64_t cursor = 0;
+	int next_insert = 500;
+	int next_erase = 10000;
+	bool grow = true;
+	do {
+		cursor = table.Scan(cursor, 8, [&](const int& key, const int&) {
+			if (key < 500) {
+				++seen[key];
+			}
+		});
+		// 在两次调用之间触发分裂, 之后再删掉新增的 key 触发合并
+		for (int i = 0; i < 40; ++i) {
+			if (grow) {
+				table.Insert(next_insert, next_insert);
+				++next_insert;
+			} else if (next_erase < next_insert) {
+				EXPECT_TRUE(table.Erase(next_erase));
+				++next_erase;
+			}
+		}
+		if (grow && next_insert >= 6000) {
+			grow = false;
+			next_erase = 500;
+		}
+	} while (cursor != 0);
+
+	for (int i = 0; i < 500; ++i) {
+		EXPECT_GE(seen[i], 1) << "key " << i;
+	}
+}
+
+TEST_F(DashTableTest, ScanReturnsStableKeysAcrossMergeMidScan) {
+	// 游标停在不同位置时删掉填充 key 触发合并, 一直存在的 key 都必须返回
+	for (int steps = 1; steps <= 60; ++steps) {
+		DashTable<int, int> table(1, 2);
+		for (int i = 0; i < 200; ++i) {
+			table.Insert(i, i);
+		}
+		for (int i = 1000; i < 4000; ++i) {
+			table.Insert(i, i);
+		}
+		const uint64_t segments_before = table.SegmentCount();
+
+		std::vector<int> seen(200, 0);
+		auto record = [&seen](const int& key, const int&) {
+			if (key < 200) {
+				++seen[key];
+			}
+		};
+		uint64_t cursor = 0;
+		for (int i = 0; i < steps && (i == 0 || cursor != 0); ++i) {
+			cursor = table.Scan(cursor, 16, record);
+		}
+		for (int i = 1000; i < 4000; ++i) {
+			ASSERT_TRUE(table.Erase(i));
+		}
+		ASSERT_LT(table.SegmentCount(), segments_before);
+		while (cursor != 0) {
+			cursor = table.Scan(cursor, 16, record);
+		}
+		for (int i = 0; i < 200; ++i) {
+			EXPECT_GE(seen[i], 1) << "steps " << steps << " key " << i;
+		}
+	}
+}
+
+TEST_F(DashTableTest, FindBatchAndEraseBatch) {
+	DashTable<int, int> table(1, 2);
+	for (int i = 0; i < 1000; i += 2) {
+		table.Insert(i, i * 10);
+	}
+
+	std::vector<int> keys;
+	for (int i = 0; i < 1000; ++i) {
+		keys.push_back(i);
+	}
+	std::vector<const int*> key_ptrs;
+	std::vector<uint64_t> hashes;
+	for (const int& key : keys) {
+		key_ptrs.push_back(&key);
+		hashes.push_back(DashTable<int, int>::Hash(key));
+	}
+
+	std::vector<const int*> results(keys.size());
+	table.FindBatch(keys.size(), key_ptrs.data(), hashes.data(), results.data());
+	for (int i = 0; i < 1000; ++i) {
+		if (i % 2 == 0) {
+			ASSERT_NE(results[i], nullptr) << "key " << i;
+			EXPECT_EQ(*results[i], i * 10);
+		} else {
+			EXPECT_EQ(results[i], nullptr) << "key " << i;
+		}
+	}
+
+	int64_t erased_sum = 0;
+	const size_t erased = table.EraseBatch(keys.size(), key_ptrs.data(), hashes.data(),
+	                                       [&erased_sum](uint64_t, const int& value) { erased_sum += value; });
+	EXPECT_EQ(erased, 500U);
+	EXPECT_EQ(erased_sum, 2495000);
+	EXPECT_EQ(table.Size(), 0U);
+	EXPECT_TRUE(table.IsDirectoryConsistent());
+}
+
+TEST_F(DashTableTest, RandomEntrySamplesEveryKey) {
+	DashTable<int, int> table(1, 2);
+	std::mt19937_64 rng(42);
+	EXPECT_EQ(table.RandomEntry(rng).first, nullptr);
+
+	for (int i = 0; i < 200; ++i) {
+		table.Insert(i, i + 1);
+	}
+	std::vector<int> hits(200, 0);
+	for (int round = 0; round < 20000; ++round) {
+		auto [key, value] = table.RandomEntry(rng);
+		ASSERT_NE(key, nullptr);
+		ASSERT_EQ(*value, *key + 1);
+		++hits[*key];
+	}
+	// 期望每个 key 约 100 次; 分段结构不应让某些 key 明显偏多或饿死
+	for (int i = 0; i < 200; ++i) {
+		EXPECT_GT(hits[i], 40) << "key " << i;
+		EXPECT_LT(hits[i], 200) << "key " << i;
+	}
+
+	for (int i = 1; i < 200; ++i) {
+		table.Erase(i);
+	}
+	auto [key, value] = table.RandomEntry(rng);
+	ASSERT_NE(key, nullptr);
+	EXPECT_EQ(*key, 0);
+	(void)value;
+}
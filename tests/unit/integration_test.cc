@@ -1,17 +1,24 @@
 #include <gtest/gtest.h>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include "command/string_family.h"
+#include "command/set_family.h"
 #include "command/command_registry.h"
 #include "core/nano_obj.h"
 #include "core/database.h"
 #include "core/command_context.h"
 #include "server/engine_shard_set.h"
 #include "server/engine_shard.h"
+#include "server/pipeline.h"
 #include "server/sharding.h"
+#include "server/transaction.h"
 #include "protocol/resp_parser.h"
 
+#include <algorithm>
+#include <photon/photon.h>
+
 class MultiShardIntegrationTest : public ::testing::Test {
 protected:
 	void SetUp() override {
@@ -238,3 +245,326 @@ TEST_F(MultiShardIntegrationTest, LargeMSetMGet) {
 
 	EXPECT_EQ(ExecuteCommand("DBSIZE", {}, &ctx), ":" + std::to_string(num_keys) + "\r\n");
 }
+
+class CrossShardSetTest : public ::testing::Test {
+protected:
+	static constexpr size_t kShards = 4;
+
+	void SetUp() override {
+		photon::init(photon::INIT_EVENT_EPOLL, photon::INIT_IO_NONE);
+		shard_set = std::make_unique<EngineShardSet>(kShards);
+		for (size_t i = 0; i < kShards; ++i) {
+			EngineShard* shard = shard_set->GetShard(i);
+			shard->GetTaskQueue()->Start("shard");
+			shard_set->Await(i, [shard]() { shard->InitializeInThread(); });
+		}
+	}
+
+	void TearDown() override {
+		for (size_t i = 0; i < kShards; ++i) {
+			shard_set->GetShard(i)->GetTaskQueue()->Shutdown();
+		}
+		shard_set.reset();
+		photon::fini();
+	}
+
+	// 找一个落在 shard_id 上、以 prefix 开头的 key
+	static std::string KeyOnShard(const std::string& prefix, size_t shard_id) {
+		for (int i = 0;; ++i) {
+			std::string key = prefix + std::to_string(i);
+			if (Shard(key, kShards) == shard_id) {
+				return key;
+			}
+		}
+	}
+
+	void SAdd(const std::string& key, const std::vector<std::string>& members) {
+		std::vector<NanoObj> args = {NanoObj::FromKey("SADD"), NanoObj::FromKey(key)};
+		for (const auto& member : members) {
+			args.push_back(NanoObj::FromKey(member));
+		}
+		shard_set->Await(Shard(key, kShards), [this, &args]() {
+			CommandContext ctx(EngineShard::Tlocal(), shard_set.get(), kShards, 0);
+			(void)SetFamily::SAdd(args, &ctx);
+		});
+	}
+
+	// 在非分片线程上执行, 所有分片都经由 AwaitAll 访问
+	std::vector<std::string> Members(std::string (*command)(const std::vector<NanoObj>&, CommandContext*),
+	                                 const std::vector<std::string>& keys) {
+		std::vector<NanoObj> args = {NanoObj::FromKey("CMD")};
+		for (const auto& key : keys) {
+			args.push_back(NanoObj::FromKey(key));
+		}
+		CommandContext ctx(nullptr, shard_set.get(), kShards, 0);
+		std::vector<std::string> values;
+		ParseMembers(command(args, &ctx), &values);
+		std::sort(values.begin(), values.end());
+		return values;
+	}
+
+	static void ParseMembers(const std::string& resp, std::vector<std::string>* values) {
+		size_t pos = resp.find("\r\n") + 2;
+		while (pos < resp.size()) {
+			const size_t len_end = resp.find("\r\n", pos);
+			const size_t len = std::stoul(resp.substr(pos + 1, len_end - pos - 1));
+			values->push_back(resp.substr(len_end + 2, len));
+			pos = len_end + 2 + len + 2;
+		}
+	}
+
+	std::unique_ptr<EngineShardSet> shard_set;
+};
+
+TEST_F(CrossShardSetTest, AlgebraAcrossShards) {
+	const std::string a = KeyOnShard("a", 0);
+	const std::string b = KeyOnShard("b", 1);
+	const std::string c = KeyOnShard("c", 2);
+	SAdd(a, {"1", "2", "3", "4", "5"});
+	SAdd(b, {"2", "3", "4", "6"});
+	SAdd(c, {"3", "4", "7"});
+
+	using V = std::vector<std::string>;
+	EXPECT_EQ(Members(&SetFamily::SInter, {a, b, c}), (V {"3", "4"}));
+	EXPECT_EQ(Members(&SetFamily::SUnion, {a, b, c}), (V {"1", "2", "3", "4", "5", "6", "7"}));
+	EXPECT_EQ(Members(&SetFamily::SDiff, {a, b, c}), (V {"1", "5"}));
+	EXPECT_TRUE(Members(&SetFamily::SInter, {a, b, KeyOnShard("missing", 3)}).empty());
+
+	// 结果写到 destination 所属分片
+	const std::string dest = KeyOnShard("dest", 3);
+	std::vector<NanoObj> store = {NanoObj::FromKey("SINTERSTORE"), NanoObj::FromKey(dest), NanoObj::FromKey(a),
+	                              NanoObj::FromKey(b)};
+	CommandContext ctx(nullptr, shard_set.get(), kShards, 0);
+	EXPECT_EQ(SetFamily::SInterStore(store, &ctx), ":3\r\n");
+	EXPECT_EQ(Members(&SetFamily::SUnion, {dest}), (V {"2", "3", "4"}));
+
+	std::vector<NanoObj> card = {NanoObj::FromKey("SINTERCARD"), NanoObj::FromKey("2"), NanoObj::FromKey(a),
+	                             NanoObj::FromKey(b),          NanoObj::FromKey("LIMIT"), NanoObj::FromKey("2")};
+	EXPECT_EQ(SetFamily::SInterCard(card, &ctx), ":2\r\n");
+}
+
+class TransactionTest : public CrossShardSetTest {
+protected:
+	void SetUp() override {
+		CrossShardSetTest::SetUp();
+		StringFamily::Register(&CommandRegistry::Instance());
+		transaction = std::make_unique<Transaction>(shard_set.get(), kShards, nullptr);
+	}
+
+	void TearDown() override {
+		transaction.reset();
+		CrossShardSetTest::TearDown();
+	}
+
+	static std::vector<NanoObj> Args(const std::vector<std::string>& parts) {
+		std::vector<NanoObj> args;
+		for (const auto& part : parts) {
+			args.push_back(NanoObj::FromKey(part));
+		}
+		return args;
+	}
+
+	// 事务之外的单 key 命令: 像连接循环一样转发到 key 所在分片执行
+	std::string Run(const std::vector<std::string>& parts) {
+		std::vector<NanoObj> args = Args(parts);
+		return shard_set->Await(Shard(parts[1], kShards), [this, &args]() {
+			CommandContext ctx(EngineShard::Tlocal(), shard_set.get(), kShards, 0);
+			return CommandRegistry::Instance().Execute(args, &ctx);
+		});
+	}
+
+	// 走事务状态机; 不是事务命令时在协调者上直接执行 (多 key 命令自己做跨分片分发)
+	std::string Send(const std::vector<std::string>& parts) {
+		std::vector<NanoObj> args = Args(parts);
+		std::string response;
+		if (!transaction->Handle(args, nullptr, &response)) {
+			CommandContext ctx(nullptr, shard_set.get(), kShards, 0);
+			response = CommandRegistry::Instance().Execute(args, &ctx);
+		}
+		return response;
+	}
+
+	std::unique_ptr<Transaction> transaction;
+};
+
+TEST_F(TransactionTest, ExecAcrossShards) {
+	const std::string a = KeyOnShard("a", 0);
+	const std::string b = KeyOnShard("b", 1);
+	const std::string c = KeyOnShard("c", 2);
+
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"MULTI"}), "-ERR MULTI calls can not be nested\r\n");
+	EXPECT_EQ(Send({"SET", a, "1"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"INCR", a}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"SET", b, "x"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"PING"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"GET", c}), "+QUEUED\r\n");
+	// 入队期间命令不执行
+	EXPECT_EQ(Send({"EXISTS", a}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*6\r\n+OK\r\n:2\r\n+OK\r\n+PONG\r\n$-1\r\n:1\r\n");
+
+	EXPECT_EQ(Run({"GET", a}), "$1\r\n2\r\n");
+	EXPECT_EQ(Run({"GET", b}), "$1\r\nx\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "-ERR EXEC without MULTI\r\n");
+	EXPECT_EQ(Send({"DISCARD"}), "-ERR DISCARD without MULTI\r\n");
+
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"SET", a, "discarded"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"DISCARD"}), "+OK\r\n");
+	EXPECT_EQ(Run({"GET", a}), "$1\r\n2\r\n");
+}
+
+TEST_F(TransactionTest, QueueErrorsAbortExec) {
+	const std::string a = KeyOnShard("a", 0);
+	const std::string b = KeyOnShard("b", 1);
+
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"SET", a, "1"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"NOSUCHCMD"}), "-ERR unknown command 'NOSUCHCMD'\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "-EXECABORT Transaction discarded because of previous errors.\r\n");
+	EXPECT_EQ(Run({"GET", a}), "$-1\r\n");
+
+	// 单条命令的 key 跨分片时在入队阶段拒绝
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"MSET", a, "1", b, "2"}).rfind("-ERR CROSSSLOT", 0), 0U);
+	EXPECT_EQ(Send({"GET"}), "-ERR wrong number of arguments for 'GET' command\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "-EXECABORT Transaction discarded because of previous errors.\r\n");
+	EXPECT_EQ(Send({"EXISTS", a, b}), ":0\r\n");
+}
+
+TEST_F(TransactionTest, SinterCardLimitIsNotAKey) {
+	// key 所在分片与 "LIMIT"、"5" 都不同, 把它们当作 key 就会误报 CROSSSLOT
+	size_t shard = 0;
+	while (shard == Shard("LIMIT", kShards) || shard == Shard("5", kShards)) {
+		++shard;
+	}
+	const std::string a = KeyOnShard("a", shard);
+	SetFamily::Register(&CommandRegistry::Instance());
+	SAdd(a, {"x", "y", "z"});
+
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"SINTERCARD", "1", a, "LIMIT", "2"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"SINTERCARD", "1", a}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*2\r\n:2\r\n:3\r\n");
+}
+
+TEST_F(TransactionTest, WatchAbortsOnConcurrentWrite) {
+	const std::string a = KeyOnShard("a", 0);
+	const std::string b = KeyOnShard("b", 1);
+
+	EXPECT_EQ(Send({"WATCH", a}), "+OK\r\n");
+	// 另一个连接改写了被 WATCH 的 key
+	EXPECT_EQ(Run({"SET", a, "other"}), "+OK\r\n");
+
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"WATCH", b}), "-ERR WATCH inside MULTI is not allowed\r\n");
+	EXPECT_EQ(Send({"SET", b, "1"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*-1\r\n");
+	EXPECT_EQ(Run({"GET", b}), "$-1\r\n");
+
+	// EXEC 之后 WATCH 自动清除; 未被改动时正常执行
+	EXPECT_EQ(Send({"WATCH", a, b}), "+OK\r\n");
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"SET", b, "1"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*1\r\n+OK\r\n");
+
+	// FLUSHDB 也会使 WATCH 失效
+	EXPECT_EQ(Send({"WATCH", b}), "+OK\r\n");
+	EXPECT_EQ(Send({"FLUSHDB"}), "+OK\r\n");
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"GET", b}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*-1\r\n");
+}
+
+TEST_F(TransactionTest, WatchVersionsLiveOnKeyShards) {
+	const std::string a = KeyOnShard("a", 0);
+	const std::string b = KeyOnShard("b", 1);
+	const std::string c = KeyOnShard("c", 2);
+
+	// 跨分片 MSET 在协调者上分发, 其他分片的 key 也要使 WATCH 失效
+	EXPECT_EQ(Send({"WATCH", c}), "+OK\r\n");
+	EXPECT_EQ(Send({"MSET", a, "1", c, "2"}), "+OK\r\n");
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"SET", b, "1"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*-1\r\n");
+
+	// 被 WATCH 的 key 不在事务涉及的分片上: 在它自己的分片上检查
+	EXPECT_EQ(Send({"WATCH", c}), "+OK\r\n");
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"SET", b, "2"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*1\r\n+OK\r\n");
+
+	EXPECT_EQ(Send({"WATCH", a, c}), "+OK\r\n");
+	EXPECT_EQ(Run({"SET", c, "3"}), "+OK\r\n");
+	EXPECT_EQ(Send({"MULTI"}), "+OK\r\n");
+	EXPECT_EQ(Send({"SET", a, "x"}), "+QUEUED\r\n");
+	EXPECT_EQ(Send({"EXEC"}), "*-1\r\n");
+	EXPECT_EQ(Run({"GET", a}), "$1\r\n1\r\n");
+	EXPECT_EQ(Run({"GET", b}), "$1\r\n2\r\n");
+}
+
+// 按连接循环的方式执行一批流水线命令: 本地命令逐条执行, 跨分片命令与其后连续的单 key 命令
+// 合并成一段, 无 key 命令或 QUIT 结束一段。local_shard 为连接所在的分片
+TEST_F(CrossShardSetTest, SquashedPipelineKeepsReplyOrder) {
+	StringFamily::Register(&CommandRegistry::Instance());
+	constexpr size_t kLocalShard = 0;
+	const std::string a = KeyOnShard("a", kLocalShard);
+	const std::string b = KeyOnShard("b", 1);
+	const std::string c = KeyOnShard("c", 2);
+
+	const std::vector<std::vector<std::string>> commands = {
+	    {"SET", a, "1"},    {"SET", b, "x"}, {"INCR", a}, {"GET", b}, {"SET", c, "z"},          {"PING"},
+	    {"APPEND", b, "y"}, {"GET", a},      {"GET", c},  {"QUIT"},   {"SET", b, "after-quit"},
+	};
+	std::vector<std::vector<NanoObj>> batch;
+	for (const auto& parts : commands) {
+		std::vector<NanoObj> args;
+		for (const auto& part : parts) {
+			args.push_back(NanoObj::FromKey(part));
+		}
+		batch.push_back(std::move(args));
+	}
+	std::vector<RoutedCommand> routes;
+	for (const auto& args : batch) {
+		routes.push_back(RouteCommand(args, CommandRegistry::Instance(), kLocalShard, kShards));
+	}
+	EXPECT_FALSE(routes[0].forward);
+	EXPECT_TRUE(routes[1].forward);
+	EXPECT_EQ(routes[5].key, nullptr);
+
+	std::string replies;
+	std::vector<size_t> run_ends;
+	std::vector<std::string> squashed;
+	for (size_t i = 0; i < batch.size(); ++i) {
+		if (batch[i][0].ToString() == "QUIT") {
+			replies += "+OK\r\n";
+			break;
+		}
+		if (routes[i].forward) {
+			const size_t run_end = SquashedRunEnd(routes, i, batch.size());
+			run_ends.push_back(run_end);
+			ExecuteSquashed(batch, routes, i, run_end, shard_set.get(), kShards, 0, nullptr, &squashed);
+			for (const auto& reply : squashed) {
+				replies += reply;
+			}
+			i = run_end - 1;
+			continue;
+		}
+		const size_t target = routes[i].key != nullptr ? routes[i].target_shard : kLocalShard;
+		replies += shard_set->Await(target, [this, &batch, &routes, i]() {
+			CommandContext ctx(EngineShard::Tlocal(), shard_set.get(), kShards, 0);
+			ctx.SetKeyHash(routes[i].key, routes[i].key_hash);
+			return CommandRegistry::Instance().Execute(batch[i], &ctx);
+		});
+	}
+
+	// 两段: [1, 5) 在 PING 处结束, [6, 9) 在 QUIT 处结束; 段内有本地、远端两种 key
+	EXPECT_EQ(run_ends, (std::vector<size_t> {5, 9}));
+	EXPECT_EQ(replies, "+OK\r\n+OK\r\n:2\r\n$1\r\nx\r\n+OK\r\n+PONG\r\n:2\r\n$1\r\n2\r\n$1\r\nz\r\n+OK\r\n");
+	const std::string final_b = shard_set->Await(Shard(b, kShards), [this, &b]() {
+		CommandContext ctx(EngineShard::Tlocal(), shard_set.get(), kShards, 0);
+		std::vector<NanoObj> args = {NanoObj::FromKey("GET"), NanoObj::FromKey(b)};
+		return CommandRegistry::Instance().Execute(args, &ctx);
+	});
+	EXPECT_EQ(final_b, "$2\r\nxy\r\n");
+}
@@ -2,6 +2,9 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <utility>
+#include <vector>
+#include "core/key_hash.h"
 #include "core/nano_obj.h"
 
 class NanoObjTest : public ::testing::Test {
@@ -280,3 +283,28 @@ TEST_F(NanoObjTest, SizeForSmallString) {
 TEST_F(NanoObjTest, NanoObjSize) {
 	EXPECT_EQ(sizeof(NanoObj), 16);
 }
+
+TEST_F(NanoObjTest, ViewBorrowsUntilCopiedOrMoved) {
+	const std::string source = "a-value-longer-than-inline";
+	NanoObj view;
+	view.SetView(source);
+	EXPECT_TRUE(view.IsView());
+	EXPECT_TRUE(view.IsString());
+	EXPECT_EQ(view.GetStringView().data(), source.data());
+	EXPECT_EQ(view, NanoObj::FromString(source));
+	EXPECT_EQ(KeyHash(view), KeyHash(NanoObj::FromString(source)));
+
+	NanoObj copy(view);
+	EXPECT_FALSE(copy.IsView());
+	EXPECT_NE(copy.GetStringView().data(), source.data());
+	EXPECT_EQ(copy.ToString(), source);
+
+	// 整体移动 vector 不会移动元素, 逐个移动才会转为自有副本
+	std::vector<NanoObj> args;
+	args.emplace_back().SetView(source);
+	std::vector<NanoObj> stolen = std::move(args);
+	EXPECT_TRUE(stolen[0].IsView());
+	NanoObj moved = std::move(stolen[0]);
+	EXPECT_FALSE(moved.IsView());
+	EXPECT_EQ(moved.ToString(), source);
+}
@@ -1,10 +1,15 @@
 #include <gtest/gtest.h>
+#include "protocol/reply_builder.h"
 #include "protocol/resp_parser.h"
+#include "server/connection.h"
 #include <algorithm>
 #include <cerrno>
+#include <cstdint>
 #include <cstring>
 #include <string>
 #include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace {
 
@@ -15,9 +20,12 @@ public:
 	}
 
 public:
+	// get_underlay_fd() 返回 underlay_fd
 	Object* get_underlay_object(uint64_t recursion = 0) override {
-		(void)recursion;
-		return nullptr;
+		if (recursion != UINT64_MAX || underlay_fd < 0) {
+			return nullptr;
+		}
+		return reinterpret_cast<Object*>(static_cast<uintptr_t>(underlay_fd));
 	}
 
 	int setsockopt(int level, int option_name, const void* option_value, socklen_t option_len) override {
@@ -86,6 +94,7 @@ public:
 
 	ssize_t recv(void* buf, size_t count, int flags = 0) override {
 		(void)flags;
+		++recv_calls;
 		if (pos >= data.size()) {
 			return 0;
 		}
@@ -125,20 +134,25 @@ public:
 		return total;
 	}
 
+	// 写入的数据记录在 sent 中; 每次最多接受 max_send 字节, 用来模拟部分写
 	ssize_t send(const void* buf, size_t count, int flags = 0) override {
-		(void)buf;
-		(void)count;
 		(void)flags;
-		errno = ENOSYS;
-		return -1;
+		const size_t n = std::min(count, max_send);
+		sent.append(static_cast<const char*>(buf), n);
+		++send_calls;
+		return static_cast<ssize_t>(n);
 	}
 
 	ssize_t send(const struct iovec* iov, int iovcnt, int flags = 0) override {
-		(void)iov;
-		(void)iovcnt;
 		(void)flags;
-		errno = ENOSYS;
-		return -1;
+		size_t total = 0;
+		for (int i = 0; i < iovcnt && total < max_send; ++i) {
+			const size_t n = std::min(iov[i].iov_len, max_send - total);
+			sent.append(static_cast<const char*>(iov[i].iov_base), n);
+			total += n;
+		}
+		++send_calls;
+		return static_cast<ssize_t>(total);
 	}
 
 	ssize_t sendfile(int in_fd, off_t offset, size_t count) override {
@@ -149,6 +163,12 @@ public:
 		return -1;
 	}
 
+	std::string sent;
+	size_t max_send = SIZE_MAX;
+	size_t send_calls = 0;
+	size_t recv_calls = 0;
+	int underlay_fd = -1;
+
 private:
 	std::string data;
 	std::vector<size_t> chunk_sizes;
@@ -173,6 +193,28 @@ TEST(RESPParserTest, RespBuilder_BulkString) {
 	EXPECT_EQ("$5\r\nhello\r\n", result);
 }
 
+TEST(RESPParserTest, ReplyBuilderMatchesMakeHelpers) {
+	std::string out = "prefix";
+	ReplyBuilder reply(&out);
+	reply.ArrayHeader(6);
+	reply.SimpleString("OK");
+	reply.Error("boom");
+	reply.Integer(-42);
+	reply.BulkString("hello");
+	reply.BulkString(NanoObj::FromInt(1234));
+	reply.NullBulkString();
+
+	std::string expected = "prefix";
+	expected += RESPParser::MakeArray(6);
+	expected += RESPParser::MakeSimpleString("OK");
+	expected += RESPParser::MakeError("boom");
+	expected += RESPParser::MakeInteger(-42);
+	expected += RESPParser::MakeBulkString("hello");
+	expected += RESPParser::MakeBulkString("1234");
+	expected += RESPParser::MakeNullBulkString();
+	EXPECT_EQ(out, expected);
+}
+
 TEST(RESPParserTest, RespBuilder_NullBulkString) {
 	std::string result = RESPParser::make_null_bulk_string();
 	EXPECT_EQ("$-1\r\n", result);
@@ -237,6 +279,99 @@ TEST(RESPParserTest, ParseArrayWithBulkStrings_SpansRecvBuffers) {
 	EXPECT_EQ(args[1].ToString(), "hello world!");
 }
 
+TEST(RESPParserTest, BufferedBulkArgsBorrowReadBuffer) {
+	const std::string long_value(100, 'x');
+	const std::string cmd = "*3\r\n$3\r\nSET\r\n$20\r\nkey-longer-than-14ch\r\n$100\r\n" + long_value + "\r\n";
+	FakeSocketStream stream(cmd);
+	RESPParser parser(&stream);
+
+	std::vector<NanoObj> args;
+	ASSERT_EQ(parser.ParseCommand(args), 3);
+	EXPECT_FALSE(args[0].IsView());
+	EXPECT_TRUE(args[1].IsView());
+	EXPECT_TRUE(args[2].IsView());
+	EXPECT_EQ(args[1].ToString(), "key-longer-than-14ch");
+	EXPECT_EQ(args[2].ToString(), long_value);
+
+	// 跨越多次 recv 的命令退回拷贝
+	FakeSocketStream chunked(cmd, {10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10});
+	RESPParser chunked_parser(&chunked);
+	ASSERT_EQ(chunked_parser.ParseCommand(args), 3);
+	EXPECT_FALSE(args[1].IsView());
+	EXPECT_FALSE(args[2].IsView());
+	EXPECT_EQ(args[2].ToString(), long_value);
+}
+
+TEST(RESPParserTest, PipelinedCommandsAcrossIndexWords) {
+	// 行尾分布在位图的多个 64 位字里, bulk 内容里的 CR / LF 不能被当成行尾
+	std::string pipelined;
+	std::vector<std::string> values;
+	for (int i = 0; i < 200; ++i) {
+		std::string value = "v" + std::to_string(i) + (i % 3 == 0 ? "\r\nx\n" : "") + std::string(i % 17, 'p');
+		pipelined += "*2\r\n$4\r\nECHO\r\n$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+		values.push_back(std::move(value));
+	}
+	pipelined += "PING\n";
+	FakeSocketStream stream(pipelined, {4096, 4096, 4096});
+	RESPParser parser(&stream);
+
+	std::vector<NanoObj> args;
+	for (const std::string& value : values) {
+		ASSERT_EQ(parser.ParseCommand(args), 2);
+		EXPECT_EQ(args[1].ToString(), value);
+	}
+	ASSERT_GE(parser.ParseCommand(args), 0);
+	ASSERT_EQ(args.size(), 1U);
+	EXPECT_EQ(args[0].ToString(), "PING");
+}
+
+TEST(RESPParserTest, LargeBulkReceivedDirectlyIntoValue) {
+	// NanoObj 的字符串最长 64KB
+	std::string value(60000, 'v');
+	for (size_t i = 0; i < value.size(); i += 4096) {
+		value[i] = static_cast<char>('a' + (i / 4096) % 26);
+	}
+	const std::string request = "*3\r\n$3\r\nSET\r\n$3\r\nbig\r\n$" + std::to_string(value.size()) + "\r\n" + value +
+	                            "\r\n*1\r\n$4\r\nPING\r\n";
+	FakeSocketStream stream(request);
+	RESPParser parser(&stream);
+
+	std::vector<NanoObj> args;
+	ASSERT_EQ(parser.ParseCommand(args), 3);
+	EXPECT_EQ(args[1].ToString(), "big");
+	EXPECT_TRUE(args[2].ToString() == value);
+	// 头部一次, value 剩余部分直接读进参数一次, 结尾的 CRLF 一次; 不再按读缓冲区大小分成多次
+	EXPECT_EQ(stream.recv_calls, 3U);
+
+	ASSERT_EQ(parser.ParseCommand(args), 1);
+	EXPECT_EQ(args[0].ToString(), "PING");
+}
+
+TEST(RESPParserTest, ReleaseBufferOnlyWhenIdle) {
+	RESPParser parser(nullptr);
+	auto feed = [&parser](const std::string& data) {
+		std::memcpy(parser.WritableData(), data.data(), data.size());
+		parser.CommitRead(data.size());
+	};
+
+	std::vector<NanoObj> args;
+	feed("*2\r\n$4\r\nECHO\r\n$3\r\nab");
+	EXPECT_EQ(parser.Parse(args), RESPParser::TryParseResult::NEED_MORE);
+	// 命令解析到一半时缓冲区不能还
+	EXPECT_FALSE(parser.ReleaseBuffer());
+
+	feed("c\r\n");
+	ASSERT_EQ(parser.Parse(args), RESPParser::TryParseResult::OK);
+	EXPECT_EQ(args[1].ToString(), "abc");
+	EXPECT_EQ(parser.Parse(args), RESPParser::TryParseResult::NEED_MORE);
+	EXPECT_TRUE(parser.ReleaseBuffer());
+
+	// 还掉之后的读入重新从池中取缓冲区
+	feed("PING\r\n");
+	ASSERT_EQ(parser.Parse(args), RESPParser::TryParseResult::OK);
+	EXPECT_EQ(args[0].ToString(), "PING");
+}
+
 TEST(RESPParserTest, HasBufferedDataForPipelinedCommands) {
 	const std::string pipelined = "*1\r\n$4\r\nPING\r\n*1\r\n$4\r\nPONG\r\n";
 	FakeSocketStream stream(pipelined, {pipelined.size()});
@@ -315,3 +450,110 @@ TEST(RESPParserTest, TryParseCommandNoReadReportsMalformedBufferedCommand) {
 	EXPECT_EQ(status, RESPParser::TryParseResult::ERROR);
 	EXPECT_TRUE(args.empty());
 }
+
+TEST(RESPParserTest, ResumesAcrossSingleByteReads) {
+	const std::string value(40, 'v');
+	const std::string request = "*3\r\n$3\r\nSET\r\n$12\r\nkey:00000001\r\n$40\r\n" + value + "\r\nPING\r\n";
+	RESPParser parser(nullptr);
+
+	std::vector<NanoObj> args;
+	std::vector<std::vector<std::string>> commands;
+	for (char c : request) {
+		*parser.WritableData() = c;
+		parser.CommitRead(1);
+		if (parser.Parse(args) == RESPParser::TryParseResult::OK) {
+			std::vector<std::string> command;
+			for (const NanoObj& arg : args) {
+				command.push_back(arg.ToString());
+			}
+			commands.push_back(std::move(command));
+		} else {
+			EXPECT_TRUE(args.empty());
+		}
+	}
+	ASSERT_EQ(commands.size(), 2U);
+	EXPECT_EQ(commands[0], (std::vector<std::string> {"SET", "key:00000001", value}));
+	EXPECT_EQ(commands[1], (std::vector<std::string> {"PING"}));
+	EXPECT_FALSE(parser.HasBufferedData());
+}
+
+TEST(RESPParserTest, BorrowedArgsMaterializedWhenCommandSpansReads) {
+	const std::string key(32, 'k');
+	const std::string head = "*3\r\n$3\r\nSET\r\n$32\r\n" + key + "\r\n$5\r\nva";
+	RESPParser parser(nullptr);
+
+	std::memcpy(parser.WritableData(), head.data(), head.size());
+	parser.CommitRead(head.size());
+	std::vector<NanoObj> args;
+	EXPECT_EQ(parser.Parse(args), RESPParser::TryParseResult::NEED_MORE);
+	EXPECT_TRUE(parser.HasBufferedData());
+
+	// 数据全部消费后缓冲区从头复用, 覆盖了之前的 key
+	char* data = parser.WritableData();
+	std::memset(data, 'x', head.size());
+	std::memcpy(data, "lue\r\n", 5);
+	parser.CommitRead(5);
+	ASSERT_EQ(parser.Parse(args), RESPParser::TryParseResult::OK);
+	ASSERT_EQ(args.size(), 3U);
+	EXPECT_FALSE(args[1].IsView());
+	EXPECT_EQ(args[1].ToString(), key);
+	EXPECT_EQ(args[2].ToString(), "value");
+	EXPECT_FALSE(parser.HasBufferedData());
+}
+
+TEST(ConnectionTest, VectoredFlushKeepsReplyOrder) {
+	FakeSocketStream socket("");
+	socket.max_send = 1000;
+	Connection connection(&socket);
+
+	const std::string large = RESPParser::MakeBulkString(std::string(10000, 'v'));
+	connection.AppendResponse(RESPParser::OkResponse());
+	connection.AppendResponse(std::string(large));
+	connection.AppendResponse(std::string(":1\r\n"));
+	connection.AppendResponse(std::string(large));
+	EXPECT_EQ(connection.PendingResponseBytes(), 5 + large.size() + 4 + large.size());
+
+	ASSERT_TRUE(connection.Flush());
+	EXPECT_EQ(socket.sent, "+OK\r\n" + large + ":1\r\n" + large);
+	EXPECT_EQ(connection.PendingResponseBytes(), 0U);
+
+	// 相邻的大回复之间没有小回复; 之后直接写进回复缓冲区的内容排在大回复之后
+	socket.sent.clear();
+	connection.AppendResponse(std::string(large));
+	connection.AppendResponse(std::string(large));
+	connection.ReplyBuffer()->append(":2\r\n");
+	connection.AppendResponse(RESPParser::OkResponse());
+	ASSERT_TRUE(connection.Flush());
+	EXPECT_EQ(socket.sent, large + large + ":2\r\n+OK\r\n");
+
+	// 只有小回复时仍走单缓冲区发送
+	socket.sent.clear();
+	socket.max_send = SIZE_MAX;
+	socket.send_calls = 0;
+	connection.AppendResponse(std::string("+PONG\r\n"));
+	ASSERT_TRUE(connection.Flush());
+	EXPECT_EQ(socket.sent, "+PONG\r\n");
+	EXPECT_EQ(socket.send_calls, 1U);
+}
+
+TEST(ConnectionTest, ReadsReadyInputWithoutWaiting) {
+	int fds[2];
+	ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	FakeSocketStream socket("");
+	socket.underlay_fd = fds[0];
+	Connection connection(&socket);
+
+	// 非流水线的请求-应答: 每条命令之前缓冲区都是空的, 数据已到达时直接读到, 不等待也不走 stream 的 recv
+	const std::string ping = "*1\r\n$4\r\nPING\r\n";
+	std::vector<NanoObj> args;
+	for (int i = 0; i < 3; ++i) {
+		ASSERT_EQ(::send(fds[1], ping.data(), ping.size(), 0), static_cast<ssize_t>(ping.size()));
+		ASSERT_EQ(connection.ParseCommand(args), 1);
+		EXPECT_EQ(args[0].ToString(), "PING");
+	}
+	EXPECT_EQ(socket.recv_calls, 0U);
+
+	::close(fds[1]);
+	EXPECT_EQ(connection.ParseCommand(args), -1);
+	::close(fds[0]);
+}
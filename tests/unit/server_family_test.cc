@@ -22,7 +22,9 @@ DEFINE_int32(port, 9527, "Server listen port");
 DEFINE_int32(num_shards, 8, "Number of shards");
 DEFINE_bool(tcp_nodelay, true, "Enable TCP_NODELAY");
 DEFINE_bool(use_iouring_tcp_server, true, "Use io_uring tcp server");
+DEFINE_bool(migrate_connections, true, "Migrate connections to the owning vCPU");
 DEFINE_uint64(photon_handler_stack_kb, 256, "Photon stack size KB");
+DEFINE_bool(release_idle_buffers, true, "Release idle connection buffers");
 
 class ServerFamilyTest : public ::testing::Test {
 protected:
@@ -98,7 +100,17 @@ TEST_F(ServerFamilyTest, InfoContainsServerAndKeyspaceSections) {
 	std::string response = Execute("INFO", {});
 	EXPECT_TRUE(response.find("# Server\r\n") != std::string::npos);
 	EXPECT_TRUE(response.find("# Keyspace\r\n") != std::string::npos);
-	EXPECT_TRUE(response.find("db0:keys=1\r\n") != std::string::npos);
+	EXPECT_TRUE(response.find("db0:keys=1,expires=0,avg_ttl=0\r\n") != std::string::npos);
+}
+
+TEST_F(ServerFamilyTest, InfoKeyspaceReportsExpires) {
+	db.Set(NanoObj::FromKey("k1"), NanoObj::FromKey("v1"));
+	db.Set(NanoObj::FromKey("k2"), NanoObj::FromKey("v2"));
+	ASSERT_TRUE(db.Expire(NanoObj::FromKey("k2"), 100000));
+
+	std::string response = Execute("INFO", {"keyspace"});
+	EXPECT_TRUE(response.find("db0:keys=2,expires=1,avg_ttl=") != std::string::npos);
+	EXPECT_TRUE(response.find("avg_ttl=0\r\n") == std::string::npos);
 }
 
 TEST_F(ServerFamilyTest, ConfigGetPort) {
@@ -123,6 +135,22 @@ TEST_F(ServerFamilyTest, ConfigSetInvalidValueReturnsError) {
 	EXPECT_TRUE(response.find("Invalid argument for CONFIG SET 'tcp_nodelay'") != std::string::npos);
 }
 
+TEST_F(ServerFamilyTest, ConfigSetMaxMemoryAndPolicy) {
+	EXPECT_EQ(Execute("CONFIG", {"SET", "maxmemory", "2mb"}), "+OK\r\n");
+	EXPECT_EQ(Execute("CONFIG", {"SET", "maxmemory-policy", "allkeys-lfu"}), "+OK\r\n");
+	std::string response = Execute("CONFIG", {"GET", "maxmemory*"});
+	EXPECT_TRUE(response.find("2097152") != std::string::npos);
+	EXPECT_TRUE(response.find("allkeys-lfu") != std::string::npos);
+
+	response = Execute("CONFIG", {"SET", "maxmemory-policy", "random"});
+	EXPECT_TRUE(response.find("Invalid argument for CONFIG SET 'maxmemory-policy'") != std::string::npos);
+	response = Execute("CONFIG", {"SET", "maxmemory", "12xb"});
+	EXPECT_TRUE(response.find("Invalid argument for CONFIG SET 'maxmemory'") != std::string::npos);
+
+	EXPECT_EQ(Execute("CONFIG", {"SET", "maxmemory", "0"}), "+OK\r\n");
+	EXPECT_EQ(Execute("CONFIG", {"SET", "maxmemory-policy", "noeviction"}), "+OK\r\n");
+}
+
 TEST_F(ServerFamilyTest, ClientSetNameGetNameAndId) {
 	Connection conn(nullptr);
 
@@ -219,3 +219,39 @@ TEST_F(SetFamilyTest, ErrorCases) {
 	std::string result = SetFamily::SAdd(args, &ctx);
 	EXPECT_TRUE(result.find("wrong number of arguments") != std::string::npos);
 }
+
+TEST_F(SetFamilyTest, StoreVariantsAndInterCard) {
+	CommandContext ctx(db.get(), 0);
+
+	std::vector<NanoObj> args = {NanoObj::FromKey("SADD"), NanoObj::FromKey("set1"), NanoObj::FromKey("a"),
+	                             NanoObj::FromKey("b"), NanoObj::FromKey("c")};
+	SetFamily::SAdd(args, &ctx);
+	args = {NanoObj::FromKey("SADD"), NanoObj::FromKey("set2"), NanoObj::FromKey("b"), NanoObj::FromKey("c"),
+	        NanoObj::FromKey("d")};
+	SetFamily::SAdd(args, &ctx);
+
+	args = {NanoObj::FromKey("SUNIONSTORE"), NanoObj::FromKey("dest"), NanoObj::FromKey("set1"),
+	        NanoObj::FromKey("set2")};
+	EXPECT_EQ(SetFamily::SUnionStore(args, &ctx), ":4\r\n");
+	args = {NanoObj::FromKey("SCARD"), NanoObj::FromKey("dest")};
+	EXPECT_EQ(SetFamily::SCard(args, &ctx), ":4\r\n");
+
+	// 目标可以同时是源 key; 结果为空时删除目标
+	args = {NanoObj::FromKey("SDIFFSTORE"), NanoObj::FromKey("dest"), NanoObj::FromKey("dest"),
+	        NanoObj::FromKey("set1")};
+	EXPECT_EQ(SetFamily::SDiffStore(args, &ctx), ":1\r\n");
+	args = {NanoObj::FromKey("SINTERSTORE"), NanoObj::FromKey("dest"), NanoObj::FromKey("set1"),
+	        NanoObj::FromKey("missing")};
+	EXPECT_EQ(SetFamily::SInterStore(args, &ctx), ":0\r\n");
+	EXPECT_EQ(db->Find(NanoObj::FromKey("dest")), nullptr);
+
+	args = {NanoObj::FromKey("SINTERCARD"), NanoObj::FromKey("2"), NanoObj::FromKey("set1"),
+	        NanoObj::FromKey("set2")};
+	EXPECT_EQ(SetFamily::SInterCard(args, &ctx), ":2\r\n");
+	args.push_back(NanoObj::FromKey("LIMIT"));
+	args.push_back(NanoObj::FromKey("1"));
+	EXPECT_EQ(SetFamily::SInterCard(args, &ctx), ":1\r\n");
+	args = {NanoObj::FromKey("SINTERCARD"), NanoObj::FromKey("3"), NanoObj::FromKey("set1"),
+	        NanoObj::FromKey("set2")};
+	EXPECT_EQ(SetFamily::SInterCard(args, &ctx).substr(0, 1), "-");
+}
@@ -78,3 +78,55 @@ TEST(ShardingTest, LongKey) {
 
 	EXPECT_EQ(Shard(long_key, 8), shard_id);
 }
+
+TEST(ShardingTest, IntEncodedKeyMatchesStringForm) {
+	NanoObj int_key = NanoObj::FromKey("12345");
+	ASSERT_TRUE(int_key.IsInt());
+	EXPECT_EQ(KeyHash(int_key), KeyHash(std::string_view("12345")));
+	EXPECT_EQ(Shard(int_key, 8), Shard("12345", 8));
+
+	NanoObj str_key = NanoObj::FromKey("user:1000");
+	EXPECT_EQ(KeyHash(str_key), KeyHash(std::string_view("user:1000")));
+	EXPECT_EQ(Shard(str_key, 8), ShardOfHash(KeyHash(str_key), 8));
+}
+
+TEST(ShardingTest, AffinitySuggestsDominantRemoteShard) {
+	ShardAffinity affinity(4);
+	std::optional<size_t> target;
+	for (uint32_t i = 0; i < ShardAffinity::kWindow; ++i) {
+		// 每 8 条命令中 7 条落在分片 2
+		target = affinity.Record(i % 8 == 0 ? 1 : 2, 0);
+		if (i + 1 < ShardAffinity::kWindow) {
+			EXPECT_FALSE(target.has_value());
+		}
+	}
+	ASSERT_TRUE(target.has_value());
+	EXPECT_EQ(*target, 2u);
+
+	// 已在占优分片上, 或没有分片占优时不迁移
+	for (uint32_t i = 0; i < ShardAffinity::kWindow; ++i) {
+		target = affinity.Record(2, 2);
+	}
+	EXPECT_FALSE(target.has_value());
+	for (uint32_t i = 0; i < ShardAffinity::kWindow; ++i) {
+		target = affinity.Record(i % 2 == 0 ? 1 : 3, 0);
+	}
+	EXPECT_FALSE(target.has_value());
+}
+
+TEST(ShardingTest, HashTagColocatesKeys) {
+	EXPECT_EQ(KeyHashTag("{user:1}:name"), "user:1");
+	EXPECT_EQ(KeyHashTag("prefix{tag}suffix{other}"), "tag");
+	EXPECT_EQ(KeyHashTag("{}:empty"), "{}:empty");
+	EXPECT_EQ(KeyHashTag("no_close{tag"), "no_close{tag");
+	EXPECT_EQ(KeyHashTag("plain"), "plain");
+
+	for (int i = 0; i < 100; ++i) {
+		const std::string field = "{tenant:42}:field" + std::to_string(i);
+		EXPECT_EQ(Shard(field, 16), Shard("tenant:42", 16));
+		const NanoObj key = NanoObj::FromKey(field);
+		EXPECT_EQ(ShardOfKey(key, KeyHash(key), 16), Shard("tenant:42", 16));
+	}
+	// 没有 hash tag 的 key 路由与表查找共用同一个哈希
+	EXPECT_EQ(Shard("user:1000", 8), ShardOfHash(KeyHash(std::string_view("user:1000")), 8));
+}
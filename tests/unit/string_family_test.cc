@@ -13,6 +13,7 @@
 #include "core/nano_obj.h"
 #include "core/database.h"
 #include "core/command_context.h"
+#include "core/memory_budget.h"
 #include "server/connection.h"
 
 class StringFamilyTest : public ::testing::Test {
@@ -295,3 +296,65 @@ TEST_F(StringFamilyTest, ErrorCases) {
 	EXPECT_TRUE(Execute("INCR", {}).find("wrong number") != std::string::npos);
 	EXPECT_TRUE(Execute("APPEND", {}).find("wrong number") != std::string::npos);
 }
+
+TEST_F(StringFamilyTest, WritesOverMaxMemory) {
+	EXPECT_EQ(Execute("SET", {"k1", "v1"}), "+OK\r\n");
+	EXPECT_EQ(Execute("SET", {"k2", "v2"}), "+OK\r\n");
+
+	// 1 字节的上限总是超出
+	MemoryBudget::SetMaxMemory(1);
+	MemoryBudget::SetPolicy(EvictionPolicy::kNoEviction);
+	EXPECT_EQ(Execute("SET", {"k3", "v3"}).rfind("-OOM", 0), 0U);
+	EXPECT_EQ(Execute("GET", {"k1"}), "$2\r\nv1\r\n");
+	EXPECT_EQ(Execute("DEL", {"k2"}), ":1\r\n");
+
+	// 开启淘汰后写命令先淘汰已有的 key
+	MemoryBudget::SetPolicy(EvictionPolicy::kAllKeysLru);
+	EXPECT_EQ(Execute("SET", {"k3", "v3"}), "+OK\r\n");
+	EXPECT_EQ(Execute("EXISTS", {"k1"}), ":0\r\n");
+	// 表已空, 淘汰不掉时拒绝
+	EXPECT_EQ(Execute("DEL", {"k3"}), ":1\r\n");
+	EXPECT_EQ(Execute("SET", {"k4", "v4"}).rfind("-OOM", 0), 0U);
+
+	MemoryBudget::SetMaxMemory(0);
+	MemoryBudget::SetPolicy(EvictionPolicy::kNoEviction);
+	EXPECT_EQ(Execute("SET", {"k4", "v4"}), "+OK\r\n");
+}
+
+TEST_F(StringFamilyTest, EvictsToStayUnderRealisticMaxMemory) {
+	// 上限比当前用量多 1MB, 写入约 4MB 后必须发生淘汰
+	MemoryBudget::Calibrate();
+	const uint64_t baseline = MemoryBudget::UsedMemory();
+	ASSERT_GT(baseline, 0U);
+	MemoryBudget::SetMaxMemory(baseline + (1U << 20));
+	MemoryBudget::SetPolicy(EvictionPolicy::kAllKeysLru);
+
+	const std::string value(4096, 'x');
+	constexpr int kWrites = 1000;
+	for (int i = 0; i < kWrites; ++i) {
+		ASSERT_EQ(Execute("SET", {"big" + std::to_string(i), value}), "+OK\r\n");
+	}
+	EXPECT_LT(db.KeyCount(), static_cast<size_t>(kWrites));
+	EXPECT_GT(db.KeyCount(), 0U);
+	// 写路径不统计堆, 只靠增删 key 时记下的字节差; 每条写命令淘汰到预算以下才停,
+	// 最后最多超出一条命令的量
+	EXPECT_LE(MemoryBudget::UsedMemory(), baseline + (1U << 20) + (64U << 10));
+	EXPECT_EQ(Execute("EXISTS", {"big" + std::to_string(kWrites - 1)}), ":1\r\n");
+
+	MemoryBudget::SetMaxMemory(0);
+	MemoryBudget::SetPolicy(EvictionPolicy::kNoEviction);
+}
+
+TEST_F(StringFamilyTest, UnlinkAndAsyncFlush) {
+	EXPECT_EQ(Execute("SET", {"k1", "v1"}), "+OK\r\n");
+	EXPECT_EQ(Execute("SET", {"k2", "v2"}), "+OK\r\n");
+	EXPECT_EQ(Execute("UNLINK", {"k1", "missing"}), ":1\r\n");
+	EXPECT_EQ(Execute("EXISTS", {"k1"}), ":0\r\n");
+
+	EXPECT_EQ(Execute("FLUSHDB", {"ASYNC"}), "+OK\r\n");
+	EXPECT_EQ(Execute("DBSIZE", {}), ":0\r\n");
+	EXPECT_EQ(Execute("SET", {"k3", "v3"}), "+OK\r\n");
+	EXPECT_EQ(Execute("FLUSHALL", {"SYNC"}), "+OK\r\n");
+	EXPECT_EQ(Execute("DBSIZE", {}), ":0\r\n");
+	EXPECT_EQ(Execute("FLUSHALL", {"LATER"}), "-ERR syntax error\r\n");
+}
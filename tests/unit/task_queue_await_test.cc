@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "core/task_queue.h"
+#include "server/engine_shard_set.h"
 #include <thread>
 #include <atomic>
 #include <vector>
@@ -124,3 +125,40 @@ TEST_F(TaskQueueAwaitTest, MultipleConsumers) {
 
 	queue.Shutdown();
 }
+
+TEST_F(TaskQueueAwaitTest, AwaitAllCollectsResultsInShardOrder) {
+	EngineShardSet shard_set(4);
+	for (size_t i = 0; i < shard_set.Size(); ++i) {
+		shard_set.GetShard(i)->GetTaskQueue()->Start("shard");
+	}
+
+	std::atomic<int> calls {0};
+	std::vector<int> results = shard_set.AwaitAll({3, 1, 2}, [&calls](size_t shard_id) {
+		calls++;
+		return static_cast<int>(shard_id) * 10;
+	});
+	EXPECT_EQ(results, (std::vector<int> {30, 10, 20}));
+	EXPECT_EQ(calls.load(), 3);
+
+	std::vector<bool> even = shard_set.AwaitOnAll([](size_t shard_id) { return shard_id % 2 == 0; });
+	EXPECT_EQ(even, (std::vector<bool> {true, false, true, false}));
+
+	std::atomic<size_t> visited {0};
+	shard_set.AwaitOnAll([&visited](size_t shard_id) { visited += shard_id + 1; });
+	EXPECT_EQ(visited.load(), 10u);
+
+	// 某个分片抛出异常时仍等待其他分片完成, 再向调用方重新抛出
+	std::atomic<int> finished {0};
+	EXPECT_THROW(shard_set.AwaitOnAll([&finished](size_t shard_id) {
+		if (shard_id == 2) {
+			throw std::runtime_error("shard failure");
+		}
+		finished++;
+	}),
+	             std::runtime_error);
+	EXPECT_EQ(finished.load(), 3);
+
+	for (size_t i = 0; i < shard_set.Size(); ++i) {
+		shard_set.GetShard(i)->GetTaskQueue()->Shutdown();
+	}
+}